@@ -0,0 +1,49 @@
+/* ========================================================================
+ * [PROJECT]    SIR100
+ * [MODULE]     MMC driver
+ * [TITLE]      Media index of the card include file
+ * [FILE]       cardindex.h
+ * [VSN]        1.0
+ * [CREATED]    19 october 2026
+ * [LASTCHNGD]  19 october 2026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    persistent index of the MP3 files on the card
+ * ======================================================================== */
+#ifndef _CardIndex_H
+#define _CardIndex_H
+
+#include <sys/types.h>
+
+#include "tag.h"
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define CARD_INDEX_PATH_LEN     128     // "FM0:" + path of 8.3 names
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+
+/*!\brief One MP3 file as kept in the index file (128 bytes) */
+typedef struct _TCardIndexFile
+{
+    u_long  ulCluster;                      // first cluster
+    u_long  ulSize;                         // size in bytes
+    u_short usDir;                          // index of its directory
+    char    szName[13];                     // 8.3 name
+    u_char  ucReserved;
+    TTagInfo tTag;                          // title and artist, may be empty
+} TCardIndexFile;
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern int CardIndexOpen(void);
+extern void CardIndexClose(void);
+extern u_short CardIndexGetNrofFiles(void);
+extern int CardIndexGetFile(u_short usIndex, TCardIndexFile *ptFile);
+extern int CardIndexGetPath(u_short usIndex, char *pszPath, u_short usSize);
+
+#endif /* _CardIndex_H */
+/*    End Of File    */
@@ -76,22 +76,61 @@
  * supported, set it to 1
  */
 #define FAT_SUPPORT_FORMAT        1
+#define FAT_SUPPORT_WRITE         1
 
 /*
  * IOCTL-Function
  */
 #define FAT_IOCTL_QUICK_FORMAT    0x1000
+#define FAT_IOCTL_GET_CLUSTER_SIZE 0x1001  /* conf points to a DWORD */
+#define FAT_IOCTL_GET_VOLUME_INFO  0x1002  /* conf points to a FATVOLINFO */
 
 /*-------------------------------------------------------------------------*/
 /* global types                                                            */
 /*-------------------------------------------------------------------------*/
 
+/*
+ * Directory enumeration, see FATDirOpen
+ */
+#define FAT_DIRENT_NAME_LEN       64
+
+#define FAT_ATTR_READ_ONLY        0x01
+#define FAT_ATTR_HIDDEN           0x02
+#define FAT_ATTR_SYSTEM           0x04
+#define FAT_ATTR_DIRECTORY        0x10
+#define FAT_ATTR_ARCHIVE          0x20
+
+typedef struct _fat_dirent
+{
+    char  szName[FAT_DIRENT_NAME_LEN];  /* long name if present, else 8.3 */
+    char  szShortName[13];              /* 8.3 name, always present */
+    BYTE  bAttribute;
+    DWORD dwSize;
+    DWORD dwCluster;                    /* first cluster */
+} FATDIRENT;
+
+typedef struct _fat_dir FATDIR;
+
+/*
+ * Identification of a mounted volume, see FATGetVolumeInfo. The free
+ * count and next free hint change whenever clusters are allocated or
+ * freed, by us or by whoever had the card before.
+ */
+typedef struct _fat_volinfo
+{
+    DWORD dwVolumeID;                   /* serial number, 0 if none */
+    DWORD dwFreeCount;                  /* 0xFFFFFFFF if not known (FAT16) */
+    DWORD dwNextFree;
+} FATVOLINFO;
+
 /*-------------------------------------------------------------------------*/
 /* global macros                                                           */
 /*-------------------------------------------------------------------------*/
 #define FAT_IOCTL(_a,_b,_c)   ((NUTDEVICE *)_a)->dev_ioctl((_a), (_b), (_c))
 
 #define FATQuickFormat(_a)    FAT_IOCTL(_a, FAT_IOCTL_QUICK_FORMAT, NULL)
+#define FATGetClusterSize(_a,_b) FAT_IOCTL(_a, FAT_IOCTL_GET_CLUSTER_SIZE, (_b))
+#define FATGetVolumeInfo(_a,_b)  FAT_IOCTL(_a, FAT_IOCTL_GET_VOLUME_INFO, (_b))
  
 
 /*-------------------------------------------------------------------------*/
@@ -99,6 +138,10 @@
 /*-------------------------------------------------------------------------*/
 extern NUTDEVICE devFAT;
 
+extern FATDIR *FATDirOpen(NUTDEVICE *pDevice, CONST char *pPath);
+extern int     FATDirRead(FATDIR *pDir, FATDIRENT *pEntry);
+extern void    FATDirClose(FATDIR *pDir);
+
 #if (FAT_USE_IDE_INTERFACE >= 1)
 extern NUTDEVICE devFATCF;
 extern NUTDEVICE devFATIDE0;
@@ -112,6 +155,8 @@ extern NUTDEVICE devFATUSB0;
 #if (FAT_USE_MMC_INTERFACE >= 1)
 extern NUTDEVICE devFATMMC0;
 extern void FATRelease(void);
+extern void FATDiscard(void);
+extern int  FATSync(void);
 
 #endif
 
@@ -50,6 +50,14 @@
 #define FAT_USE_USB_INTERFACE     0
 #define FAT_USE_MMC_INTERFACE     1 
 
+/*
+ * Host builds only (tools/fatbench): the MMC drive is backed
+ * by an image file instead of the card, see imgdrv.c
+ */
+#ifndef FAT_USE_IMAGE_INTERFACE
+#define FAT_USE_IMAGE_INTERFACE   0
+#endif
+
 
 #if (FAT_USE_IDE_INTERFACE >= 1)
 #include "ide.h"
@@ -86,7 +94,22 @@
 #endif /* (FAT_USE_USB_INTERFACE >= 1) */
 
 
-#if (FAT_USE_MMC_INTERFACE >= 1)
+#if (FAT_USE_MMC_INTERFACE >= 1) && (FAT_USE_IMAGE_INTERFACE >= 1)
+#include "imgdrv.h"
+
+#define HW_SUPPORT_WRITE  IMG_SUPPORT_WRITE
+#define HW_SUPPORT_ATAPI  IMG_SUPPORT_ATAPI
+
+#define HW_OK             IMG_OK
+#define HW_ERROR          IMG_ERROR
+
+#define HW_DRIVE_C        IMG_DRIVE_C
+#define HW_DRIVE_D        IMG_DRIVE_C
+#define HW_DRIVE_E        IMG_DRIVE_C
+
+#define HW_SECTOR_SIZE    IMG_SECTOR_SIZE
+
+#elif (FAT_USE_MMC_INTERFACE >= 1)
 #include "mmcdrv.h"
 
 #define HW_SUPPORT_WRITE  MMC_SUPPORT_WRITE
@@ -138,7 +161,17 @@
 #define HWWriteSectors      USBWriteSectors
 #endif /* (FAT_USE_USB_INTERFACE == 1) */
 
-#if (FAT_USE_MMC_INTERFACE >= 1)
+#if (FAT_USE_MMC_INTERFACE >= 1) && (FAT_USE_IMAGE_INTERFACE >= 1)
+#define HWInit              IMGInit
+#define HWMountAllDevices   IMGMountAllDevices
+#define HWGetSectorSize     IMGGetSectorSize
+#define HWIsCDROMDevice     IMGIsCDROMDevice
+#define HWIsZIPDevice       IMGIsZIPDevice
+#define HWUnMountDevice     IMGUnMountDevice
+#define HWGetTotalSectors   IMGGetTotalSectors
+#define HWReadSectors       IMGReadSectors  
+#define HWWriteSectors      IMGWriteSectors
+#elif (FAT_USE_MMC_INTERFACE >= 1)
 #define HWInit              MMCInit
 #define HWMountAllDevices   MMCMountAllDevices
 #define HWGetSectorSize     MMCGetSectorSize
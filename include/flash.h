@@ -32,6 +32,16 @@
 #define AT45DB0321B 5
 #define AT45DB0642  6
 
+/*
+ *  dataflash memory map. Page numbers are valid for the smallest device
+ *  that is fitted (AT45DB041B: 2048 pages of 264 bytes). The last page is
+ *  kept free for the (optional) parameter page, see USE_FLASH_PARAM_PAGE
+ */
+#define FLASH_PLUGIN_PAGE           1536    // decoder plugin/patch images
+#define FLASH_PLUGIN_NROF_PAGES     256
+#define FLASH_SETTINGS_PAGE         1792    // settings log, see settings.c
+#define FLASH_SETTINGS_NROF_PAGES   8
+
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
@@ -51,7 +61,17 @@ extern int At45dbInit(void);
 extern int At45dbPageErase(u_int off);
 extern int At45dbChipErase(void);
 extern int At45dbPageRead(u_long pgn, void *data, u_int len);
+extern int At45dbRead(u_long pgn, u_int off, void *data, u_int len);
+extern u_int At45dbPageSize(void);
+extern void At45dbLock(void);
+extern void At45dbUnlock(void);
 extern int At45dbPageWrite(u_long pgn, CONST void *data, u_int len);
+extern int At45dbBufferLoad(u_long pgn);
+extern int At45dbBufferWrite(u_int off, CONST void *data, u_int len);
+extern int At45dbBufferFlash(u_long pgn);
+extern int At45dbWriteBegin(u_long pgn);
+extern int At45dbWriteData(CONST void *data, u_int len);
+extern int At45dbWriteEnd(void);
 
 #ifdef USE_FLASH_PARAM_PAGE
 extern int At45dbParamRead(u_int pos, void *data, u_int len);
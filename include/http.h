@@ -0,0 +1,54 @@
+#ifndef _Http_H
+#define _Http_H
+/*
+ *  Copyright STREAMIT BV, 2010.
+ *
+ *  Project             : SIR
+ *  Module              : Http
+ *  File name  $Workfile: Http.h  $
+ *       Last Save $Date: 2003/08/23 18:39:38  $
+ *             $Revision: 0.1  $
+ *  Creation Date       : 2003/08/23 18:39:38
+ *
+ *  Description         : Http client routines
+ *
+ */
+
+/*--------------------------------------------------------------------------*/
+/*  Include files                                                           */
+/*--------------------------------------------------------------------------*/
+#include <stdio.h>
+
+/*--------------------------------------------------------------------------*/
+/*  Constant definitions                                                    */
+/*--------------------------------------------------------------------------*/
+
+/*!\brief Request modes, see HttpSendRequest() */
+#define HTTP_AUTH           0x0001      /* add Basic authentication */
+
+/*--------------------------------------------------------------------------*/
+/*  Type declarations                                                       */
+/*--------------------------------------------------------------------------*/
+
+/*!\brief Parts of a URL, all point into the parsed URL */
+typedef struct
+{
+    char *pszHost;
+    char *pszPort;
+    char *pszPath;                      /* without the leading '/' */
+} TUrlParts;
+
+/*--------------------------------------------------------------------------*/
+/*  Global variables                                                        */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*  Global functions                                                        */
+/*--------------------------------------------------------------------------*/
+extern int Base64EncodedSize(size_t tNrOfBytes);
+extern size_t Base64Encode(char *szDest, CONST u_char *pSrc, size_t tSize);
+extern u_long GetHostByName(CONST char *szHostName);
+extern void HttpParseUrl(char *szUrl, TUrlParts *tUrlParts);
+extern int HttpSendRequest(FILE *ptStream, CONST char *pszHeaders, u_short wMode);
+
+#endif /* _Http_H */
@@ -0,0 +1,88 @@
+/****************************************************************************
+*  This file is part of the FAT device driver.
+*
+*  Image file driver, a stand-in for the MMC driver on a host. The sectors
+*  come from a file holding a copy of a card (MBR, FAT16 or FAT32), every
+*  sector read and written is counted.
+*
+****************************************************************************
+*  History:
+*
+*  19.10.26         First Version
+****************************************************************************/
+#ifndef __IMGDRV_H__
+#define __IMGDRV_H__
+
+#include "typedefs.h"
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define IMG_SUPPORT_WRITE               1
+#define IMG_SUPPORT_ATAPI               0
+
+#define IMG_OK                          0x00
+#define IMG_ERROR                       0x01
+#define IMG_DRIVE_NOT_FOUND             0x02
+#define IMG_PARAM_ERROR                 0x03
+
+#define IMG_DRIVE_C                     0
+
+//
+// Sector size
+//
+#define IMG_SECTOR_SIZE                 512
+#define MAX_SECTOR_SIZE                 IMG_SECTOR_SIZE
+
+/*-------------------------------------------------------------------------*/
+/* global types                                                            */
+/*-------------------------------------------------------------------------*/
+typedef void IMG_MOUNT_FUNC(int nDevice);
+
+//
+// Counters, see IMGGetStats
+//
+typedef struct _img_stats
+{
+    DWORD dwReadCalls;              /* calls of IMGReadSectors      */
+    DWORD dwReadSectors;            /* sectors read by them         */
+    DWORD dwWriteCalls;             /* calls of IMGWriteSectors     */
+    DWORD dwWriteSectors;           /* sectors written by them      */
+} IMG_STATS;
+
+/*-------------------------------------------------------------------------*/
+/* global macros                                                           */
+/*-------------------------------------------------------------------------*/
+
+/*-------------------------------------------------------------------------*/
+/* Prototypes                                                              */
+/*-------------------------------------------------------------------------*/
+int IMGSetImage(const char *pPath);
+
+void IMGGetStats(IMG_STATS *pStats);
+
+void IMGResetStats(void);
+
+int IMGInit(int nIMGMode, IMG_MOUNT_FUNC * pMountFunc, IMG_MOUNT_FUNC * pUnMountFunc);
+
+int IMGMountAllDevices(int nIMGMode, BYTE *pSectorBuffer);
+
+int IMGGetSectorSize(BYTE bDevice);
+
+int IMGIsCDROMDevice(BYTE bDevice);
+
+int IMGIsZIPDevice(BYTE bDevice);
+
+int IMGUnMountDevice(BYTE bDevice);
+
+DWORD IMGGetTotalSectors(BYTE bDevice);
+
+int IMGReadSectors(BYTE bDevice, void *pData, DWORD dwStartSector, WORD wSectorCount);
+
+#if (IMG_SUPPORT_WRITE == 1)
+
+int IMGWriteSectors(BYTE bDevice, void *pData, DWORD dwStartSector, WORD wSectorCount);
+
+#endif
+
+#endif /* !__IMGDRV_H__ */
@@ -0,0 +1,125 @@
+#ifndef _Inet_H
+#define _Inet_H
+/*
+ *  Copyright STREAMIT BV, 2010.
+ *
+ *  Project             : SIR
+ *  Module              : Inet
+ *  File name  $Workfile: Inet.h  $
+ *       Last Save $Date: 2006/02/24 13:46:16  $
+ *             $Revision: 0.1  $
+ *  Creation Date       : 2006/02/24 13:46:16
+ *
+ *  Description         : Internet (HTTP/ICY) client sessions
+ *
+ */
+
+/*--------------------------------------------------------------------------*/
+/*  Include files                                                           */
+/*--------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <sys/socket.h>
+
+#include "typedefs.h"
+#include "http.h"
+
+/*--------------------------------------------------------------------------*/
+/*  Constant definitions                                                    */
+/*--------------------------------------------------------------------------*/
+
+/*!\brief Options of InetHttpOpenRequest() */
+#define INET_FLAG_ADD_SERIAL            0x0001  /* add our serial number to a path ending in '=' */
+#define INET_FLAG_ICY_META_REQ          0x0002  /* ask for ICY meta data */
+#define INET_FLAG_CLOSE                 0x0004  /* ask the server to close after the response */
+#define INET_FLAG_NO_AUTH               0x0008  /* do not retry with authentication */
+
+/*!\brief Info levels of InetHttpQueryInfo() */
+#define INET_HTTP_QUERY_STATUS_CODE     0x0001
+#define INET_HTTP_QUERY_LOCATION        0x0002
+#define INET_HTTP_QUERY_CONTENT_LENGTH  0x0004
+#define INET_HTTP_QUERY_CONTENT_TYPE    0x0008
+#define INET_HTTP_QUERY_ICY_METADATA    0x0010
+#define INET_HTTP_QUERY_MOD_NUMERIC     0x8000  /* return the value as a long */
+
+/*!\brief Protocol of the response */
+#define INET_PROTO_HTTP                 1
+#define INET_PROTO_ICY                  2
+
+/*!\brief Content, see InetGetMimeType() */
+#define MIME_TYPE_UNKNOWN               0
+#define MIME_TYPE_MP3                   1
+#define MIME_TYPE_PLS                   2
+#define MIME_TYPE_M3U                   3
+#define MIME_TYPE_TEXT                  4
+
+/*--------------------------------------------------------------------------*/
+/*  Type declarations                                                       */
+/*--------------------------------------------------------------------------*/
+
+/*!\brief State of a session, used to abort it from another thread */
+typedef enum
+{
+    INET_STATE_IDLE = 0,                /* not in a call */
+    INET_STATE_BUSY,                    /* in a call that may block */
+    INET_STATE_CLOSING                  /* InetClose() waits for the call to end */
+} TInetState;
+
+/*!\brief The request and the response headers */
+typedef struct _INETREQ
+{
+    char *pszRequest;
+    unsigned int unRequestBufSize;
+    unsigned int unRequestInUse;
+    char *pszResponse;
+    unsigned int unResponseBufSize;
+    unsigned int unResponseInUse;
+    unsigned short wOptions;            /* INET_FLAG_xxx */
+    unsigned short wHttpMode;           /* HTTP_xxx */
+    unsigned char byProto;              /* INET_PROTO_xxx */
+} INETREQ, *HINETREQ;
+
+/*!\brief Problems seen, each is allowed a few times */
+typedef struct
+{
+    unsigned char byNoDnsCount;
+    unsigned char byNoConnectCount;
+    unsigned char byBadResponseCount;
+} TInetRetries;
+
+/*!\brief A session, see InetOpen() */
+typedef struct _INET
+{
+    volatile TInetState tState;
+    char *pszUrl;
+    TUrlParts tUrlParts;                /* point into pszUrl */
+    u_long ulIpAddress;
+    u_short wPort;
+    TCPSOCKET *ptSocket;
+    FILE *ptStream;
+    u_long ulRecvTimeout;
+    unsigned int unMss;
+    unsigned int unTcpRecvBufSize;
+    TInetRetries tRetries;
+    HINETREQ hRequest;
+} INET, *HINET;
+
+/*--------------------------------------------------------------------------*/
+/*  Global variables                                                        */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*  Global functions                                                        */
+/*--------------------------------------------------------------------------*/
+extern HINET InetOpen(void);
+extern TError InetConnect(HINET hInet, CONST char *pszUrl, unsigned long ulRecvTimeout, unsigned int unMss, unsigned int unTcpRecvBufSize);
+extern TError InetHttpOpenRequest(HINET hInet, CONST char *pszMethod, CONST char *pszPath, CONST char *pszAccept, unsigned short wOptions);
+extern int InetHttpAddRequestHeaders(HINET hInet, CONST char *pszNewHeaders);
+extern TError InetHttpSendRequest(HINET hInet);
+extern int InetHttpQueryInfo(HINET hInet, unsigned short wInfoLevel, void **pInfo, unsigned int *punInfoSize, int *pnIndex);
+extern int InetGetMimeType(HINET hInet);
+extern int InetRead(HINET hInet, char *pcBuf, unsigned int unBufSize);
+extern int InetReadExact(HINET hInet, unsigned char *pbyBuf, unsigned int unBufSize);
+extern int InetReadFile(HINET hInet, char **ppcBuf, unsigned int *punBufSize);
+extern HINET InetClose(HINET hInet);
+
+#endif /* _Inet_H */
@@ -32,6 +32,9 @@ extern u_char CardCheckCard(void);          // check by examining physical PIN
 extern u_char CardCheckPresent(void);       // check by examining administration
 extern TError CardPlayMp3File(char *path);
 extern void CardStopMp3File(void);
+extern TError CardAppendMp3File(char *path);
+extern void CardReleaseMp3File(void);
+extern u_char CardReadAheadBusy(void);
 extern void CardUpdateTicks(void);
 extern u_char CardGetNumberOfPlayLists(void);
 
@@ -0,0 +1,35 @@
+/* ========================================================================
+ * [PROJECT]    SIR100
+ * [MODULE]     Player
+ * [TITLE]      Audio source selection include file
+ * [FILE]       player.h
+ * [VSN]        1.0
+ * [CREATED]    19 october 2026
+ * [LASTCHNGD]  19 october 2026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    feeds the decoder from an internet stream and falls back
+ *              to the card when the stream cannot be played
+ * ======================================================================== */
+#ifndef _Player_H
+#define _Player_H
+
+#include "typedefs.h"
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define PLAYER_SOURCE_NONE      0
+#define PLAYER_SOURCE_STREAM    1
+#define PLAYER_SOURCE_CARD      2       // fallback, see STATUS_FALLBACK_ACTIVE
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern TError PlayerInit(void);
+extern TError PlayerPlayStream(CONST char *pszUrl);
+extern void PlayerStop(void);
+extern TError PlayerStatus(void);
+extern u_char PlayerGetSource(void);
+
+#endif /* _Player_H */
+/*    End Of File    */
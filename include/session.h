@@ -0,0 +1,42 @@
+#ifndef _Session_H
+#define _Session_H
+/*
+ *  Copyright STREAMIT BV, 2010.
+ *
+ *  Project             : SIR
+ *  Module              : Session
+ *  File name  $Workfile: Session.h  $
+ *       Last Save $Date: 2003/08/16 15:01:36  $
+ *             $Revision: 0.1  $
+ *  Creation Date       : 2003/08/16 15:01:36
+ *
+ *  Description         : Network interface (ethernet) bring-up
+ *
+ */
+
+/*--------------------------------------------------------------------------*/
+/*  Include files                                                           */
+/*--------------------------------------------------------------------------*/
+#include "typedefs.h"
+
+/*--------------------------------------------------------------------------*/
+/*  Constant definitions                                                    */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*  Type declarations                                                       */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*  Global variables                                                        */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*  Global functions                                                        */
+/*--------------------------------------------------------------------------*/
+extern TError SessionInit(void);
+extern TError SessionOpen(void);
+extern TError SessionStatus(void);
+extern TError SessionClose(void);
+
+#endif /* _Session_H */
@@ -0,0 +1,51 @@
+/* ========================================================================
+ * [PROJECT]    SIR100
+ * [MODULE]     Settings
+ * [TITLE]      Persistent settings include file
+ * [FILE]       settings.h
+ * [VSN]        1.0
+ * [CREATED]    19 october 2026
+ * [LASTCHNGD]  19 october 2026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    key/value settings kept as a log in the serial dataflash
+ * ======================================================================== */
+#ifndef _Settings_H
+#define _Settings_H
+
+#include <sys/types.h>
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+
+/*
+ *  keys of the settings. Never re-use or renumber a key, the values
+ *  written by older firmware stay on the flash
+ */
+#define SETTINGS_KEY_VOLUME         0x00    // u_char left, u_char right
+#define SETTINGS_KEY_DHCP           0x01    // u_char
+#define SETTINGS_KEY_IP             0x02    // dotted string
+#define SETTINGS_KEY_NETMASK        0x03    // dotted string
+#define SETTINGS_KEY_GATEWAY        0x04    // dotted string
+#define SETTINGS_KEY_DNS1           0x05    // dotted string
+#define SETTINGS_KEY_DNS2           0x06    // dotted string
+#define SETTINGS_KEY_STATION        0x07    // u_short, last played preset
+#define SETTINGS_KEY_STREAM_URL     0x08    // string, stream played at power-up
+
+#define SETTINGS_MAX_KEYS           32
+
+/*
+ *  all settings together must fit in one page of the smallest dataflash
+ *  (264 bytes, less 6 bytes page header and 3 bytes per setting)
+ */
+#define SETTINGS_MAX_LEN            64
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern int SettingsInit(void);
+extern int SettingsGet(u_char ucKey, void *pData, u_char ucLen);
+extern int SettingsSet(u_char ucKey, CONST void *pData, u_char ucLen);
+
+#endif /* _Settings_H */
+/*    End Of File    */
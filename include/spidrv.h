@@ -47,6 +47,10 @@ extern u_char SPItransferByte(u_char);      // send byte using SPI, return resul
 extern void SPIinit(void);                  // initialise SPI-registers (speed, mode)
 extern void SPImode(u_char data);
 extern u_char SPIgetmode(void);
+extern void SPIsetSpeed(TSPIDevice Device, u_char bSpeed);
+extern void SPIlock(void);                  // claim the bus for one transaction
+extern void SPIunlock(void);
+extern void SPItransfer(TSPIDevice Device, CONST u_char *pTx, u_char *pRx, u_short wLen);
 
 #endif /* _SPI_H */
 /*    End Of File    */
@@ -0,0 +1,68 @@
+/* ========================================================================
+ * [PROJECT]    SIR100
+ * [MODULE]     Tag
+ * [TITLE]      ID3/APE tag parser include file
+ * [FILE]       tag.h
+ * [VSN]        1.0
+ * [CREATED]    19 october 2026
+ * [LASTCHNGD]  19 october 2026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    keep ID3 and APE tags away from the decoder, pick up the
+ *              title and artist on the way
+ * ======================================================================== */
+#ifndef _Tag_H
+#define _Tag_H
+
+#include <sys/types.h>
+
+/*-------------------------------------------------------------------------*/
+/* global defines                                                          */
+/*-------------------------------------------------------------------------*/
+#define TAG_TEXT_LEN            52      // including the '\0'
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+
+/*!\brief Title and artist as found in the tags, empty if not present */
+typedef struct _TTagInfo
+{
+    char szTitle[TAG_TEXT_LEN];
+    char szArtist[TAG_TEXT_LEN];
+} TTagInfo;
+
+/*!\brief State of the ID3v2 parser, see TagParserFeed */
+typedef struct _TTagParser
+{
+    TTagInfo *ptInfo;               // NULL if nothing is to be extracted
+    u_long  ulTagLeft;              // bytes of the current tag not seen yet
+    u_long  ulSkip;                 // bytes to drop in TAG_STATE_SKIP
+    u_long  ulFrameLeft;            // bytes of the text frame not seen yet
+    u_char  ucState;
+    u_char  ucVersion;              // 2, 3 or 4
+    u_char  ucFooter;               // a footer follows the current tag
+    u_char  ucCount;                // bytes collected in aucHdr
+    u_char  aucHdr[10];             // tag, extended or frame header
+    char   *pszText;                // title or artist being filled
+    u_char  ucTextIdx;
+    u_char  ucTextEnc;              // encoding byte of the frame
+    u_char  ucTextBE;               // UTF-16 is big endian
+    u_char  ucTextHave;             // bytes pending in ucTextPrev
+    u_char  ucTextPrev;             // first half of a UTF-16 unit, UTF-8 lead
+    u_char  ucTextSkip;             // data length indicator still to skip
+    u_char  ucUnsync;               // frame is unsynchronised
+    u_char  ucLastFF;               // previous byte was 0xFF
+} TTagParser;
+
+/*-------------------------------------------------------------------------*/
+/* export global routines (interface)                                      */
+/*-------------------------------------------------------------------------*/
+extern void TagParserInit(TTagParser *ptParser, TTagInfo *ptInfo);
+extern u_short TagParserFeed(TTagParser *ptParser, CONST u_char *pucData, u_short usLen);
+extern u_long TagParserSkip(TTagParser *ptParser);
+extern void TagParserSkipped(TTagParser *ptParser, u_long ulSkipped);
+extern u_char TagParserDone(TTagParser *ptParser);
+extern int TagScanFile(int nFile, u_long ulSize, TTagInfo *ptInfo, u_long *pulStart, u_long *pulEnd);
+
+#endif /* _Tag_H */
+/*    End Of File    */
@@ -0,0 +1,53 @@
+#ifndef _Util_H
+#define _Util_H
+/*
+ *  Copyright STREAMIT BV, 2010.
+ *
+ *  Project             : SIR
+ *  Module              : Util
+ *  File name  $Workfile: Util.h  $
+ *       Last Save $Date: 2006/05/11 9:53:22  $
+ *             $Revision: 0.1  $
+ *  Creation Date       : 2006/05/11 9:53:22
+ *
+ *  Description         : Utility functions for the SIR project
+ *
+ */
+
+/*--------------------------------------------------------------------------*/
+/*  Include files                                                           */
+/*--------------------------------------------------------------------------*/
+#include <sys/heap.h>
+
+/*--------------------------------------------------------------------------*/
+/*  Constant definitions                                                    */
+/*--------------------------------------------------------------------------*/
+
+/*!\brief Free memory allocated by MyMalloc. NULL is allowed. */
+#define MyFree(p)       do { if ((p) != NULL) { NutHeapFree(p); } } while (0)
+
+/*--------------------------------------------------------------------------*/
+/*  Type declarations                                                       */
+/*--------------------------------------------------------------------------*/
+
+/*!\brief One row of a lookup table, see LutSearch() */
+typedef struct
+{
+    PGM_P pszTag;                       /* text to match, NULL ends the table */
+    void *pDesc;                        /* returned on a match */
+} tLut;
+
+/*--------------------------------------------------------------------------*/
+/*  Global variables                                                        */
+/*--------------------------------------------------------------------------*/
+
+/*--------------------------------------------------------------------------*/
+/*  Global functions                                                        */
+/*--------------------------------------------------------------------------*/
+extern void *MyMalloc(unsigned int unSize);
+extern char *strdup(CONST char *str);
+extern int BufferMakeRoom(char **ppcBuf, unsigned int *punBufSize, unsigned int unBufInUse, unsigned int unSizeNeeded);
+extern int BufferAddString(char **ppcBuf, unsigned int *punBufSize, unsigned int *punBufInUse, CONST char *pszString);
+extern void *LutSearch(CONST tLut tLookupTable[], CONST char *pcText, unsigned char byLen);
+
+#endif /* _Util_H */
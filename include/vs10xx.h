@@ -131,6 +131,20 @@
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
+/*!
+ * \brief Decoder telemetry, sampled once per second.
+ */
+typedef struct _VS_SAMPLE
+{
+    u_long  ulWallTime;             // NutGetSeconds() at the time of sampling
+    u_short wDecodeTime;            // decoded seconds (VS_DECODE_TIME_REG)
+    u_short wFormat;                // stream format (VS_HDAT1_REG)
+    u_short wBitrate;               // kbps
+    u_short wSampleRate;            // Hz
+    u_char  bChannels;              // 1 mono, 2 stereo
+    u_char  bStatus;                // player status (VS_STATUS_...)
+    u_char  bDreqDuty;              // DREQ high during the last second (percent)
+} TVsSample;
 
 /*-------------------------------------------------------------------------*/
 /* export global variables                                                 */
@@ -151,6 +165,8 @@ extern u_short VsMemoryTest(void);
 extern u_short VsGetType(void);
 extern u_short VsGetTypeHex(void);
 extern int VsSetVolume(u_char left, u_char right);
+extern int VsVolumeFade(u_char left, u_char right, u_short ms);
+extern u_char VsVolumeFading(void);
 extern u_short VsGetVolume(void);
 extern int VsBeep(u_char fsin, u_short ms);
 extern int VsBeepStart(u_char fsin);
@@ -158,7 +174,14 @@ extern int VsBeepStartRaw(u_char Raw);
 extern int VsBeepStop(void);
 extern u_short VsRegInfo(u_char reg);
 extern void VsRegWrite(u_char reg, u_short data);
+extern void VsRegQueue(u_char reg, u_short data);
+extern void VsMainBeat(void);
 extern u_short VsStreamValid(void);
 
+extern int VsTelemetryGet(u_char bIndex, TVsSample *ptSample);
+extern int VsTelemetryDrift(void);
+extern void VsTelemetryDump(void);
+extern u_short VsGetRecoveryCount(void);
+
 
 /*@}*/
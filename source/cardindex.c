@@ -0,0 +1,783 @@
+/* ========================================================================
+ * [PROJECT]    SIR100
+ * [MODULE]     MMC driver
+ * [TITLE]      Media index of the card
+ * [FILE]       cardindex.c
+ * [VSN]        1.0
+ * [CREATED]    19 october 2026
+ * [LASTCHNGD]  19 october 2026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    builds, stores and reads back an index of the MP3 files on
+ *              the card, so browsing or shuffling does not need to walk
+ *              the directory tree
+ * ======================================================================== */
+
+/*
+ *  The index is kept on the card itself, in MEDIA0.IDX and MEDIA1.IDX in
+ *  the root. A new index is always written to the file that does not hold
+ *  the current one and its header (with the magic) is written last, so a
+ *  card pulled halfway leaves the previous index intact.
+ *
+ *  Layout of an index file:
+ *
+ *      0                       header, padded to one sector
+ *      512                     usFiles TCardIndexFile records (128 bytes)
+ *      512 + usFiles * 128     usDirs TCardIndexDir records (32 bytes)
+ *
+ *  The files of one directory are consecutive. The path of a file is
+ *  found by walking the parents of its directory record.
+ *
+ *  The index belongs to a volume (serial number) and to the state of its
+ *  FAT (FSInfo free count and next free cluster). When both match, the
+ *  index is used as is, which costs a few sector reads. Otherwise every
+ *  directory is read again and hashed, only directories with a changed
+ *  hash have their files (and ID3 tags) probed again.
+ *
+ *  Without FSInfo (FAT16) the FAT state is unknown. Every directory is
+ *  then hashed first and a new index is only written when a directory
+ *  was added, removed or changed.
+ */
+
+#define LOG_MODULE  LOG_MMC_MODULE
+
+#include <string.h>
+#include <stdio.h>
+#include <io.h>
+#include <fcntl.h>
+
+#include <sys/heap.h>
+
+#include "system.h"
+#include "log.h"
+#include "fat.h"
+#include "tag.h"
+#include "cardindex.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+#define CARD_INDEX_MAGIC        0x58444D49UL    // "IMDX"
+#define CARD_INDEX_VERSION      1
+#define CARD_INDEX_HDR_SIZE     512             // records start on a sector
+#define CARD_INDEX_MAX_DIRS     64              // RAM used while building
+#define CARD_INDEX_MAX_DEPTH    8
+#define CARD_INDEX_NO_DIR       0xFFFF
+#define CARD_INDEX_NO_SLOT      0xFF
+
+#define CARD_INDEX_FNV_BASIS    2166136261UL
+#define CARD_INDEX_FNV_PRIME    16777619UL
+
+#define FSINFO_UNKNOWN          0xFFFFFFFFUL
+
+/*--------------------------------------------------------------------------*/
+/*  Type declarations                                                       */
+/*--------------------------------------------------------------------------*/
+/*!\brief Header at the start of an index file */
+typedef struct _TCardIndexHdr
+{
+    u_long  ulMagic;                        // written last
+    u_char  ucVersion;
+    u_char  ucReserved;
+    u_short usDirs;
+    u_short usFiles;
+    u_short usReserved;
+    u_long  ulGeneration;                   // the highest valid one is used
+    u_long  ulVolumeID;
+    u_long  ulFreeCount;                    // FAT state when written
+    u_long  ulNextFree;
+} TCardIndexHdr;
+
+/*!\brief One directory as kept in the index file (32 bytes) */
+typedef struct _TCardIndexDir
+{
+    u_long  ulCluster;                      // first cluster, 0 for the root
+    u_long  ulSignature;                    // hash over its entries
+    u_short usParent;                       // CARD_INDEX_NO_DIR for the root
+    u_short usFirstFile;
+    u_short usFiles;
+    char    szName[13];                     // 8.3 name
+    u_char  aucReserved[5];
+} TCardIndexDir;
+
+/*-------------------------------------------------------------------------*/
+/* local variable definitions                                              */
+/*-------------------------------------------------------------------------*/
+/*!\brief header of the index in use */
+static TCardIndexHdr g_tIndexHdr;
+
+/*!\brief file (0 or 1) that holds the index in use, CARD_INDEX_NO_SLOT if none */
+static u_char g_ucIndexSlot = CARD_INDEX_NO_SLOT;
+
+/*!\brief directories found while building */
+static TCardIndexDir *g_ptDirs;
+
+/*
+ *  kept out of the stack of the CardPresent thread
+ */
+static char g_szPath[CARD_INDEX_PATH_LEN];
+static TCardIndexFile g_tFile;
+static FATDIRENT g_tEntry;
+
+/*-------------------------------------------------------------------------*/
+/* local routines (prototyping)                                            */
+/*-------------------------------------------------------------------------*/
+static int IndexOpenSlot(u_char ucSlot, int nMode);
+static int IndexReadHeader(u_char ucSlot, TCardIndexHdr *ptHdr);
+static int IndexDirPath(TCardIndexDir *ptDirs, u_short usDir, char *pszPath, u_short usSize);
+static int IndexIsOwnFile(u_short usDir, FATDIRENT *ptEntry);
+static u_long IndexHash(u_long ulHash, CONST void *pData, u_short usLen);
+static int IndexScanDir(u_short usDir, u_short *pusDirs);
+static int IndexCopyFiles(int nOld, TCardIndexDir *ptOldDir, int nNew, u_short usDir);
+static int IndexScanFiles(int nNew, u_short usDir, u_short *pusFiles);
+static int IndexUnchanged(TCardIndexHdr *ptOld, u_char ucOldSlot);
+static int IndexBuild(TCardIndexHdr *ptOld, u_char ucOldSlot);
+
+
+/*!
+ * \addtogroup Card
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief open one of the two index files
+ *
+ * \param   ucSlot 0 or 1
+ * \param   nMode flags for _open, _O_BINARY is added
+ *
+ * \return  file descriptor or -1
+ */
+static int IndexOpenSlot(u_char ucSlot, int nMode)
+{
+    char szName[16];
+
+    sprintf_P(szName, PSTR("FM0:MEDIA%d.IDX"), ucSlot);
+    return(_open(szName, nMode | _O_BINARY));
+}
+
+/*!
+ * \brief read and check the header of one of the index files
+ *
+ * \return  0 if it holds a complete index, -1 otherwise
+ */
+static int IndexReadHeader(u_char ucSlot, TCardIndexHdr *ptHdr)
+{
+    int nFile;
+    int iResult = -1;
+
+    if ((nFile = IndexOpenSlot(ucSlot, _O_RDONLY)) != -1)
+    {
+        if ((_read(nFile, ptHdr, sizeof(TCardIndexHdr)) == sizeof(TCardIndexHdr)) &&
+            (ptHdr->ulMagic == CARD_INDEX_MAGIC) &&
+            (ptHdr->ucVersion == CARD_INDEX_VERSION))
+        {
+            iResult = 0;
+        }
+        _close(nFile);
+    }
+    return(iResult);
+}
+
+/*!
+ * \brief build "FM0:dir/sub" for a directory
+ *
+ * Parents always have a lower index than their children.
+ *
+ * \return  0 on success, -1 if the path does not fit
+ */
+static int IndexDirPath(TCardIndexDir *ptDirs, u_short usDir, char *pszPath, u_short usSize)
+{
+    u_short ausChain[CARD_INDEX_MAX_DEPTH];
+    u_char ucDepth = 0;
+    u_short usLen;
+
+    while (usDir != 0)
+    {
+        if (ucDepth == CARD_INDEX_MAX_DEPTH)
+        {
+            return(-1);
+        }
+        ausChain[ucDepth++] = usDir;
+        usDir = ptDirs[usDir].usParent;
+    }
+
+    strcpy_P(pszPath, PSTR("FM0:"));
+    usLen = 4;
+    while (ucDepth != 0)
+    {
+        char *pszName = ptDirs[ausChain[--ucDepth]].szName;
+
+        if (usLen + strlen(pszName) + 2 > usSize)
+        {
+            return(-1);
+        }
+        if (usLen > 4)
+        {
+            pszPath[usLen++] = '/';
+        }
+        strcpy(&pszPath[usLen], pszName);
+        usLen += strlen(pszName);
+    }
+    return(0);
+}
+
+/*!
+ * \brief check for our own index files, which change on every build
+ */
+static int IndexIsOwnFile(u_short usDir, FATDIRENT *ptEntry)
+{
+    return((usDir == 0) &&
+           ((strcasecmp_P(ptEntry->szShortName, PSTR("MEDIA0.IDX")) == 0) ||
+            (strcasecmp_P(ptEntry->szShortName, PSTR("MEDIA1.IDX")) == 0)));
+}
+
+/*!
+ * \brief FNV-1a hash, used as signature of a directory
+ */
+static u_long IndexHash(u_long ulHash, CONST void *pData, u_short usLen)
+{
+    CONST u_char *pucData = (CONST u_char *)pData;
+
+    while (usLen--)
+    {
+        ulHash = (ulHash ^ *pucData++) * CARD_INDEX_FNV_PRIME;
+    }
+    return(ulHash);
+}
+
+/*!
+ * \brief hash the entries of a directory and queue its subdirectories
+ *
+ * The signature is stored in g_ptDirs[usDir], the subdirectories are
+ * added at the end of g_ptDirs.
+ *
+ * \param   pusDirs number of directories in g_ptDirs, updated
+ *
+ * \return  0 on success, -1 if the directory is too deep or unreadable
+ */
+static int IndexScanDir(u_short usDir, u_short *pusDirs)
+{
+    FATDIR *pDir;
+    u_long ulSignature = CARD_INDEX_FNV_BASIS;
+
+    if ((IndexDirPath(g_ptDirs, usDir, g_szPath, sizeof(g_szPath)) != 0) ||
+        ((pDir = FATDirOpen(&devFATMMC0, (usDir == 0) ? "/" : &g_szPath[4])) == NULL))
+    {
+        return(-1);
+    }
+
+    while (FATDirRead(pDir, &g_tEntry) == 1)
+    {
+        if (IndexIsOwnFile(usDir, &g_tEntry))
+        {
+            continue;
+        }
+        ulSignature = IndexHash(ulSignature, g_tEntry.szName, strlen(g_tEntry.szName));
+        ulSignature = IndexHash(ulSignature, &g_tEntry.bAttribute, sizeof(g_tEntry.bAttribute));
+        ulSignature = IndexHash(ulSignature, &g_tEntry.dwSize, sizeof(g_tEntry.dwSize));
+        ulSignature = IndexHash(ulSignature, &g_tEntry.dwCluster, sizeof(g_tEntry.dwCluster));
+
+        if ((g_tEntry.bAttribute & FAT_ATTR_DIRECTORY) && (g_tEntry.dwCluster != 0))
+        {
+            if (*pusDirs == CARD_INDEX_MAX_DIRS)
+            {
+                LogMsg_P(LOG_WARNING, PSTR("Index: skipping [%s]"), g_tEntry.szName);
+                continue;
+            }
+            g_ptDirs[*pusDirs].ulCluster = g_tEntry.dwCluster;
+            g_ptDirs[*pusDirs].usParent = usDir;
+            strcpy(g_ptDirs[*pusDirs].szName, g_tEntry.szShortName);
+            ++*pusDirs;
+        }
+    }
+    FATDirClose(pDir);
+    g_ptDirs[usDir].ulSignature = ulSignature;
+
+    return(0);
+}
+
+/*!
+ * \brief copy the file records of an unchanged directory from the old index
+ *
+ * \return  0 on success, -1 on error
+ */
+static int IndexCopyFiles(int nOld, TCardIndexDir *ptOldDir, int nNew, u_short usDir)
+{
+    u_short usFile;
+
+    if (_seek(nOld, CARD_INDEX_HDR_SIZE + (long)ptOldDir->usFirstFile * sizeof(TCardIndexFile), SEEK_SET) < 0)
+    {
+        return(-1);
+    }
+    for (usFile = 0; usFile < ptOldDir->usFiles; usFile++)
+    {
+        if (_read(nOld, &g_tFile, sizeof(TCardIndexFile)) != sizeof(TCardIndexFile))
+        {
+            return(-1);
+        }
+        g_tFile.usDir = usDir;
+        if (_write(nNew, &g_tFile, sizeof(TCardIndexFile)) != sizeof(TCardIndexFile))
+        {
+            return(-1);
+        }
+    }
+    return(0);
+}
+
+/*!
+ * \brief write a record for every MP3 file in a directory
+ *
+ * g_szPath must hold the path of the directory.
+ *
+ * \param   pusFiles number of files in the index, updated
+ *
+ * \return  0 on success, -1 on error
+ */
+static int IndexScanFiles(int nNew, u_short usDir, u_short *pusFiles)
+{
+    FATDIR *pDir;
+    u_short usLen = strlen(g_szPath);
+    char *pExt;
+    u_long ulStart;
+    u_long ulEnd;
+    int nFile;
+    int iResult = 0;
+
+    if ((pDir = FATDirOpen(&devFATMMC0, &g_szPath[4])) == NULL)
+    {
+        return(-1);
+    }
+
+    while (FATDirRead(pDir, &g_tEntry) == 1)
+    {
+        pExt = strrchr(g_tEntry.szShortName, '.');
+        if ((g_tEntry.bAttribute & FAT_ATTR_DIRECTORY) ||
+            (pExt == NULL) || (strcasecmp_P(pExt, PSTR(".mp3")) != 0))
+        {
+            continue;
+        }
+        if ((*pusFiles == CARD_INDEX_NO_DIR - 1) ||
+            (usLen + strlen(g_tEntry.szShortName) + 2 > sizeof(g_szPath)))
+        {
+            continue;
+        }
+
+        memset(&g_tFile, 0, sizeof(TCardIndexFile));
+        g_tFile.ulCluster = g_tEntry.dwCluster;
+        g_tFile.ulSize = g_tEntry.dwSize;
+        g_tFile.usDir = usDir;
+        strcpy(g_tFile.szName, g_tEntry.szShortName);
+
+        /*
+         *  probe the tags, a file that cannot be read is indexed without
+         */
+        sprintf_P(&g_szPath[usLen], (usLen > 4) ? PSTR("/%s") : PSTR("%s"), g_tEntry.szShortName);
+        if ((nFile = _open(g_szPath, _O_RDONLY | _O_BINARY)) != -1)
+        {
+            TagScanFile(nFile, g_tFile.ulSize, &g_tFile.tTag, &ulStart, &ulEnd);
+            _close(nFile);
+        }
+        g_szPath[usLen] = 0;
+
+        if (_write(nNew, &g_tFile, sizeof(TCardIndexFile)) != sizeof(TCardIndexFile))
+        {
+            iResult = -1;
+            break;
+        }
+        ++*pusFiles;
+    }
+    FATDirClose(pDir);
+
+    return(iResult);
+}
+
+/*!
+ * \brief check whether the directories on the card still match an index
+ *
+ * Every directory is hashed the way IndexBuild() does it, but nothing is
+ * written. The directories are visited in the same order, so an
+ * unchanged tree gives the same directory records.
+ *
+ * \param   ptOld header of the current index
+ * \param   ucOldSlot file that holds the current index
+ *
+ * \return  1 when no directory was added, removed or changed, 0 otherwise
+ */
+static int IndexUnchanged(TCardIndexHdr *ptOld, u_char ucOldSlot)
+{
+    TCardIndexDir tOldDir;
+    u_short usDirs = 1;
+    u_short usDir;
+    int nOld;
+    int iResult = 0;
+
+    if ((g_ptDirs = NutHeapAllocClear(CARD_INDEX_MAX_DIRS * sizeof(TCardIndexDir))) == NULL)
+    {
+        return(0);
+    }
+
+    if ((nOld = IndexOpenSlot(ucOldSlot, _O_RDONLY)) != -1)
+    {
+        if (_seek(nOld, CARD_INDEX_HDR_SIZE + (long)ptOld->usFiles * sizeof(TCardIndexFile), SEEK_SET) >= 0)
+        {
+            iResult = 1;
+            g_ptDirs[0].usParent = CARD_INDEX_NO_DIR;
+            for (usDir = 0; (usDir < usDirs) && (iResult == 1); usDir++)
+            {
+                IndexScanDir(usDir, &usDirs);                   // unreadable keeps signature 0, as in the index
+                if ((usDirs > ptOld->usDirs) ||
+                    (_read(nOld, &tOldDir, sizeof(TCardIndexDir)) != sizeof(TCardIndexDir)) ||
+                    (tOldDir.ulCluster != g_ptDirs[usDir].ulCluster) ||
+                    (tOldDir.ulSignature != g_ptDirs[usDir].ulSignature))
+                {
+                    iResult = 0;
+                }
+            }
+            if (usDirs != ptOld->usDirs)
+            {
+                iResult = 0;
+            }
+        }
+        _close(nOld);
+    }
+
+    NutHeapFree(g_ptDirs);
+    g_ptDirs = NULL;
+
+    return(iResult);
+}
+
+/*!
+ * \brief write a new index, reusing the records of unchanged directories
+ *
+ * Directories are handled breadth first, g_ptDirs doubles as the queue.
+ *
+ * \param   ptOld header of the current index, NULL if there is none
+ * \param   ucOldSlot file that holds the current index
+ *
+ * \return  0 on success, -1 on error
+ */
+static int IndexBuild(TCardIndexHdr *ptOld, u_char ucOldSlot)
+{
+    TCardIndexHdr tHdr;
+    TCardIndexDir *ptOldDirs = NULL;
+    TCardIndexDir *ptDir;
+    FATVOLINFO tVol;
+    u_char ucSlot = (ptOld != NULL) ? (ucOldSlot ^ 1) : 0;
+    u_short usDirs = 1;
+    u_short usDir;
+    u_short usOld;
+    u_short usFiles = 0;
+    u_short usReused = 0;
+    int nOld = -1;
+    int nNew;
+    int iResult = 0;
+
+    if ((g_ptDirs = NutHeapAllocClear(CARD_INDEX_MAX_DIRS * sizeof(TCardIndexDir))) == NULL)
+    {
+        return(-1);
+    }
+
+    /*
+     *  the directories of the old index are needed to find unchanged ones
+     */
+    if ((ptOld != NULL) && (ptOld->usDirs != 0) &&
+        ((ptOldDirs = NutHeapAlloc(ptOld->usDirs * sizeof(TCardIndexDir))) != NULL))
+    {
+        if (((nOld = IndexOpenSlot(ucOldSlot, _O_RDONLY)) == -1) ||
+            (_seek(nOld, CARD_INDEX_HDR_SIZE + (long)ptOld->usFiles * sizeof(TCardIndexFile), SEEK_SET) < 0) ||
+            (_read(nOld, ptOldDirs, ptOld->usDirs * sizeof(TCardIndexDir)) != (int)(ptOld->usDirs * sizeof(TCardIndexDir))))
+        {
+            NutHeapFree(ptOldDirs);
+            ptOldDirs = NULL;
+        }
+    }
+
+    if ((nNew = IndexOpenSlot(ucSlot, _O_WRONLY | _O_CREAT | _O_TRUNC)) == -1)
+    {
+        iResult = -1;
+    }
+    else
+    {
+        /*
+         *  room for the header, it is written when everything else is there
+         */
+        memset(&g_tFile, 0, sizeof(TCardIndexFile));
+        for (usDir = 0; usDir < CARD_INDEX_HDR_SIZE / sizeof(TCardIndexFile); usDir++)
+        {
+            if (_write(nNew, &g_tFile, sizeof(TCardIndexFile)) != sizeof(TCardIndexFile))
+            {
+                iResult = -1;
+            }
+        }
+    }
+
+    g_ptDirs[0].usParent = CARD_INDEX_NO_DIR;
+    for (usDir = 0; (usDir < usDirs) && (iResult == 0); usDir++)
+    {
+        ptDir = &g_ptDirs[usDir];
+        ptDir->usFirstFile = usFiles;
+
+        if (IndexScanDir(usDir, &usDirs) != 0)
+        {
+            continue;                               // too deep or unreadable
+        }
+
+        /*
+         *  reuse the records when the directory did not change
+         */
+        for (usOld = 0; (ptOldDirs != NULL) && (usOld < ptOld->usDirs); usOld++)
+        {
+            if ((ptOldDirs[usOld].ulCluster == ptDir->ulCluster) &&
+                (ptOldDirs[usOld].ulSignature == ptDir->ulSignature))
+            {
+                break;
+            }
+        }
+        if ((ptOldDirs != NULL) && (usOld < ptOld->usDirs))
+        {
+            iResult = IndexCopyFiles(nOld, &ptOldDirs[usOld], nNew, usDir);
+            usFiles += ptOldDirs[usOld].usFiles;
+            usReused += ptOldDirs[usOld].usFiles;
+        }
+        else
+        {
+            iResult = IndexScanFiles(nNew, usDir, &usFiles);
+        }
+        ptDir->usFiles = usFiles - ptDir->usFirstFile;
+    }
+
+    if (iResult == 0)
+    {
+        if (_write(nNew, g_ptDirs, usDirs * sizeof(TCardIndexDir)) != (int)(usDirs * sizeof(TCardIndexDir)))
+        {
+            iResult = -1;
+        }
+    }
+    if (nNew != -1)
+    {
+        _close(nNew);
+    }
+    if (nOld != -1)
+    {
+        _close(nOld);
+    }
+    if (ptOldDirs != NULL)
+    {
+        NutHeapFree(ptOldDirs);
+    }
+    NutHeapFree(g_ptDirs);
+    g_ptDirs = NULL;
+
+    /*
+     *  the FAT state is taken after the index itself has been written,
+     *  rewriting the header in place does not allocate anything
+     */
+    if ((iResult == 0) && (FATGetVolumeInfo(&devFATMMC0, &tVol) == 0) &&
+        ((nNew = IndexOpenSlot(ucSlot, _O_RDWR)) != -1))
+    {
+        memset(&tHdr, 0, sizeof(tHdr));
+        tHdr.ulMagic = CARD_INDEX_MAGIC;
+        tHdr.ucVersion = CARD_INDEX_VERSION;
+        tHdr.usDirs = usDirs;
+        tHdr.usFiles = usFiles;
+        tHdr.ulGeneration = (ptOld != NULL) ? ptOld->ulGeneration + 1 : 1;
+        tHdr.ulVolumeID = tVol.dwVolumeID;
+        tHdr.ulFreeCount = tVol.dwFreeCount;
+        tHdr.ulNextFree = tVol.dwNextFree;
+
+        if (_write(nNew, &tHdr, sizeof(tHdr)) != sizeof(tHdr))
+        {
+            iResult = -1;
+        }
+        _close(nNew);
+
+        if (iResult == 0)
+        {
+            g_tIndexHdr = tHdr;
+            g_ucIndexSlot = ucSlot;
+            LogMsg_P(LOG_INFO, PSTR("Index: %u files in %u dirs, %u reused"), usFiles, usDirs, usReused);
+            return(0);
+        }
+    }
+
+    LogMsg_P(LOG_ERR, PSTR("Index: cannot write the index"));
+    return(-1);
+}
+
+/*!
+ * \brief load the media index of the card, (re)build it when needed
+ *
+ * To be called after the card has been mounted. This may take long when
+ * the card is new or its contents changed.
+ *
+ * \return  0 on success, -1 if there is no index available
+ */
+int CardIndexOpen(void)
+{
+    TCardIndexHdr atHdr[2];
+    FATVOLINFO tVol;
+    u_char ucSlot = CARD_INDEX_NO_SLOT;
+    u_char ucIdx;
+
+    g_ucIndexSlot = CARD_INDEX_NO_SLOT;
+
+    if (FATGetVolumeInfo(&devFATMMC0, &tVol) != 0)
+    {
+        return(-1);
+    }
+
+    /*
+     *  take the newest complete index of this volume
+     */
+    for (ucIdx = 0; ucIdx < 2; ucIdx++)
+    {
+        if ((IndexReadHeader(ucIdx, &atHdr[ucIdx]) == 0) &&
+            (atHdr[ucIdx].ulVolumeID == tVol.dwVolumeID) &&
+            ((ucSlot == CARD_INDEX_NO_SLOT) || (atHdr[ucIdx].ulGeneration > atHdr[ucSlot].ulGeneration)))
+        {
+            ucSlot = ucIdx;
+        }
+    }
+
+    /*
+     *  without FSInfo (FAT16) the FAT state says nothing, check the directories
+     */
+    if ((ucSlot != CARD_INDEX_NO_SLOT) &&
+        (((tVol.dwFreeCount != FSINFO_UNKNOWN) &&
+          (atHdr[ucSlot].ulFreeCount == tVol.dwFreeCount) &&
+          (atHdr[ucSlot].ulNextFree == tVol.dwNextFree)) ||
+         ((tVol.dwFreeCount == FSINFO_UNKNOWN) &&
+          (IndexUnchanged(&atHdr[ucSlot], ucSlot) == 1))))
+    {
+        g_tIndexHdr = atHdr[ucSlot];
+        g_ucIndexSlot = ucSlot;
+        LogMsg_P(LOG_INFO, PSTR("Index: %u files"), g_tIndexHdr.usFiles);
+        return(0);
+    }
+
+    return(IndexBuild((ucSlot != CARD_INDEX_NO_SLOT) ? &atHdr[ucSlot] : NULL, ucSlot));
+}
+
+/*!
+ * \brief forget the index, the card is gone
+ */
+void CardIndexClose(void)
+{
+    g_ucIndexSlot = CARD_INDEX_NO_SLOT;
+}
+
+/*!
+ * \brief return the number of MP3 files in the index
+ */
+u_short CardIndexGetNrofFiles(void)
+{
+    return((g_ucIndexSlot == CARD_INDEX_NO_SLOT) ? 0 : g_tIndexHdr.usFiles);
+}
+
+/*!
+ * \brief read the record of one file from the index
+ *
+ * \param   usIndex 0 .. CardIndexGetNrofFiles() - 1
+ * \param   ptFile receives the record
+ *
+ * \return  0 on success, -1 on error
+ */
+int CardIndexGetFile(u_short usIndex, TCardIndexFile *ptFile)
+{
+    int nFile;
+    int iResult = -1;
+
+    if ((g_ucIndexSlot == CARD_INDEX_NO_SLOT) || (usIndex >= g_tIndexHdr.usFiles))
+    {
+        return(-1);
+    }
+
+    if ((nFile = IndexOpenSlot(g_ucIndexSlot, _O_RDONLY)) != -1)
+    {
+        if ((_seek(nFile, CARD_INDEX_HDR_SIZE + (long)usIndex * sizeof(TCardIndexFile), SEEK_SET) >= 0) &&
+            (_read(nFile, ptFile, sizeof(TCardIndexFile)) == sizeof(TCardIndexFile)))
+        {
+            iResult = 0;
+        }
+        _close(nFile);
+    }
+    return(iResult);
+}
+
+/*!
+ * \brief build the full path of a file, to be used with _open()
+ *
+ * \param   usIndex 0 .. CardIndexGetNrofFiles() - 1
+ * \param   pszPath receives "FM0:dir/sub/NAME.MP3"
+ * \param   usSize size of pszPath
+ *
+ * \return  0 on success, -1 on error
+ */
+int CardIndexGetPath(u_short usIndex, char *pszPath, u_short usSize)
+{
+    TCardIndexDir tDir;
+    char aszNames[CARD_INDEX_MAX_DEPTH][13];
+    u_char ucDepth = 0;
+    u_short usDir;
+    u_short usLen;
+    int nFile;
+    int iResult = 0;
+
+    if (CardIndexGetFile(usIndex, &g_tFile) != 0)
+    {
+        return(-1);
+    }
+    if ((nFile = IndexOpenSlot(g_ucIndexSlot, _O_RDONLY)) == -1)
+    {
+        return(-1);
+    }
+
+    /*
+     *  collect the directories up to the root, deepest first
+     */
+    usDir = g_tFile.usDir;
+    while (usDir != 0)
+    {
+        if ((ucDepth == CARD_INDEX_MAX_DEPTH) || (usDir >= g_tIndexHdr.usDirs) ||
+            (_seek(nFile, CARD_INDEX_HDR_SIZE + (long)g_tIndexHdr.usFiles * sizeof(TCardIndexFile) +
+                   (long)usDir * sizeof(TCardIndexDir), SEEK_SET) < 0) ||
+            (_read(nFile, &tDir, sizeof(TCardIndexDir)) != sizeof(TCardIndexDir)))
+        {
+            iResult = -1;
+            break;
+        }
+        strcpy(aszNames[ucDepth++], tDir.szName);
+        usDir = tDir.usParent;
+    }
+    _close(nFile);
+
+    if (iResult == 0)
+    {
+        strcpy_P(pszPath, PSTR("FM0:"));
+        usLen = 4;
+        while (ucDepth != 0)
+        {
+            --ucDepth;
+            if (usLen + strlen(aszNames[ucDepth]) + 2 > usSize)
+            {
+                return(-1);
+            }
+            usLen += sprintf_P(&pszPath[usLen], PSTR("%s/"), aszNames[ucDepth]);
+        }
+        if (usLen + strlen(g_tFile.szName) + 1 > usSize)
+        {
+            return(-1);
+        }
+        strcpy(&pszPath[usLen], g_tFile.szName);
+    }
+    return(iResult);
+}
+
+/* ---------- end of module ------------------------------------------------ */
+
+/*@}*/
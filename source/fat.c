@@ -80,14 +80,18 @@
 
 #include <string.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
 
 #include <sys/heap.h>
 #include <sys/event.h>
 #include <sys/thread.h>
 
 #include <sys/device.h>
+#include <fs/fs.h>
+#include <fcntl.h>
 
 #include "typedefs.h"
 
@@ -95,6 +99,7 @@
 #include "fatdrv.h"
 #include "portio.h"
 #include "log.h"
+#include "rtc.h"
 
 
 /*==========================================================*/
@@ -117,6 +122,61 @@
 
 #define FAT_MAX_DRIVE                   3
 
+//
+// Number of FAT sectors kept in the FAT cache (LRU)
+//
+#ifndef FAT_CACHE_ENTRIES
+#define FAT_CACHE_ENTRIES               4
+#endif
+
+//
+// Marker for "no file sector in the sector buffer"
+//
+#define FAT_NO_SECTOR                   0xFFFFFFFF
+
+//
+// Number of private sector buffers handed out to open files,
+// a file that gets none uses the shared sector buffer (max 8)
+//
+#ifndef FAT_HANDLE_BUFFERS
+#define FAT_HANDLE_BUFFERS              2
+#endif
+
+//
+// Max number of contiguous runs kept in the extent map of a file
+//
+#ifndef FAT_MAX_EXTENTS
+#define FAT_MAX_EXTENTS                 16
+#endif
+
+//
+// Number of resolved path components kept in the dentry cache (LRU)
+//
+#ifndef FAT_DENTRY_ENTRIES
+#define FAT_DENTRY_ENTRIES              8
+#endif
+
+//
+// Longest name (incl. the terminating 0) kept in the dentry cache,
+// longer names are always looked up in the directory
+//
+#ifndef FAT_DENTRY_NAME_LEN
+#define FAT_DENTRY_NAME_LEN             32
+#endif
+
+#define FAT_EXTENT_NONE                 0   /* map not built yet        */
+#define FAT_EXTENT_PARTIAL              1   /* map covers a file prefix */
+#define FAT_EXTENT_COMPLETE             2   /* map covers the file      */
+
+//
+// FHANDLE Flags
+//
+#define FILE_FLAG_WRITE                 0x01    /* opened for writing       */
+#define FILE_FLAG_APPEND                0x02    /* every write at the EOF   */
+#define FILE_FLAG_DIRTY                 0x04    /* dir entry must be updated */
+
+#define FSINFO_UNKNOWN                  0xFFFFFFFF
+
 //
 // Some defines for the FAT structures
 //
@@ -337,6 +397,28 @@ typedef struct _fat_entry_table32
     DWORD aEntry[128];
 } FAT_ENTRY_TABLE32;
 
+//
+// Entry of the FAT sector cache
+//
+typedef struct _fat_cache
+{
+    BYTE  bValid;
+    BYTE  bDevice;
+    BYTE  bDirty;
+    WORD  wLastUse;
+    DWORD dwSector;
+    BYTE *pData;
+} FAT_CACHE;
+
+//
+// Position of a short directory entry
+//
+typedef struct _fat_dir_pos
+{
+    DWORD dwSector;
+    BYTE  bIndex;
+} FAT_DIR_POS;
+
 typedef union _fat_dir_table
 {
     FAT32_DIRECTORY_ENTRY      aShort[16];
@@ -361,8 +443,44 @@ typedef struct _drive_info
     DWORD dwCluster2StartSector;
 
     DWORD dwClusterSize;
+
+    BYTE  bNumFATs;
+    BYTE  bFSInfoDirty;
+    DWORD dwMaxCluster;                 /* last cluster number + 1      */
+    DWORD dwFSInfoSector;               /* 0 if there is no FSInfo      */
+    DWORD dwFreeCount;                  /* FSINFO_UNKNOWN if not known  */
+    DWORD dwNextFree;                   /* where to look for a free one */
+    DWORD dwVolumeID;                   /* serial number, 0 if none     */
 } DRIVE_INFO;
 
+//
+// Entry of the dentry cache: (parent cluster, name) -> file
+//
+typedef struct _fat_dentry
+{
+    BYTE        bValid;
+    BYTE        bDevice;
+    BYTE        bAttribute;             /* attribute searched for       */
+    BYTE        bNameLen;
+    WORD        wLastUse;
+    DWORD       dwParent;
+    DWORD       dwHash;
+    DWORD       dwCluster;
+    DWORD       dwSize;
+    FAT_DIR_POS sDirPos;
+    char        szName[FAT_DENTRY_NAME_LEN]; /* upper case      */
+} FAT_DENTRY;
+
+//
+// Run of contiguous clusters of a file
+//
+typedef struct _fat_extent
+{
+    DWORD dwCluster;                    /* first cluster of the run       */
+    DWORD dwIndex;                      /* its cluster index in the file  */
+    DWORD dwLength;                     /* number of clusters in the run  */
+} FAT_EXTENT;
+
 typedef struct _fhandle
 {
     DWORD      dwFileSize;
@@ -374,10 +492,48 @@ typedef struct _fhandle
     int         nLastError;
     int         nEOF;
 
+    FAT_EXTENT *pExtent;                /* extent map, or NULL          */
+    BYTE        bExtents;               /* used entries of the map      */
+    BYTE        bExtentIndex;           /* extent of dwReadCluster      */
+    BYTE        bExtentState;
+
+    BYTE        bFlags;
+    FAT_DIR_POS sDirPos;                /* our short directory entry    */
+
+    BYTE       *pBuffer;                /* own sector buffer, or NULL   */
+    DWORD       dwBufSector;            /* sector held in pBuffer       */
+    WORD        wBufGen;                /* wWriteGen when it was read   */
+    struct _fhandle *pNextWrite;        /* list of files open for write */
+
     DRIVE_INFO *pDrive;
+    BYTE        bMountGen;              /* bMountGen when it was opened */
 } FHANDLE;
 
+//
+// Directory iterator, see FATDirOpen
+//
+struct _fat_dir
+{
+    DRIVE_INFO *pDrive;
+    DWORD       dwCluster;              /* current cluster, 1 = FAT16 root */
+    DWORD       dwSector;               /* first sector of that cluster    */
+    WORD        wSector;                /* next sector to read             */
+    WORD        wMaxSector;
+    BYTE        bEntry;                 /* next entry in the buffer        */
+    BYTE        bEnd;
+
+    BYTE        bLfnValid;              /* long name assembly in progress  */
+    BYTE        bLfnNext;               /* next expected sequence number   */
+    BYTE        bLfnChecksum;
+    char        szLongName[FAT_DIRENT_NAME_LEN];
+
+    BYTE       *pBuffer;                /* one sector of the directory     */
+};
+
 static int QuickFormat(NUTDEVICE *dev, DRIVE_INFO *pDrive);
+#if (FAT_SUPPORT_WRITE >= 1)
+static int FATWriteBack(BYTE bDevice);
+#endif
 
 /*==========================================================*/
 /*  DEFINE: Definition of all local Data                    */
@@ -385,11 +541,30 @@ static int QuickFormat(NUTDEVICE *dev, DRIVE_INFO *pDrive);
 static int        nIsInit = FALSE;
 
 static BYTE      *pSectorBuffer = NULL;
+static BYTE       bBufferDevice;
+static DWORD      dwBufferSector = FAT_NO_SECTOR;
+static WORD       wBufferGen;
+static WORD       wWriteGen;            /* bumped on every data write   */
+static BYTE       bMountGen;            /* bumped by FATDiscard()       */
+
+static BYTE      *pHandleBuffers = NULL;
+static BYTE       bHandleBuffersUsed;
 static char      *pLongName1 = NULL;
 static char      *pLongName2 = NULL;
 static DRIVE_INFO sDriveInfo[FAT_MAX_DRIVE];
 
-static HANDLE hFATSemaphore;
+static BYTE      *pFATCacheBuffer = NULL;
+static FAT_CACHE  sFATCache[FAT_CACHE_ENTRIES];
+static WORD       wFATCacheUse;
+
+static FAT_DENTRY sDentry[FAT_DENTRY_ENTRIES];
+static WORD       wDentryUse;
+
+#if (FAT_SUPPORT_WRITE >= 1)
+static FHANDLE   *pWriteList = NULL;
+#endif
+
+static HANDLE hFATSemaphore = SIGNALED;   /* FATDiscard() may run before FATInit() */
 
 static DSKSZTOSECPERCLUS DskTableFAT32[] = {
     {      66600,  0}, /* disks up to 32.5MB, the 0 value for SecPerClusVal trips an error */
@@ -405,10 +580,313 @@ static DSKSZTOSECPERCLUS DskTableFAT32[] = {
 /*  DEFINE: Definition of all local Procedures              */
 /*==========================================================*/
 
-void FATRelease()
+/************************************************************/
+/*  FATCacheInvalidate                                      */
+/*                                                          */
+/*  Drop the cached FAT sectors of a device, or of all      */
+/*  devices when bDevice is 0xFF. Modified sectors are lost */
+/*  too, so call FATWriteBack() first; only what could not  */
+/*  be written should be left to drop here.                 */
+/************************************************************/
+static void FATCacheInvalidate(BYTE bDevice)
 {
-    nIsInit=FALSE;
+    BYTE i;
+
+    for (i = 0; i < FAT_CACHE_ENTRIES; i++)
+    {
+        if ((bDevice == 0xFF) || (sFATCache[i].bDevice == bDevice))
+        {
+            sFATCache[i].bValid = FALSE;
+            sFATCache[i].bDirty = FALSE;
+        }
+    }
+}
+
+#if (FAT_SUPPORT_WRITE >= 1)
+/************************************************************/
+/*  FATCacheWriteBack                                       */
+/*                                                          */
+/*  Write a modified FAT sector to the first FAT and, if    */
+/*  present, to the second one.                             */
+/************************************************************/
+static int FATCacheWriteBack(FAT_CACHE *pEntry)
+{
+    int         nError;
+    DRIVE_INFO *pDrive;
+
+    nError = HW_OK;
+
+    if ((pEntry->bValid == TRUE) && (pEntry->bDirty == TRUE))
+    {
+        pDrive = &sDriveInfo[pEntry->bDevice];
+
+        nError = HWWriteSectors(pDrive->bDevice, pEntry->pData, pEntry->dwSector, 1);
+        if ((nError == HW_OK) && (pDrive->bNumFATs > 1))
+        {
+            nError = HWWriteSectors(pDrive->bDevice, pEntry->pData,
+                                    pEntry->dwSector - pDrive->dwFAT1StartSector + pDrive->dwFAT2StartSector, 1);
+        }
+        if (nError == HW_OK)
+        {
+            pEntry->bDirty = FALSE;
+        }
+    }
+
+    return(nError);
+}
+
+/************************************************************/
+/*  FATCacheFlush                                           */
+/*                                                          */
+/*  Write all modified FAT sectors of a device.             */
+/************************************************************/
+static int FATCacheFlush(BYTE bDevice)
+{
+    BYTE i;
+    int  nError;
+
+    nError = HW_OK;
+
+    for (i = 0; (i < FAT_CACHE_ENTRIES) && (nError == HW_OK); i++)
+    {
+        if (sFATCache[i].bDevice == bDevice)
+        {
+            nError = FATCacheWriteBack(&sFATCache[i]);
+        }
+    }
+
+    return(nError);
+}
+#endif /* (FAT_SUPPORT_WRITE >= 1) */
+
+/************************************************************/
+/*  FATCacheRead                                            */
+/*                                                          */
+/*  Return a FAT sector from the cache, read it into the    */
+/*  least recently used entry if it is not there.           */
+/*                                                          */
+/*  Returns:    pointer to the sector data, or NULL on a    */
+/*              read error.                                 */
+/************************************************************/
+static BYTE *FATCacheRead(DRIVE_INFO *pDrive, DWORD dwSector)
+{
+    BYTE       i;
+    FAT_CACHE *pEntry;
+    FAT_CACHE *pVictim;
+
+    pVictim = &sFATCache[0];
+    for (i = 0; i < FAT_CACHE_ENTRIES; i++)
+    {
+        pEntry = &sFATCache[i];
+        if ((pEntry->bValid == TRUE) &&
+            (pEntry->bDevice == pDrive->bDevice) &&
+            (pEntry->dwSector == dwSector))
+        {
+            pEntry->wLastUse = ++wFATCacheUse;
+            return(pEntry->pData);
+        }
+
+        //
+        // Remember the free or least recently used entry
+        //
+        if (pVictim->bValid == TRUE)
+        {
+            if ((pEntry->bValid == FALSE) ||
+                ((WORD)(wFATCacheUse - pEntry->wLastUse) > (WORD)(wFATCacheUse - pVictim->wLastUse)))
+            {
+                pVictim = pEntry;
+            }
+        }
+    }
+
+#if (FAT_SUPPORT_WRITE >= 1)
+    //
+    // The FAT copies are updated lazily, when a modified
+    // sector leaves the cache
+    //
+    if (FATCacheWriteBack(pVictim) != HW_OK)
+    {
+        return(NULL);
+    }
+#endif
+
+    pVictim->bValid = FALSE;
+    if (HWReadSectors(pDrive->bDevice, pVictim->pData, dwSector, 1) != HW_OK)
+    {
+        return(NULL);
+    }
+    pVictim->bValid   = TRUE;
+    pVictim->bDevice  = pDrive->bDevice;
+    pVictim->dwSector = dwSector;
+    pVictim->wLastUse = ++wFATCacheUse;
+
+    return(pVictim->pData);
+}
+
+/************************************************************/
+/*  ReadSharedSector                                        */
+/*                                                          */
+/*  Get a data sector into the shared sector buffer, unless */
+/*  it is there already. The caller holds the FAT lock.     */
+/************************************************************/
+static int ReadSharedSector(DRIVE_INFO *pDrive, DWORD dwSector)
+{
+    int nError = HW_OK;
+
+    if ((dwBufferSector != dwSector) || (bBufferDevice != pDrive->bDevice) ||
+        (wBufferGen != wWriteGen))
+    {
+        dwBufferSector = FAT_NO_SECTOR;
+        nError = HWReadSectors(pDrive->bDevice, pSectorBuffer, dwSector, 1);
+        if (nError == HW_OK)
+        {
+            dwBufferSector = dwSector;
+            bBufferDevice  = pDrive->bDevice;
+            wBufferGen     = wWriteGen;
+        }
+    }
+
+    return(nError);
+}
+
+/************************************************************/
+/*  ReadHandleSector                                        */
+/*                                                          */
+/*  Same for the private buffer of a file, no lock needed.  */
+/************************************************************/
+static int ReadHandleSector(FHANDLE *hFile, DWORD dwSector)
+{
+    int  nError = HW_OK;
+    WORD wGen;
+
+    if ((hFile->dwBufSector != dwSector) || (hFile->wBufGen != wWriteGen))
+    {
+        //
+        // Take the generation before the read, a write that
+        // slips in while we wait for the card makes it stale
+        //
+        wGen = wWriteGen;
+        hFile->dwBufSector = FAT_NO_SECTOR;
+        nError = HWReadSectors(hFile->pDrive->bDevice, hFile->pBuffer, dwSector, 1);
+        if (nError == HW_OK)
+        {
+            hFile->dwBufSector = dwSector;
+            hFile->wBufGen     = wGen;
+        }
+    }
+
+    return(nError);
+}
+
+/************************************************************/
+/*  HandleBufferGet                                         */
+/*                                                          */
+/*  Take a sector buffer from the pool, NULL if all are in  */
+/*  use. The caller holds the FAT lock.                     */
+/************************************************************/
+static BYTE *HandleBufferGet(void)
+{
+    BYTE i;
+
+    if (pHandleBuffers != NULL)
+    {
+        for (i = 0; i < FAT_HANDLE_BUFFERS; i++)
+        {
+            if ((bHandleBuffersUsed & (1 << i)) == 0)
+            {
+                bHandleBuffersUsed |= (1 << i);
+                return(pHandleBuffers + (i * MAX_SECTOR_SIZE));
+            }
+        }
+    }
+
+    return(NULL);
+}
+
+/************************************************************/
+/*  HandleBufferPut                                         */
+/************************************************************/
+static void HandleBufferPut(BYTE *pBuffer)
+{
+    if ((pBuffer != NULL) && (pHandleBuffers != NULL))
+    {
+        bHandleBuffersUsed &= ~(1 << ((pBuffer - pHandleBuffers) / MAX_SECTOR_SIZE));
+    }
+}
+
+/************************************************************/
+/*  DropWriteHandles                                        */
+/*                                                          */
+/*  Forget the pending changes of the files open for write  */
+/*  on a device (0xFF for all), so they never end up on the */
+/*  next card that is inserted. Call FATWriteBack() first,  */
+/*  so only the changes that could not be written are lost. */
+/************************************************************/
+static void DropWriteHandles(BYTE bDevice)
+{
+#if (FAT_SUPPORT_WRITE >= 1)
+    FHANDLE **ppLink;
+    FHANDLE  *hFile;
+
+    ppLink = &pWriteList;
+    while (*ppLink != NULL)
+    {
+        hFile = *ppLink;
+        if ((bDevice == 0xFF) || (hFile->pDrive->bDevice == bDevice))
+        {
+            hFile->bFlags &= ~(FILE_FLAG_WRITE | FILE_FLAG_DIRTY);
+            *ppLink = hFile->pNextWrite;
+        }
+        else
+        {
+            ppLink = &hFile->pNextWrite;
+        }
+    }
+#endif
+}
+
+/************************************************************/
+/*  DentryInvalidate                                        */
+/*                                                          */
+/*  Drop the cached path lookups of a device, or of all     */
+/*  devices when bDevice is 0xFF.                           */
+/************************************************************/
+static void DentryInvalidate(BYTE bDevice)
+{
+    BYTE i;
+
+    for (i = 0; i < FAT_DENTRY_ENTRIES; i++)
+    {
+        if ((bDevice == 0xFF) || (sDentry[i].bDevice == bDevice))
+        {
+            sDentry[i].bValid = FALSE;
+        }
+    }
+}
+
+#if (FAT_SUPPORT_WRITE >= 1)
+/************************************************************/
+/*  DentryForget                                            */
+/*                                                          */
+/*  Drop the cached lookup of a directory entry whose size  */
+/*  or start cluster is going to change.                    */
+/************************************************************/
+static void DentryForget(BYTE bDevice, FAT_DIR_POS *pDirPos)
+{
+    BYTE i;
+
+    for (i = 0; i < FAT_DENTRY_ENTRIES; i++)
+    {
+        if ((sDentry[i].bDevice == bDevice) &&
+            (sDentry[i].sDirPos.dwSector == pDirPos->dwSector) &&
+            (sDentry[i].sDirPos.bIndex == pDirPos->bIndex))
+        {
+            sDentry[i].bValid = FALSE;
+        }
+    }
 }
+#endif
+
 /************************************************************/
 /*  FATLock                                                 */
 /************************************************************/
@@ -433,6 +911,47 @@ void FATSemaInit(void)
     NutEventPost(&hFATSemaphore);
 }
 
+/************************************************************/
+/*  FATRelease                                              */
+/*                                                          */
+/*  Unmount a card that is still there: write back what is  */
+/*  pending, whatever fails is dropped by FATDiscard().     */
+/************************************************************/
+void FATRelease()
+{
+#if (FAT_SUPPORT_WRITE >= 1)
+    if (nIsInit == TRUE)
+    {
+        FATLock();
+        FATWriteBack(0xFF);
+        FATFree();
+    }
+#endif
+    FATDiscard();
+}
+
+/************************************************************/
+/*  FATDiscard                                              */
+/*                                                          */
+/*  Unmount a card that was removed. Nothing is written,    */
+/*  the pending changes of files open for write are lost.   */
+/************************************************************/
+void FATDiscard()
+{
+    //
+    // Under the lock, a FATFileRead() that dropped it checks
+    // bMountGen before it touches the handle again
+    //
+    FATLock();
+    bMountGen++;
+    nIsInit=FALSE;
+    DropWriteHandles(0xFF);
+    DentryInvalidate(0xFF);
+    FATCacheInvalidate(0xFF);
+    dwBufferSector = FAT_NO_SECTOR;
+    FATFree();
+}
+
 /************************************************************/
 /*  GetFirstSectorOfCluster                                 */
 /************************************************************/
@@ -478,8 +997,11 @@ static DWORD GetNextCluster(DRIVE_INFO *pDrive, DWORD dwCluster)
             dwSector = (dwCluster / 128) + pDrive->dwFAT1StartSector;
             dwIndex  = dwCluster % 128;
 
-            HWReadSectors(pDrive->bDevice, pSectorBuffer, dwSector, 1);
-            pFatTable32 = (FAT_ENTRY_TABLE32 *) pSectorBuffer;
+            pFatTable32 = (FAT_ENTRY_TABLE32 *) FATCacheRead(pDrive, dwSector);
+            if (pFatTable32 == NULL)
+            {
+                return(0);
+            }
 
             dwNextCluster = (pFatTable32->aEntry[dwIndex] & FAT32_CLUSTER_MASK);
             if ((dwNextCluster == FAT32_CLUSTER_EOF) || (dwNextCluster == FAT32_CLUSTER_ERROR))
@@ -496,8 +1018,11 @@ static DWORD GetNextCluster(DRIVE_INFO *pDrive, DWORD dwCluster)
             dwSector = (dwCluster / 256) + pDrive->dwFAT1StartSector;
             dwIndex  = dwCluster % 256;
 
-            HWReadSectors(pDrive->bDevice, pSectorBuffer, dwSector, 1);
-            pFatTable16 = (FAT_ENTRY_TABLE16 *) pSectorBuffer;
+            pFatTable16 = (FAT_ENTRY_TABLE16 *) FATCacheRead(pDrive, dwSector);
+            if (pFatTable16 == NULL)
+            {
+                return(0);
+            }
 
             dwNextCluster = (pFatTable16->aEntry[dwIndex] & FAT16_CLUSTER_MASK);
             if ((dwNextCluster == FAT16_CLUSTER_EOF) || (dwNextCluster == FAT16_CLUSTER_ERROR))
@@ -512,1222 +1037,3051 @@ static DWORD GetNextCluster(DRIVE_INFO *pDrive, DWORD dwCluster)
 }
 
 /************************************************************/
-/*  GetLongChar                                             */
+/*  BuildExtentMap                                          */
+/*                                                          */
+/*  Walk the cluster chain of the file once and record the  */
+/*  runs of contiguous clusters. When the chain has more    */
+/*  than FAT_MAX_EXTENTS runs, only the first ones are      */
+/*  mapped and the rest is walked through the FAT.          */
 /************************************************************/
-static char GetLongChar(WORD wValue)
+static void BuildExtentMap(FHANDLE *hFile)
 {
-    BYTE Value;
+    DRIVE_INFO *pDrive;
+    FAT_EXTENT *pExtent;
+    DWORD       dwClusters;
+    DWORD       dwCluster;
+    DWORD       dwNextCluster;
+    DWORD       dwIndex;
+
+    pDrive = hFile->pDrive;
+    hFile->bExtentState = FAT_EXTENT_PARTIAL;
+    hFile->bExtents     = 0;
+    hFile->bExtentIndex = 0;
+
+    dwClusters = (hFile->dwFileSize + pDrive->dwClusterSize - 1) / pDrive->dwClusterSize;
+    if ((dwClusters == 0) || (hFile->dwStartCluster == 0))
+    {
+        return;
+    }
 
-    Value = (BYTE)(wValue & 0x00FF);
-    if (Value == 0xFF)
+    if (hFile->pExtent == NULL)
     {
-        Value = 0;
+        hFile->pExtent = (FAT_EXTENT *) NutHeapAlloc(FAT_MAX_EXTENTS * sizeof(FAT_EXTENT));
+        if (hFile->pExtent == NULL)
+        {
+            return;
+        }
     }
 
-    if (Value != 0)
+    pExtent = hFile->pExtent;
+    dwCluster = hFile->dwStartCluster;
+    dwIndex   = 0;
+
+    pExtent->dwCluster = dwCluster;
+    pExtent->dwIndex   = 0;
+    pExtent->dwLength  = 1;
+    hFile->bExtents    = 1;
+
+    while ((dwIndex + 1) < dwClusters)
     {
-        Value = toupper(Value);
+        dwNextCluster = GetNextCluster(pDrive, dwCluster);
+        if (dwNextCluster == 0)
+        {
+            break;
+        }
+        dwIndex++;
+
+        if (dwNextCluster == (dwCluster + 1))
+        {
+            pExtent->dwLength++;
+        }
+        else
+        {
+            if (hFile->bExtents == FAT_MAX_EXTENTS)
+            {
+                break;
+            }
+            pExtent++;
+            pExtent->dwCluster = dwNextCluster;
+            pExtent->dwIndex   = dwIndex;
+            pExtent->dwLength  = 1;
+            hFile->bExtents++;
+        }
+        dwCluster = dwNextCluster;
     }
 
-    return((char)Value);
-}
+    if ((dwIndex + 1) >= dwClusters)
+    {
+        hFile->bExtentState = FAT_EXTENT_COMPLETE;
+    }
+} /* BuildExtentMap */
 
 /************************************************************/
-/*  FindFile                                                */
+/*  FindExtent                                              */
 /*                                                          */
-/*  Find a file by a given name pLongName.                  */
+/*  Binary search the extent holding the cluster with the   */
+/*  given index in the file.                                */
 /*                                                          */
-/*  It is possible that a SHORT name like "enlogo.gif"      */
-/*  is stored as a LONG name. I have seen this              */
-/*  nasty behaviour by Win98. Therefore I will check        */
-/*  the long name too, even if nIsLongName is FALSE.        */
+/*  Returns:    the extent number, or -1 if the index is    */
+/*              not mapped.                                 */
 /************************************************************/
-static DWORD FindFile(DRIVE_INFO            *pDrive,
-                      FAT32_DIRECTORY_ENTRY *pSearchEntry, 
-                      char                  *pLongName,
-                      DWORD                 dwDirCluster, 
-                      DWORD                 *pFileSize, 
-                      int                    nIsLongName)
+static int FindExtent(FHANDLE *hFile, DWORD dwIndex)
 {
-    int                       i, x;
-    BYTE                      bError;
-    int                       nNameLen;
-    int                       nMaxLen;
-    BYTE                      bFound;
-    BYTE                      bEndLoop;
-    BYTE                      bOrder;
-    BYTE                      bMaxOrder;
-    int                       nDirMaxSector;
-    DWORD                     dwSector;
-    DWORD                     dwNewCluster;
-    FAT32_DIRECTORY_ENTRY      *pDirEntryShort;
-    FAT32_DIRECTORY_ENTRY_LONG *pDirEntryLong;
-    char                       *pDirName = 0;
-    FAT_DIR_TABLE              *pDirTable;
-
-    bError       = FALSE;
-    *pFileSize   = 0;
-    dwNewCluster = 0;
+    int         nLow;
+    int         nHigh;
+    int         nMid;
+    FAT_EXTENT *pExtent;
 
-    nNameLen  = strlen(pLongName);
+    nLow  = 0;
+    nHigh = (int) hFile->bExtents - 1;
 
-    bMaxOrder = (BYTE) ((nNameLen + 12) / 13);
-    nMaxLen   = (int) (bMaxOrder * 13);
-    if (nMaxLen >= (FAT_LONG_NAME_LEN - 1))
+    while (nLow <= nHigh)
     {
-        bError = TRUE;
+        nMid = (nLow + nHigh) / 2;
+        pExtent = &hFile->pExtent[nMid];
+
+        if (dwIndex < pExtent->dwIndex)
+        {
+            nHigh = nMid - 1;
+        }
+        else if (dwIndex >= (pExtent->dwIndex + pExtent->dwLength))
+        {
+            nLow = nMid + 1;
+        }
+        else
+        {
+            return(nMid);
+        }
     }
 
-    bOrder = (BYTE) (0x40 | bMaxOrder);
-    if (bOrder == 0xE5)
+    return(-1);
+} /* FindExtent */
+
+/************************************************************/
+/*  GetFileCluster                                          */
+/*                                                          */
+/*  Get the cluster with the given index in the file, and   */
+/*  point the extent hint of the handle at it.              */
+/*                                                          */
+/*  Returns:    the cluster number, or 0 on error.          */
+/************************************************************/
+static DWORD GetFileCluster(FHANDLE *hFile, DWORD dwIndex)
+{
+    int         nExtent;
+    DWORD       dwCluster;
+    DWORD       dwClusterIndex;
+    FAT_EXTENT *pExtent;
+
+    dwCluster      = hFile->dwStartCluster;
+    dwClusterIndex = 0;
+
+    if (hFile->bExtents != 0)
     {
+        nExtent = FindExtent(hFile, dwIndex);
+        if (nExtent >= 0)
+        {
+            pExtent = &hFile->pExtent[nExtent];
+            hFile->bExtentIndex = (BYTE) nExtent;
+
+            return(pExtent->dwCluster + (dwIndex - pExtent->dwIndex));
+        }
+
         //
-        // I do not know what should I do if the bOrder is 0xe5.
-        // This is a sign for a "empty" entry. 
+        // Behind the mapped part, continue from its last cluster
         //
-        bError = TRUE;
+        pExtent = &hFile->pExtent[hFile->bExtents - 1];
+        dwCluster      = pExtent->dwCluster + pExtent->dwLength - 1;
+        dwClusterIndex = pExtent->dwIndex + pExtent->dwLength - 1;
     }
+    hFile->bExtentIndex = hFile->bExtents;
 
-    if (bError == FALSE)
+    while ((dwClusterIndex < dwIndex) && (dwCluster != 0))
     {
-        bFound   = FALSE;
-        bEndLoop = FALSE;
-        while ((bEndLoop == FALSE) && (dwDirCluster != 0))
-        {
-            dwSector = GetFirstSectorOfCluster(pDrive, dwDirCluster);
-            nDirMaxSector = (int) pDrive->bSectorsPerCluster;
+        dwCluster = GetNextCluster(hFile->pDrive, dwCluster);
+        dwClusterIndex++;
+    }
 
-            //
-            // Test for special case dwDirCluster and FAT16.
-            //
-            if ((dwDirCluster == 1) && (pDrive->bIsFAT32 == FALSE))
+    return(dwCluster);
+} /* GetFileCluster */
+
+/************************************************************/
+/*  GetNextFileCluster                                      */
+/*                                                          */
+/*  Like GetNextCluster, but inside the extent map the FAT  */
+/*  is not touched at all.                                  */
+/************************************************************/
+static DWORD GetNextFileCluster(FHANDLE *hFile, DWORD dwCluster)
+{
+    FAT_EXTENT *pExtent;
+
+    if (hFile->bExtentIndex < hFile->bExtents)
+    {
+        pExtent = &hFile->pExtent[hFile->bExtentIndex];
+        if ((dwCluster >= pExtent->dwCluster) &&
+            (dwCluster < (pExtent->dwCluster + pExtent->dwLength)))
+        {
+            if ((dwCluster + 1) < (pExtent->dwCluster + pExtent->dwLength))
             {
-                dwSector = pDrive->dwFirstRootDirSector;
-                nDirMaxSector = (int) pDrive->dwRootDirSectors;
+                return(dwCluster + 1);
             }
-            //
-            // One cluster has SecPerCluster sectors.
-            //
-            for (i = 0; i < nDirMaxSector; i++)
+
+            hFile->bExtentIndex++;
+            if (hFile->bExtentIndex < hFile->bExtents)
             {
-                HWReadSectors(pDrive->bDevice, pSectorBuffer, dwSector + i, 1);
-                pDirTable = (FAT_DIR_TABLE *) pSectorBuffer;
+                return(pExtent[1].dwCluster);
+            }
+        }
+    }
 
-                //
-                // And one sector has 16 entries.
-                //
-                // HW_SECTOR_SIZE / sizeof(FAT32_DIRECTORY_ENTRY) = 16
-                //
-                for (x = 0; x < 16; x++)
-                {
-                    if (bFound == TRUE)
-                    {
-                        pDirEntryShort = (FAT32_DIRECTORY_ENTRY *) & pDirTable->aShort[x];
-                        dwNewCluster   = pDirEntryShort->HighCluster;
-                        dwNewCluster   = (dwNewCluster << 16) | (DWORD) pDirEntryShort->LowCluster;
-                        *pFileSize     = pDirEntryShort->FileSize;
-                        bEndLoop       = TRUE;
-                        break;
-                    }
-                    //
-                    // Check for valid entry.
-                    //
-                    pDirEntryShort = (FAT32_DIRECTORY_ENTRY *) & pDirTable->aShort[x];
-                    pDirEntryLong = (FAT32_DIRECTORY_ENTRY_LONG *) & pDirTable->aLong[x];
+    return(GetNextCluster(hFile->pDrive, dwCluster));
+} /* GetNextFileCluster */
 
-                    if (nIsLongName == FALSE)
-                    {
-                        //
-                        // Check if it could be a short name. If Win2000 tell us it
-                        // is a short name, it is true. But with Win98 we must
-                        // test both, short and long...
-                        //
-                        if ((pDirEntryShort->Name[0] != 0xE5) && (pDirEntryShort->Name[0] != 0x00))
-                        {
-                            if (memcmp(pDirEntryShort, pSearchEntry, 11) == 0)
-                            {
-                                //
-                                // Check for the correct attribute, this is done with
-                                // the '&' and not with the memcmp.
-                                // With the '&' it is possible to find a hidden archive too :-)
-                                //
-                                if ((pDirEntryShort->Attribute & pSearchEntry->Attribute) ==
-                                    pSearchEntry->Attribute)
-                                {
+/************************************************************/
+/*  SetFilePosition                                         */
+/*                                                          */
+/*  Move the file pointer of the handle to dwPos, which     */
+/*  must not be behind the EOF.                             */
+/*                                                          */
+/*  Returns:    FAT_OK or FAT_ERROR.                        */
+/************************************************************/
+static int SetFilePosition(FHANDLE *hFile, DWORD dwPos)
+{
+    DWORD       dwCluster;
+    DRIVE_INFO *pDrive;
 
-                                    dwNewCluster = pDirEntryShort->HighCluster;
-                                    dwNewCluster = (dwNewCluster << 16) | (DWORD) pDirEntryShort->LowCluster;
-                                    *pFileSize   = pDirEntryShort->FileSize;
+    pDrive = hFile->pDrive;
 
-                                    bEndLoop = TRUE;
-                                    break;
+    if (hFile->bExtentState == FAT_EXTENT_NONE)
+    {
+        BuildExtentMap(hFile);
+    }
 
-                                } /* endif Attribute */
-                            } /* endif test Name+Ext */
-                        } /* endif Name[0] != 0xe5, 0x00 */
-                    }
-                    /*
-                     * endif nIsLongName == FALSE 
-                     */
-                    if ((pDirEntryLong->Attribute == DIRECTORY_ATTRIBUTE_LONG_NAME)
-                        && (pDirEntryLong->Order == bOrder))
-                    {
-                        //
-                        // Next bOrder is bOrder--
-                        //  
-                        if (bOrder & 0x40)
-                        {
-                            bOrder &= ~0x40;
+    if ((dwPos < hFile->dwFileSize) || ((dwPos % pDrive->dwClusterSize) != 0))
+    {
+        dwCluster = GetFileCluster(hFile, dwPos / pDrive->dwClusterSize);
+        if (dwCluster == 0)
+        {
+            return(FAT_ERROR);
+        }
+    }
+    else
+    {
+        //
+        // At the end of the last cluster, there is no cluster to
+        // read from. A write will append a new one.
+        //
+        dwCluster = 0;
+    }
 
-                            //
-                            // Get the space for the name.
-                            //
-                            pDirName = pLongName2;
+    hFile->dwReadCluster    = dwCluster;
+    hFile->dwFilePointer    = dwPos;
+    hFile->dwClusterPointer = dwPos % pDrive->dwClusterSize;
+    hFile->nEOF             = (dwPos >= hFile->dwFileSize);
+    hFile->nLastError       = FAT_OK;
 
-                            //
-                            // Set the end of string.
-                            //
-                            pDirName[nMaxLen--] = 0;
-                        }
+    return(FAT_OK);
+} /* SetFilePosition */
 
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name3[1]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name3[0]);
+#if (FAT_SUPPORT_WRITE >= 1)
+/************************************************************/
+/*  SetNextCluster                                          */
+/*                                                          */
+/*  Set the FAT entry of dwCluster to dwValue. Only the     */
+/*  cached FAT sector is changed, it is written to both     */
+/*  FATs when it is flushed or leaves the cache.            */
+/************************************************************/
+static int SetNextCluster(DRIVE_INFO *pDrive, DWORD dwCluster, DWORD dwValue)
+{
+    BYTE              *pData;
+    FAT_ENTRY_TABLE16 *pFatTable16;
+    FAT_ENTRY_TABLE32 *pFatTable32;
+    BYTE               i;
 
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[5]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[4]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[3]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[2]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[1]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[0]);
+    if (pDrive->bIsFAT32 == TRUE)
+    {
+        pData = FATCacheRead(pDrive, (dwCluster / 128) + pDrive->dwFAT1StartSector);
+        if (pData == NULL)
+        {
+            return(FAT_ERROR);
+        }
+        pFatTable32 = (FAT_ENTRY_TABLE32 *) pData;
 
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[4]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[3]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[2]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[1]);
-                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[0]);
-
-                        bOrder--;
-                        if (bOrder == 0)
-                        {
-                            //
-                            // Now compare the name.
-                            //
-                            bOrder = (BYTE) (0x40 | bMaxOrder);
-                            nMaxLen = (int) (bMaxOrder * 13);
-                            if (memcmp(pLongName, pDirName, strlen(pLongName)) == 0)
-                            {
-                                //
-                                // The next entry will be the correct entry.
-                                //
-                                bFound = TRUE;
-                            }
-                        }
-                    }
-                    /*
-                     * pDirEntryLong->Order == bOrder 
-                     */
-                } /* endfor x<16 */
-
-                if (bEndLoop == TRUE)
-                {
-                    break;
-                }
-            }
-
-            if (bEndLoop == FALSE)
-            {
-                //
-                // No file found in this cluster, get the next one.
-                //
-                dwDirCluster = GetNextCluster(pDrive, dwDirCluster);
-            }
-        } /* endwhile */
+        //
+        // The upper 4 bits are reserved, keep them
+        //
+        pFatTable32->aEntry[dwCluster % 128] =
+        (pFatTable32->aEntry[dwCluster % 128] & ~FAT32_CLUSTER_MASK) | (dwValue & FAT32_CLUSTER_MASK);
+    }
+    else
+    {
+        pData = FATCacheRead(pDrive, (dwCluster / 256) + pDrive->dwFAT1StartSector);
+        if (pData == NULL)
+        {
+            return(FAT_ERROR);
+        }
+        pFatTable16 = (FAT_ENTRY_TABLE16 *) pData;
+        pFatTable16->aEntry[dwCluster % 256] = (WORD) (dwValue & FAT16_CLUSTER_MASK);
+    }
 
+    for (i = 0; i < FAT_CACHE_ENTRIES; i++)
+    {
+        if (sFATCache[i].pData == pData)
+        {
+            sFATCache[i].bDirty = TRUE;
+        }
     }
-    /*
-     * endif bError == FALSE 
-     */
-    return(dwNewCluster);
-}
+
+    return(FAT_OK);
+} /* SetNextCluster */
 
 /************************************************************/
-/*  MountHW                                                 */
+/*  IsClusterFree                                           */
 /************************************************************/
-static int MountHW(int nDrive)
+static int IsClusterFree(DRIVE_INFO *pDrive, DWORD dwCluster, BYTE *pData)
 {
-    int                    nError;
-    int                    i;
-    DWORD                 dwSector;
-    DWORD                 dwFATSz;
-    DWORD                 dwRootDirSectors;
-    FAT32_PARTITION_TABLE *pPartitionTable;
-    FAT32_BOOT_RECORD     *pBootRecord;
-    DRIVE_INFO            *pDrive;
+    if (pDrive->bIsFAT32 == TRUE)
+    {
+        return((((FAT_ENTRY_TABLE32 *) pData)->aEntry[dwCluster % 128] & FAT32_CLUSTER_MASK) == 0);
+    }
 
-    nError   = HW_OK;
-    i        = nDrive;
-    pDrive   = &sDriveInfo[nDrive];
-    dwSector = 0;
+    return(((FAT_ENTRY_TABLE16 *) pData)->aEntry[dwCluster % 256] == 0);
+} /* IsClusterFree */
 
-    if (pDrive->bFlags & FLAG_FAT_IS_ZIP)
+/************************************************************/
+/*  AllocCluster                                            */
+/*                                                          */
+/*  Allocate a free cluster and link it behind dwPrev, if   */
+/*  dwPrev is not 0. The cluster right behind dwPrev is     */
+/*  tried first, so files grow in contiguous runs. Else the */
+/*  FAT is scanned from the FSInfo next free hint on, one   */
+/*  whole FAT sector at a time.                             */
+/*                                                          */
+/*  Returns:    the new cluster, or 0 if the disk is full.  */
+/************************************************************/
+static DWORD AllocCluster(DRIVE_INFO *pDrive, DWORD dwPrev)
+{
+    BYTE  *pData;
+    DWORD  dwCluster;
+    DWORD  dwFound;
+    DWORD  dwScanned;
+    DWORD  dwPerSector;
+    DWORD  dwEOF;
+
+    dwFound     = 0;
+    dwPerSector = (pDrive->bIsFAT32 == TRUE) ? 128 : 256;
+    dwEOF       = (pDrive->bIsFAT32 == TRUE) ? FAT32_CLUSTER_EOF : FAT16_CLUSTER_EOF;
+
+    if ((pDrive->dwFreeCount == 0) || (pDrive->dwMaxCluster <= 2))
     {
-        dwSector = ZIP_DRIVE_BR_SECTOR;
+        return(0);
     }
-    else
+
+    if ((dwPrev >= 2) && ((dwPrev + 1) < pDrive->dwMaxCluster))
     {
-        //
-        // Try to find a PartitionTable.
-        // 
-        nError = HWReadSectors(nDrive, pSectorBuffer, 0, 1);
-        if (nError == HW_OK)
+        pData = FATCacheRead(pDrive, ((dwPrev + 1) / dwPerSector) + pDrive->dwFAT1StartSector);
+        if ((pData != NULL) && IsClusterFree(pDrive, dwPrev + 1, pData))
         {
-            pPartitionTable = (FAT32_PARTITION_TABLE *) pSectorBuffer;
-
-            if (pPartitionTable->Signature == FAT_SIGNATURE)
-            {
-                if (pPartitionTable->Partition[0].NumSectors)
-                {
-                    //
-                    // We found a PartitionTable, read BootRecord.
-                    // 
-                    dwSector = pPartitionTable->Partition[0].StartSectors;
-                }
-            }
+            dwFound = dwPrev + 1;
         }
     }
 
-    if (dwSector != 0)
+    dwCluster = pDrive->dwNextFree;
+    dwScanned = 0;
+    while ((dwFound == 0) && (dwScanned < pDrive->dwMaxCluster))
     {
-        HWReadSectors(i, pSectorBuffer, dwSector, 1);
-        pBootRecord = (FAT32_BOOT_RECORD *) pSectorBuffer;
+        if ((dwCluster < 2) || (dwCluster >= pDrive->dwMaxCluster))
+        {
+            dwCluster = 2;
+        }
+
+        pData = FATCacheRead(pDrive, (dwCluster / dwPerSector) + pDrive->dwFAT1StartSector);
+        if (pData == NULL)
+        {
+            return(0);
+        }
 
         //
-        // Test valid BootRecord.
+        // Check the rest of this FAT sector
         //
-        if (pBootRecord->Signature == FAT_SIGNATURE)
+        do
         {
-            pDrive->bSectorsPerCluster = pBootRecord->SecPerClus;
-
-            if (pBootRecord->FATSz16 != 0)
+            if (IsClusterFree(pDrive, dwCluster, pData))
             {
-                dwFATSz = pBootRecord->FATSz16;
-                pDrive->bIsFAT32 = FALSE;
-                pDrive->dwRootCluster = 1;  /* special value, see */
-                                            /* FindFile           */
+                dwFound = dwCluster;
+                break;
             }
-            else
+            dwCluster++;
+            dwScanned++;
+        } while (((dwCluster % dwPerSector) != 0) && (dwCluster < pDrive->dwMaxCluster));
+    }
+
+    if (dwFound != 0)
+    {
+        if (SetNextCluster(pDrive, dwFound, dwEOF) != FAT_OK)
+        {
+            return(0);
+        }
+        if (dwPrev != 0)
+        {
+            if (SetNextCluster(pDrive, dwPrev, dwFound) != FAT_OK)
             {
-                dwFATSz               = pBootRecord->Off36.FAT32.FATSz32;
-                pDrive->bIsFAT32      = TRUE;
-                pDrive->dwRootCluster = pBootRecord->Off36.FAT32.RootClus;
+                return(0);
             }
+        }
 
-            dwRootDirSectors =
-            ((pBootRecord->RootEntCnt * 32) +
-             (pBootRecord->BytsPerSec - 1)) / pBootRecord->BytsPerSec;
-
-            pDrive->dwFAT1StartSector = pBootRecord->HiddSec + pBootRecord->RsvdSecCnt;
-            pDrive->dwFAT2StartSector = pDrive->dwFAT1StartSector + dwFATSz;
-
-            pDrive->dwCluster2StartSector =
-            pBootRecord->HiddSec + pBootRecord->RsvdSecCnt +
-            (pBootRecord->NumFATs * dwFATSz) + dwRootDirSectors;
-
-            pDrive->dwClusterSize = pBootRecord->SecPerClus * pDrive->wSectorSize;
-
-            pDrive->dwRootDirSectors = dwRootDirSectors;
-            pDrive->dwFirstRootDirSector = pDrive->dwFAT2StartSector + dwFATSz;
-
-        } /* endif pBootRecord->Signature */
+        pDrive->dwNextFree = dwFound + 1;
+        if (pDrive->dwFreeCount != FSINFO_UNKNOWN)
+        {
+            pDrive->dwFreeCount--;
+        }
+        pDrive->bFSInfoDirty = TRUE;
     }
-    /*
-     * endif dwSector != 0 
-     */
-    return(nError);
-}
+
+    return(dwFound);
+} /* AllocCluster */
 
 /************************************************************/
-/*  MountAllDrives                                          */
+/*  FreeChain                                               */
+/*                                                          */
+/*  Release all clusters of a chain.                        */
 /************************************************************/
-static int MountDrive(BYTE bDrive)
+static int FreeChain(DRIVE_INFO *pDrive, DWORD dwCluster)
 {
-    int nError;
+    DWORD dwNextCluster;
 
-    nError = HW_OK;
-
-    FATLock();
-
-    if (pLongName1 == NULL)
-    {
-        pLongName1 = (char *)NutHeapAlloc(FAT_LONG_NAME_LEN);
-    }
-    if (pLongName2 == NULL)
-    {
-        pLongName2 = (char *)NutHeapAlloc(FAT_LONG_NAME_LEN);
-    }
-    if (pSectorBuffer == NULL)
-    {
-        pSectorBuffer = (BYTE *)NutHeapAlloc(MAX_SECTOR_SIZE);
-    }
-
-    if ((pSectorBuffer != NULL) && (pLongName1 != NULL) && (pLongName2 != NULL))
+    while ((dwCluster >= 2) && (dwCluster < pDrive->dwMaxCluster))
     {
-        memset((BYTE *) & sDriveInfo[bDrive], 0x00, sizeof(DRIVE_INFO));
-
-        sDriveInfo[bDrive].bDevice     = bDrive;
-        sDriveInfo[bDrive].wSectorSize = HWGetSectorSize(bDrive);
-
-        if (HWIsCDROMDevice(bDrive) == TRUE)
+        dwNextCluster = GetNextCluster(pDrive, dwCluster);
+        if (SetNextCluster(pDrive, dwCluster, 0) != FAT_OK)
         {
-            sDriveInfo[bDrive].bFlags |= FLAG_FAT_IS_CDROM;
+            return(FAT_ERROR);
         }
 
-        if (HWIsZIPDevice(bDrive) == TRUE)
+        if (dwCluster < pDrive->dwNextFree)
         {
-            sDriveInfo[bDrive].bFlags |= FLAG_FAT_IS_ZIP;
+            pDrive->dwNextFree = dwCluster;
         }
-
-        switch (sDriveInfo[bDrive].wSectorSize)
+        if (pDrive->dwFreeCount != FSINFO_UNKNOWN)
         {
-            case HW_SECTOR_SIZE:{
-                    nError = MountHW(bDrive);
-                    break;
-                }
-            default:{
-                    nError = HW_ERROR;
-                    break;
-                }
+            pDrive->dwFreeCount++;
         }
+        pDrive->bFSInfoDirty = TRUE;
+
+        dwCluster = dwNextCluster;
     }
-    /*
-     * endif pSectorBuffer != NULL 
-     */
-    FATFree();
 
-    return(nError);
-}
+    return(FAT_OK);
+} /* FreeChain */
 
 /************************************************************/
-/*  MountAllDrives                                          */
+/*  FlushFSInfo                                             */
+/*                                                          */
+/*  Write the free cluster count and next free hint back.   */
 /************************************************************/
-static int MountAllDrives(void)
+static int FlushFSInfo(DRIVE_INFO *pDrive)
 {
-    BYTE  i;
-    int  nError = HW_OK;
+    int           nError;
+    FAT32_FSINFO *pFSInfo;
 
-    for (i = 0; i < FAT_MAX_DRIVE; i++)
+    nError = HW_OK;
+
+    if ((pDrive->bFSInfoDirty == TRUE) && (pDrive->dwFSInfoSector != 0))
     {
-        MountDrive(i);
+        dwBufferSector = FAT_NO_SECTOR;
+        nError = HWReadSectors(pDrive->bDevice, pSectorBuffer, pDrive->dwFSInfoSector, 1);
+        if (nError == HW_OK)
+        {
+            pFSInfo = (FAT32_FSINFO *) pSectorBuffer;
+            pFSInfo->NumberOfFreeClusters         = pDrive->dwFreeCount;
+            pFSInfo->MostRecentlyAllocatedCluster = pDrive->dwNextFree;
+
+            nError = HWWriteSectors(pDrive->bDevice, pSectorBuffer, pDrive->dwFSInfoSector, 1);
+        }
+    }
+    if (nError == HW_OK)
+    {
+        pDrive->bFSInfoDirty = FALSE;
     }
 
     return(nError);
-}
+} /* FlushFSInfo */
 
-/*==========================================================*/
-/*  DEFINE: All code exported by the NUTDEVICE              */
-/*==========================================================*/
 /************************************************************/
-/*  FATUnMountDrive                                         */
+/*  GetDirDate                                              */
+/*                                                          */
+/*  Date and time for a directory entry, from the RTC. If   */
+/*  the clock can not be read or is not set, 2010-01-01     */
+/*  00:00 is used, never the invalid 1980-00-00.            */
 /************************************************************/
-static int FATUnMountDrive(int nDrive)
+static void GetDirDate(FAT32_FILEDATETIME *pDate)
 {
-    int         nError;
-    DRIVE_INFO *pDrive;
-
-    FATLock();
-
-    nError = FAT_OK;
+    tm sTime;
 
-    if ((nDrive >= HW_DRIVE_C) && (nDrive <= HW_DRIVE_D))
+    if ((X12RtcGetClock(&sTime) == 0) &&
+        (sTime.tm_year >= 80) && (sTime.tm_year < 80 + 128) &&
+        (sTime.tm_mon >= 0) && (sTime.tm_mon < 12) &&
+        (sTime.tm_mday >= 1) && (sTime.tm_mday <= 31))
     {
-        pDrive = &sDriveInfo[nDrive];
-        pDrive->bSectorsPerCluster = 0;
+        pDate->Year    = sTime.tm_year - 80;
+        pDate->Month   = sTime.tm_mon + 1;
+        pDate->Day     = sTime.tm_mday;
+        pDate->Hour    = sTime.tm_hour;
+        pDate->Minute  = sTime.tm_min;
+        pDate->Seconds = sTime.tm_sec / 2;
     }
     else
     {
-        nError = FAT_ERROR;
+        pDate->Year    = 2010 - 1980;
+        pDate->Month   = 1;
+        pDate->Day     = 1;
+        pDate->Hour    = 0;
+        pDate->Minute  = 0;
+        pDate->Seconds = 0;
     }
-
-    FATFree();
-
-    return(nError);
-}
+} /* GetDirDate */
 
 /************************************************************/
-/*  CFMount                                                 */
+/*  UpdateDirEntry                                          */
+/*                                                          */
+/*  Write size, start cluster and modification date of the */
+/*  file to its short directory entry.                      */
 /************************************************************/
-static void CFMount(int nDrive)
+static int UpdateDirEntry(FHANDLE *hFile)
 {
-    BYTE *pSectorBuffer;
+    int                    nError;
+    DRIVE_INFO            *pDrive;
+    FAT32_DIRECTORY_ENTRY *pDirEntry;
 
-    pSectorBuffer = (BYTE *) NutHeapAlloc(MAX_SECTOR_SIZE);
-    if (pSectorBuffer != NULL)
+    pDrive = hFile->pDrive;
+
+    dwBufferSector = FAT_NO_SECTOR;
+    nError = HWReadSectors(pDrive->bDevice, pSectorBuffer, hFile->sDirPos.dwSector, 1);
+    if (nError == HW_OK)
     {
-        MountDrive(nDrive);
-        NutHeapFree(pSectorBuffer);
+        pDirEntry = &((FAT_DIR_TABLE *) pSectorBuffer)->aShort[hFile->sDirPos.bIndex];
+        pDirEntry->FileSize    = hFile->dwFileSize;
+        pDirEntry->HighCluster = (WORD) (hFile->dwStartCluster >> 16);
+        pDirEntry->LowCluster  = (WORD) hFile->dwStartCluster;
+        pDirEntry->Attribute  |= DIRECTORY_ATTRIBUTE_ARCHIVE;
+        GetDirDate(&pDirEntry->Date);
+
+        nError = HWWriteSectors(pDrive->bDevice, pSectorBuffer, hFile->sDirPos.dwSector, 1);
     }
-}
+    if (nError == HW_OK)
+    {
+        hFile->bFlags &= ~FILE_FLAG_DIRTY;
+    }
+    DentryForget(pDrive->bDevice, &hFile->sDirPos);
 
-/************************************************************/
-/*  CFUnMount                                               */
-/************************************************************/
-static void CFUnMount(int nDrive)
-{
-    FATUnMountDrive(nDrive);
-}
+    return(nError);
+} /* UpdateDirEntry */
 
 /************************************************************/
-/*  FATInit                                                 */
+/*  CreateDirEntry                                          */
+/*                                                          */
+/*  Add an empty file with the short name of pEntry to the  */
+/*  directory dwDirCluster. If the directory is full, it    */
+/*  is extended by a cluster (not the FAT16 root).          */
 /************************************************************/
-static int FATInit(NUTDEVICE * pDevice)
+static int CreateDirEntry(DRIVE_INFO *pDrive, FAT32_DIRECTORY_ENTRY *pEntry,
+                          DWORD dwDirCluster, FAT_DIR_POS *pDirPos)
 {
-    int   nError;
-    int   nHWMode;  
-    BYTE *pSectorBuffer;
+    int            i, x;
+    int            nDirMaxSector;
+    DWORD          dwSector;
+    DWORD          dwNextCluster;
+    FAT_DIR_TABLE *pDirTable;
 
-    nError        = NUTDEV_ERROR;
-    nHWMode       = 0;
-    pSectorBuffer = NULL;
+    dwBufferSector = FAT_NO_SECTOR;
 
-    if ((nIsInit              == FALSE) && 
-        (pDevice->dev_name[0] == 'F')   &&
-        (pDevice->dev_name[1] == 'A')   &&
-        (pDevice->dev_name[2] == 'T'))
+    while (dwDirCluster != 0)
     {
-        nError = NUTDEV_OK;      
+        dwSector = GetFirstSectorOfCluster(pDrive, dwDirCluster);
+        nDirMaxSector = (int) pDrive->bSectorsPerCluster;
 
-        //
-        // Get the mode.
-        //    
-        switch (pDevice->dev_base)
+        if ((dwDirCluster == 1) && (pDrive->bIsFAT32 == FALSE))
         {
+            dwSector = pDrive->dwFirstRootDirSector;
+            nDirMaxSector = (int) pDrive->dwRootDirSectors;
+        }
 
-#if (FAT_USE_MMC_INTERFACE >= 1)
-            case FAT_MODE_MMC:
-                nHWMode = 0;   
-                break; 
-#endif        
-            default:
-                nError = NUTDEV_ERROR;
-                break;
+        for (i = 0; i < nDirMaxSector; i++)
+        {
+            if (HWReadSectors(pDrive->bDevice, pSectorBuffer, dwSector + i, 1) != HW_OK)
+            {
+                return(FAT_ERROR);
+            }
+            pDirTable = (FAT_DIR_TABLE *) pSectorBuffer;
+
+            for (x = 0; x < 16; x++)
+            {
+                if ((pDirTable->aShort[x].Name[0] == 0xE5) || (pDirTable->aShort[x].Name[0] == 0x00))
+                {
+                    memcpy(&pDirTable->aShort[x], pEntry, sizeof(FAT32_DIRECTORY_ENTRY));
+                    GetDirDate(&pDirTable->aShort[x].Date);
+                    if (HWWriteSectors(pDrive->bDevice, pSectorBuffer, dwSector + i, 1) != HW_OK)
+                    {
+                        return(FAT_ERROR);
+                    }
+                    pDirPos->dwSector = dwSector + i;
+                    pDirPos->bIndex   = (BYTE) x;
+                    return(FAT_OK);
+                }
+            }
         }
 
-        if (nError == NUTDEV_OK)
+        if ((dwDirCluster == 1) && (pDrive->bIsFAT32 == FALSE))
         {
             //
-            // Init my semaphore.
+            // The FAT16 root directory can not grow
             //
-            FATSemaInit();
+            return(FAT_ERROR);
+        }
 
-            pSectorBuffer = (BYTE *) NutHeapAlloc(MAX_SECTOR_SIZE);
-            if (pSectorBuffer != NULL)
+        dwNextCluster = GetNextCluster(pDrive, dwDirCluster);
+        if (dwNextCluster == 0)
+        {
+            //
+            // Directory is full, add a cleared cluster
+            //
+            dwNextCluster = AllocCluster(pDrive, dwDirCluster);
+            if (dwNextCluster == 0)
             {
-                /*
-                 * HW init
-                 */
-                nError = HWInit(nHWMode, CFMount, CFUnMount);
-                if (nError == HW_OK)
+                return(FAT_ERROR);
+            }
+            memset(pSectorBuffer, 0x00, pDrive->wSectorSize);
+            dwSector = GetFirstSectorOfCluster(pDrive, dwNextCluster);
+            for (i = 0; i < (int) pDrive->bSectorsPerCluster; i++)
+            {
+                if (HWWriteSectors(pDrive->bDevice, pSectorBuffer, dwSector + i, 1) != HW_OK)
                 {
-                    HWMountAllDevices(nHWMode, pSectorBuffer);
+                    return(FAT_ERROR);
+                }
+            }
+        }
+        dwDirCluster = dwNextCluster;
+    }
 
-                    /*
-                     * FAT init
-                     */
-                    MountAllDrives();
+    return(FAT_ERROR);
+} /* CreateDirEntry */
 
-                    nError  = NUTDEV_OK;
-                    nIsInit = TRUE;    
-                }
-                else
-                {
-                    nError  = NUTDEV_WRONG_HW;
-                }  
+/************************************************************/
+/*  FlushFile                                               */
+/*                                                          */
+/*  Bring the directory entry of the file, the FAT and the  */
+/*  FSInfo sector on the disk up to date.                   */
+/************************************************************/
+static int FlushFile(FHANDLE *hFile)
+{
+    int nError;
 
-                NutHeapFree(pSectorBuffer);
-            } /* endif pSectorBuffer != NULL */
-        } /* endif nError == NUTDEV_OK */
+    nError = HW_OK;
+
+    if (hFile->bFlags & FILE_FLAG_DIRTY)
+    {
+        nError = UpdateDirEntry(hFile);
     }
-    else
+    if (nError == HW_OK)
     {
-        if (nIsInit == TRUE)
-        {
-#if (FAT_USE_MMC_INTERFACE >= 1)
-            if ((pDevice->dev_name[0] == 'F')   &&
-                (pDevice->dev_name[1] == 'M')   &&
-                (pDevice->dev_name[2] == '0'))
-            {
-                /*
-                 * Always OK, because the MMC card
-                 * can be inserted later.
-                 */
-                nError = NUTDEV_OK;  
-            }
-#endif /* (FAT_USE_MMC_INTERFACE >= 0) */      
-
-        } /* endif (nIsInit == TRUE) */
-    } /* endif nIsInit == FALSE */
+        nError = FATCacheFlush(hFile->pDrive->bDevice);
+    }
+    if (nError == HW_OK)
+    {
+        nError = FlushFSInfo(hFile->pDrive);
+    }
 
     return(nError);
-}
+} /* FlushFile */
 
 /************************************************************/
-/*  GetDriveByDevice                                        */
+/*  FATWriteBack                                            */
+/*                                                          */
+/*  Write the pending changes of a device, or of all        */
+/*  devices when bDevice is 0xFF: the files open for write, */
+/*  modified FAT sectors and the FSInfo data. The caller    */
+/*  holds the FAT lock.                                     */
+/*                                                          */
+/*  Returns:    HW_OK, or the first write error. It stops   */
+/*              there, the card may be gone already.        */
 /************************************************************/
-static DRIVE_INFO* GetDriveByDevice (NUTDEVICE *pDevice)
+static int FATWriteBack(BYTE bDevice)
 {
-    DRIVE_INFO* pDrive = NULL;
+    BYTE     i;
+    int      nError;
+    FHANDLE *hFile;
 
-    if (pDevice != NULL)
+    nError = HW_OK;
+
+    for (hFile = pWriteList; (hFile != NULL) && (nError == HW_OK); hFile = hFile->pNextWrite)
     {
-        switch (pDevice->dev_name[2])
+        if ((bDevice == 0xFF) || (hFile->pDrive->bDevice == bDevice))
         {
-            case 'F':{
-                    pDrive = &sDriveInfo[HW_DRIVE_C];
-                    break;
-                }
-            case '0':{
-                    pDrive = &sDriveInfo[HW_DRIVE_D];
-                    break;
-                }
-            case '1':{
-                    pDrive = &sDriveInfo[HW_DRIVE_E];
-                    break;        
-                }      
+            nError = FlushFile(hFile);
         }
     }
 
-    return(pDrive);
-}  
+    for (i = 0; (i < FAT_CACHE_ENTRIES) && (nError == HW_OK); i++)
+    {
+        if ((bDevice == 0xFF) || (sFATCache[i].bDevice == bDevice))
+        {
+            nError = FATCacheWriteBack(&sFATCache[i]);
+        }
+    }
+
+    for (i = 0; (i < FAT_MAX_DRIVE) && (nError == HW_OK); i++)
+    {
+        if (((bDevice == 0xFF) || (bDevice == i)) && (sDriveInfo[i].bSectorsPerCluster != 0))
+        {
+            nError = FlushFSInfo(&sDriveInfo[i]);
+        }
+    }
+
+    return(nError);
+} /* FATWriteBack */
+#endif /* (FAT_SUPPORT_WRITE >= 1) */
 
 /************************************************************/
-/*  FATFileOpen                                             */
-/*                                                          */
-/*  Opens an existing file for reading.                     */
-/*                                                          */
-/*  Parameters: pName points to a string that specifies the */
-/*              name of the file to open. The name must     */
-/*              exactly match the full pathname of the file.*/
-/*                                                          */
-/*  Returns:    A pointer to a FILE structure that can be   */
-/*              used to read the file and retrieve          */
-/*              information about the file.                 */
-/*                                                          */
-/*              A return value of -1 indicates an error.    */
+/*  GetLongChar                                             */
 /************************************************************/
-static NUTFILE *FATFileOpen(NUTDEVICE *pDevice, CONST char *pName, int nMode,
-                            int nAccess)
+static char GetLongChar(WORD wValue)
 {
-    int                    i, x;
-    int                    nError;
-    int                    nEndWhile;
-    DWORD                 dwFileSize;
-    DWORD                 dwCluster;
-    FHANDLE               *hFile;
-    DRIVE_INFO            *pDrive;
-    FAT32_DIRECTORY_ENTRY  sDirEntry;
-    NUTFILE               *hNUTFile;
-    int                    nLongName;
-    char                  *pLongName;
-    char                  *pShortName;
-    char                  *pExtension;
+    BYTE Value;
 
-    //
-    // If the user has forgotten to call NUTDeviceOpen,
-    // we must call FATInit.
-    //
-    if (nIsInit == FALSE)
+    Value = (BYTE)(wValue & 0x00FF);
+    if (Value == 0xFF)
     {
-        FATInit(pDevice);
+        Value = 0;
     }
 
-    FATLock();
+    if (Value != 0)
+    {
+        Value = toupper(Value);
+    }
 
-    pDrive    = NULL;
-    nError    = TRUE;
-    nLongName = FALSE;
-    pLongName = (char *)pLongName1;
+    return((char)Value);
+}
 
-    //
-    // hFile is our FAT-Handle.
-    //
-    hFile = NULL;
+/************************************************************/
+/*  FindFile                                                */
+/*                                                          */
+/*  Find a file by a given name pLongName.                  */
+/*                                                          */
+/*  It is possible that a SHORT name like "enlogo.gif"      */
+/*  is stored as a LONG name. I have seen this              */
+/*  nasty behaviour by Win98. Therefore I will check        */
+/*  the long name too, even if nIsLongName is FALSE.        */
+/*                                                          */
+/*  pDirPos receives the position of the short entry, its   */
+/*  dwSector is FAT_NO_SECTOR if the file was not found.    */
+/************************************************************/
+static DWORD FindFile(DRIVE_INFO            *pDrive,
+                      FAT32_DIRECTORY_ENTRY *pSearchEntry, 
+                      char                  *pLongName,
+                      DWORD                 dwDirCluster, 
+                      DWORD                 *pFileSize, 
+                      int                    nIsLongName,
+                      FAT_DIR_POS           *pDirPos)
+{
+    int                       i, x;
+    BYTE                      bError;
+    int                       nNameLen;
+    int                       nMaxLen;
+    BYTE                      bFound;
+    BYTE                      bEndLoop;
+    BYTE                      bOrder;
+    BYTE                      bMaxOrder;
+    int                       nDirMaxSector;
+    DWORD                     dwSector;
+    DWORD                     dwNewCluster;
+    FAT32_DIRECTORY_ENTRY      *pDirEntryShort;
+    FAT32_DIRECTORY_ENTRY_LONG *pDirEntryLong;
+    char                       *pDirName = 0;
+    FAT_DIR_TABLE              *pDirTable;
 
-    //
-    // hNUTFile is the.... correct, NUT handle.
-    //   
-    hNUTFile = (NUTFILE *) NUTDEV_ERROR;
+    bError       = FALSE;
+    *pFileSize   = 0;
+    dwNewCluster = 0;
+    pDirPos->dwSector = FAT_NO_SECTOR;
 
-    pDrive = GetDriveByDevice(pDevice);
+    nNameLen  = strlen(pLongName);
 
-    if ((pDrive != NULL) && (pDrive->bSectorsPerCluster != 0) && (pName[0] != 0))
+    bMaxOrder = (BYTE) ((nNameLen + 12) / 13);
+    nMaxLen   = (int) (bMaxOrder * 13);
+    if (nMaxLen >= (FAT_LONG_NAME_LEN - 1))
     {
+        bError = TRUE;
+    }
 
+    bOrder = (BYTE) (0x40 | bMaxOrder);
+    if (bOrder == 0xE5)
+    {
         //
-        // Create a new file handle.
-        //    
-        hFile = (FHANDLE *) NutHeapAlloc(sizeof(FHANDLE));
+        // I do not know what should I do if the bOrder is 0xe5.
+        // This is a sign for a "empty" entry. 
+        //
+        bError = TRUE;
+    }
 
-        if ((pDrive->dwFAT1StartSector) && (hFile != NULL) && (*pName != '.'))
+    if (bError == FALSE)
+    {
+        bFound   = FALSE;
+        bEndLoop = FALSE;
+        while ((bEndLoop == FALSE) && (dwDirCluster != 0))
         {
-
-            memset(hFile, 0x00, sizeof(FHANDLE));
+            dwSector = GetFirstSectorOfCluster(pDrive, dwDirCluster);
+            nDirMaxSector = (int) pDrive->bSectorsPerCluster;
 
             //
-            // Start by the ROOT dir...
+            // Test for special case dwDirCluster and FAT16.
             //
-            dwCluster = pDrive->dwRootCluster;
-
+            if ((dwDirCluster == 1) && (pDrive->bIsFAT32 == FALSE))
+            {
+                dwSector = pDrive->dwFirstRootDirSector;
+                nDirMaxSector = (int) pDrive->dwRootDirSectors;
+            }
             //
-            // If the first char a "/", jump over, e.g. "/index.html"
-            // 
+            // One cluster has SecPerCluster sectors.
             //
-            if (*pName == '/')
+            dwBufferSector = FAT_NO_SECTOR;
+            for (i = 0; i < nDirMaxSector; i++)
             {
-                pName++;
-            }
+                HWReadSectors(pDrive->bDevice, pSectorBuffer, dwSector + i, 1);
+                pDirTable = (FAT_DIR_TABLE *) pSectorBuffer;
 
-            nEndWhile = FALSE;
-            while (nEndWhile == FALSE)
+                //
+                // And one sector has 16 entries.
+                //
+                // HW_SECTOR_SIZE / sizeof(FAT32_DIRECTORY_ENTRY) = 16
+                //
+                for (x = 0; x < 16; x++)
+                {
+                    if (bFound == TRUE)
+                    {
+                        pDirEntryShort = (FAT32_DIRECTORY_ENTRY *) & pDirTable->aShort[x];
+                        dwNewCluster   = pDirEntryShort->HighCluster;
+                        dwNewCluster   = (dwNewCluster << 16) | (DWORD) pDirEntryShort->LowCluster;
+                        *pFileSize     = pDirEntryShort->FileSize;
+                        pDirPos->dwSector = dwSector + i;
+                        pDirPos->bIndex   = (BYTE) x;
+                        bEndLoop       = TRUE;
+                        break;
+                    }
+                    //
+                    // Check for valid entry.
+                    //
+                    pDirEntryShort = (FAT32_DIRECTORY_ENTRY *) & pDirTable->aShort[x];
+                    pDirEntryLong = (FAT32_DIRECTORY_ENTRY_LONG *) & pDirTable->aLong[x];
+
+                    if (nIsLongName == FALSE)
+                    {
+                        //
+                        // Check if it could be a short name. If Win2000 tell us it
+                        // is a short name, it is true. But with Win98 we must
+                        // test both, short and long...
+                        //
+                        if ((pDirEntryShort->Name[0] != 0xE5) && (pDirEntryShort->Name[0] != 0x00))
+                        {
+                            if (memcmp(pDirEntryShort, pSearchEntry, 11) == 0)
+                            {
+                                //
+                                // Check for the correct attribute, this is done with
+                                // the '&' and not with the memcmp.
+                                // With the '&' it is possible to find a hidden archive too :-)
+                                //
+                                if ((pDirEntryShort->Attribute & pSearchEntry->Attribute) ==
+                                    pSearchEntry->Attribute)
+                                {
+
+                                    dwNewCluster = pDirEntryShort->HighCluster;
+                                    dwNewCluster = (dwNewCluster << 16) | (DWORD) pDirEntryShort->LowCluster;
+                                    *pFileSize   = pDirEntryShort->FileSize;
+                                    pDirPos->dwSector = dwSector + i;
+                                    pDirPos->bIndex   = (BYTE) x;
+
+                                    bEndLoop = TRUE;
+                                    break;
+
+                                } /* endif Attribute */
+                            } /* endif test Name+Ext */
+                        } /* endif Name[0] != 0xe5, 0x00 */
+                    }
+                    /*
+                     * endif nIsLongName == FALSE 
+                     */
+                    if ((pDirEntryLong->Attribute == DIRECTORY_ATTRIBUTE_LONG_NAME)
+                        && (pDirEntryLong->Order == bOrder))
+                    {
+                        //
+                        // Next bOrder is bOrder--
+                        //  
+                        if (bOrder & 0x40)
+                        {
+                            bOrder &= ~0x40;
+
+                            //
+                            // Get the space for the name.
+                            //
+                            pDirName = pLongName2;
+
+                            //
+                            // Set the end of string.
+                            //
+                            pDirName[nMaxLen--] = 0;
+                        }
+
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name3[1]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name3[0]);
+
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[5]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[4]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[3]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[2]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[1]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name2[0]);
+
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[4]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[3]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[2]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[1]);
+                        pDirName[nMaxLen--] = GetLongChar(pDirEntryLong->Name1[0]);
+
+                        bOrder--;
+                        if (bOrder == 0)
+                        {
+                            //
+                            // Now compare the name.
+                            //
+                            bOrder = (BYTE) (0x40 | bMaxOrder);
+                            nMaxLen = (int) (bMaxOrder * 13);
+                            if (memcmp(pLongName, pDirName, strlen(pLongName)) == 0)
+                            {
+                                //
+                                // The next entry will be the correct entry.
+                                //
+                                bFound = TRUE;
+                            }
+                        }
+                    }
+                    /*
+                     * pDirEntryLong->Order == bOrder 
+                     */
+                } /* endfor x<16 */
+
+                if (bEndLoop == TRUE)
+                {
+                    break;
+                }
+            }
+
+            if (bEndLoop == FALSE)
+            {
+                //
+                // No file found in this cluster, get the next one.
+                //
+                dwDirCluster = GetNextCluster(pDrive, dwDirCluster);
+            }
+        } /* endwhile */
+
+    }
+    /*
+     * endif bError == FALSE 
+     */
+    return(dwNewCluster);
+}
+
+/************************************************************/
+/*  LookupFile                                              */
+/*                                                          */
+/*  FindFile with a cache in front of it. Recently resolved */
+/*  names are found by (parent cluster, name) without       */
+/*  reading the directory. The hash only speeds up the      */
+/*  search, a hit is confirmed by comparing the name. Case  */
+/*  is folded, as FAT names are case insensitive.           */
+/************************************************************/
+static DWORD LookupFile(DRIVE_INFO            *pDrive,
+                        FAT32_DIRECTORY_ENTRY *pSearchEntry,
+                        char                  *pLongName,
+                        DWORD                  dwDirCluster,
+                        DWORD                 *pFileSize,
+                        int                    nIsLongName,
+                        FAT_DIR_POS           *pDirPos)
+{
+    BYTE        i;
+    BYTE        bNameLen;
+    DWORD       dwHash;
+    DWORD       dwCluster;
+    FAT_DENTRY *pEntry;
+    FAT_DENTRY *pVictim;
+    char       *pName;
+
+    //
+    // FNV-1a over the upper case name
+    //
+    dwHash = 2166136261UL;
+    for (pName = pLongName; *pName != 0; pName++)
+    {
+        dwHash = (dwHash ^ (BYTE) toupper(*pName)) * 16777619UL;
+    }
+    bNameLen = (BYTE) (pName - pLongName);
+
+    pVictim = &sDentry[0];
+    for (i = 0; i < FAT_DENTRY_ENTRIES; i++)
+    {
+        pEntry = &sDentry[i];
+        if ((pEntry->bValid == TRUE) &&
+            (pEntry->bDevice == pDrive->bDevice) &&
+            (pEntry->bAttribute == pSearchEntry->Attribute) &&
+            (pEntry->dwParent == dwDirCluster) &&
+            (pEntry->dwHash == dwHash) &&
+            (pEntry->bNameLen == bNameLen) &&
+            (strcasecmp(pEntry->szName, pLongName) == 0))
+        {
+            pEntry->wLastUse = ++wDentryUse;
+            *pFileSize = pEntry->dwSize;
+            *pDirPos   = pEntry->sDirPos;
+            return(pEntry->dwCluster);
+        }
+
+        if (pVictim->bValid == TRUE)
+        {
+            if ((pEntry->bValid == FALSE) ||
+                ((WORD)(wDentryUse - pEntry->wLastUse) > (WORD)(wDentryUse - pVictim->wLastUse)))
+            {
+                pVictim = pEntry;
+            }
+        }
+    }
+
+    dwCluster = FindFile(pDrive, pSearchEntry, pLongName, dwDirCluster, pFileSize, nIsLongName, pDirPos);
+
+    if ((pDirPos->dwSector != FAT_NO_SECTOR) && (bNameLen < FAT_DENTRY_NAME_LEN))
+    {
+        for (i = 0; i <= bNameLen; i++)
+        {
+            pVictim->szName[i] = toupper(pLongName[i]);
+        }
+        pVictim->bValid     = TRUE;
+        pVictim->bDevice    = pDrive->bDevice;
+        pVictim->bAttribute = pSearchEntry->Attribute;
+        pVictim->bNameLen   = bNameLen;
+        pVictim->wLastUse   = ++wDentryUse;
+        pVictim->dwParent   = dwDirCluster;
+        pVictim->dwHash     = dwHash;
+        pVictim->dwCluster  = dwCluster;
+        pVictim->dwSize     = *pFileSize;
+        pVictim->sDirPos    = *pDirPos;
+    }
+
+    return(dwCluster);
+} /* LookupFile */
+
+/************************************************************/
+/*  MountHW                                                 */
+/************************************************************/
+static int MountHW(int nDrive)
+{
+    int                    nError;
+    int                    i;
+    DWORD                 dwSector;
+    DWORD                 dwFATSz;
+    DWORD                 dwRootDirSectors;
+    DWORD                 dwTotSec;
+    FAT32_PARTITION_TABLE *pPartitionTable;
+    FAT32_BOOT_RECORD     *pBootRecord;
+    FAT32_FSINFO          *pFSInfo;
+    DRIVE_INFO            *pDrive;
+
+    nError   = HW_OK;
+    i        = nDrive;
+    pDrive   = &sDriveInfo[nDrive];
+    dwSector = 0;
+
+    if (pDrive->bFlags & FLAG_FAT_IS_ZIP)
+    {
+        dwSector = ZIP_DRIVE_BR_SECTOR;
+    }
+    else
+    {
+        //
+        // Try to find a PartitionTable.
+        // 
+        dwBufferSector = FAT_NO_SECTOR;
+        nError = HWReadSectors(nDrive, pSectorBuffer, 0, 1);
+        if (nError == HW_OK)
+        {
+            pPartitionTable = (FAT32_PARTITION_TABLE *) pSectorBuffer;
+
+            if (pPartitionTable->Signature == FAT_SIGNATURE)
+            {
+                if (pPartitionTable->Partition[0].NumSectors)
+                {
+                    //
+                    // We found a PartitionTable, read BootRecord.
+                    // 
+                    dwSector = pPartitionTable->Partition[0].StartSectors;
+                }
+            }
+        }
+    }
+
+    if (dwSector != 0)
+    {
+        dwBufferSector = FAT_NO_SECTOR;
+        HWReadSectors(i, pSectorBuffer, dwSector, 1);
+        pBootRecord = (FAT32_BOOT_RECORD *) pSectorBuffer;
+
+        //
+        // Test valid BootRecord.
+        //
+        if (pBootRecord->Signature == FAT_SIGNATURE)
+        {
+            pDrive->bSectorsPerCluster = pBootRecord->SecPerClus;
+
+            if (pBootRecord->FATSz16 != 0)
+            {
+                dwFATSz = pBootRecord->FATSz16;
+                pDrive->bIsFAT32 = FALSE;
+                pDrive->dwRootCluster = 1;  /* special value, see */
+                                            /* FindFile           */
+                pDrive->dwVolumeID = (pBootRecord->Off36.FAT16.BootSig == 0x29) ?
+                                     pBootRecord->Off36.FAT16.VollID : 0;
+            }
+            else
+            {
+                dwFATSz               = pBootRecord->Off36.FAT32.FATSz32;
+                pDrive->bIsFAT32      = TRUE;
+                pDrive->dwRootCluster = pBootRecord->Off36.FAT32.RootClus;
+                pDrive->dwVolumeID    = (pBootRecord->Off36.FAT32.BootSig == 0x29) ?
+                                        pBootRecord->Off36.FAT32.VollID : 0;
+            }
+
+            dwRootDirSectors =
+            ((pBootRecord->RootEntCnt * 32) +
+             (pBootRecord->BytsPerSec - 1)) / pBootRecord->BytsPerSec;
+
+            pDrive->dwFAT1StartSector = pBootRecord->HiddSec + pBootRecord->RsvdSecCnt;
+            pDrive->dwFAT2StartSector = pDrive->dwFAT1StartSector + dwFATSz;
+
+            pDrive->dwCluster2StartSector =
+            pBootRecord->HiddSec + pBootRecord->RsvdSecCnt +
+            (pBootRecord->NumFATs * dwFATSz) + dwRootDirSectors;
+
+            pDrive->dwClusterSize = pBootRecord->SecPerClus * pDrive->wSectorSize;
+
+            pDrive->dwRootDirSectors = dwRootDirSectors;
+            pDrive->dwFirstRootDirSector = pDrive->dwFAT2StartSector + dwFATSz;
+
+            pDrive->bNumFATs = pBootRecord->NumFATs;
+            pDrive->dwFreeCount = FSINFO_UNKNOWN;
+            pDrive->dwNextFree  = 2;
+
+            dwTotSec = pBootRecord->TotSec16;
+            if (dwTotSec == 0)
+            {
+                dwTotSec = pBootRecord->TotSec32;
+            }
+            pDrive->dwMaxCluster =
+            ((dwTotSec - (pDrive->dwCluster2StartSector - pBootRecord->HiddSec)) / pBootRecord->SecPerClus) + 2;
+
+            //
+            // The FAT may not hold more entries than it has room for
+            //
+            if (pDrive->bIsFAT32 == TRUE)
+            {
+                if (pDrive->dwMaxCluster > (dwFATSz * 128))
+                {
+                    pDrive->dwMaxCluster = dwFATSz * 128;
+                }
+                if (pBootRecord->Off36.FAT32.FSInfo != 0)
+                {
+                    pDrive->dwFSInfoSector = pBootRecord->HiddSec + pBootRecord->Off36.FAT32.FSInfo;
+                }
+            }
+            else if (pDrive->dwMaxCluster > (dwFATSz * 256))
+            {
+                pDrive->dwMaxCluster = dwFATSz * 256;
+            }
+
+#if (FAT_SUPPORT_WRITE >= 1)
+            //
+            // Take the free cluster hints from the FSInfo sector,
+            // this overwrites the boot record in the buffer
+            //
+            if (pDrive->dwFSInfoSector != 0)
+            {
+                if (HWReadSectors(i, pSectorBuffer, pDrive->dwFSInfoSector, 1) == HW_OK)
+                {
+                    pFSInfo = (FAT32_FSINFO *) pSectorBuffer;
+                    if ((pFSInfo->FirstSignature == FSINFO_FIRSTSIGNATURE) &&
+                        (pFSInfo->FSInfoSignature == FSINFO_FSINFOSIGNATURE))
+                    {
+                        pDrive->dwFreeCount = pFSInfo->NumberOfFreeClusters;
+                        if ((pFSInfo->MostRecentlyAllocatedCluster >= 2) &&
+                            (pFSInfo->MostRecentlyAllocatedCluster < pDrive->dwMaxCluster))
+                        {
+                            pDrive->dwNextFree = pFSInfo->MostRecentlyAllocatedCluster;
+                        }
+                    }
+                    else
+                    {
+                        pDrive->dwFSInfoSector = 0;
+                    }
+                }
+            }
+#endif
+
+        } /* endif pBootRecord->Signature */
+    }
+    /*
+     * endif dwSector != 0 
+     */
+    return(nError);
+}
+
+/************************************************************/
+/*  MountAllDrives                                          */
+/************************************************************/
+static int MountDrive(BYTE bDrive)
+{
+    int nError;
+
+    nError = HW_OK;
+
+    FATLock();
+
+    if (pLongName1 == NULL)
+    {
+        pLongName1 = (char *)NutHeapAlloc(FAT_LONG_NAME_LEN);
+    }
+    if (pLongName2 == NULL)
+    {
+        pLongName2 = (char *)NutHeapAlloc(FAT_LONG_NAME_LEN);
+    }
+    if (pSectorBuffer == NULL)
+    {
+        pSectorBuffer = (BYTE *)NutHeapAlloc(MAX_SECTOR_SIZE);
+    }
+    if (pHandleBuffers == NULL)
+    {
+        //
+        // Optional, files use the shared buffer without it
+        //
+        pHandleBuffers = (BYTE *)NutHeapAlloc(FAT_HANDLE_BUFFERS * MAX_SECTOR_SIZE);
+        bHandleBuffersUsed = 0;
+    }
+    if (pFATCacheBuffer == NULL)
+    {
+        pFATCacheBuffer = (BYTE *)NutHeapAlloc(FAT_CACHE_ENTRIES * MAX_SECTOR_SIZE);
+        if (pFATCacheBuffer != NULL)
+        {
+            BYTE i;
+
+            for (i = 0; i < FAT_CACHE_ENTRIES; i++)
+            {
+                sFATCache[i].bValid = FALSE;
+                sFATCache[i].pData  = pFATCacheBuffer + (i * MAX_SECTOR_SIZE);
+            }
+        }
+    }
+
+    if ((pSectorBuffer != NULL) && (pLongName1 != NULL) && (pLongName2 != NULL) && (pFATCacheBuffer != NULL))
+    {
+        DentryInvalidate(bDrive);
+        FATCacheInvalidate(bDrive);
+
+        memset((BYTE *) & sDriveInfo[bDrive], 0x00, sizeof(DRIVE_INFO));
+
+        sDriveInfo[bDrive].bDevice     = bDrive;
+        sDriveInfo[bDrive].wSectorSize = HWGetSectorSize(bDrive);
+
+        if (HWIsCDROMDevice(bDrive) == TRUE)
+        {
+            sDriveInfo[bDrive].bFlags |= FLAG_FAT_IS_CDROM;
+        }
+
+        if (HWIsZIPDevice(bDrive) == TRUE)
+        {
+            sDriveInfo[bDrive].bFlags |= FLAG_FAT_IS_ZIP;
+        }
+
+        switch (sDriveInfo[bDrive].wSectorSize)
+        {
+            case HW_SECTOR_SIZE:{
+                    nError = MountHW(bDrive);
+                    break;
+                }
+            default:{
+                    nError = HW_ERROR;
+                    break;
+                }
+        }
+    }
+    /*
+     * endif pSectorBuffer != NULL 
+     */
+    FATFree();
+
+    return(nError);
+}
+
+/************************************************************/
+/*  MountAllDrives                                          */
+/************************************************************/
+static int MountAllDrives(void)
+{
+    BYTE  i;
+    int  nError = HW_OK;
+
+    for (i = 0; i < FAT_MAX_DRIVE; i++)
+    {
+        MountDrive(i);
+    }
+
+    return(nError);
+}
+
+/*==========================================================*/
+/*  DEFINE: All code exported by the NUTDEVICE              */
+/*==========================================================*/
+/************************************************************/
+/*  FATUnMountDrive                                         */
+/************************************************************/
+static int FATUnMountDrive(int nDrive)
+{
+    int         nError;
+    DRIVE_INFO *pDrive;
+
+    FATLock();
+
+    nError = FAT_OK;
+
+    if ((nDrive >= HW_DRIVE_C) && (nDrive <= HW_DRIVE_D))
+    {
+        pDrive = &sDriveInfo[nDrive];
+#if (FAT_SUPPORT_WRITE >= 1)
+        FATWriteBack((BYTE)nDrive);
+#endif
+        pDrive->bSectorsPerCluster = 0;
+        DropWriteHandles((BYTE)nDrive);
+        DentryInvalidate((BYTE)nDrive);
+        FATCacheInvalidate((BYTE)nDrive);
+        dwBufferSector = FAT_NO_SECTOR;
+    }
+    else
+    {
+        nError = FAT_ERROR;
+    }
+
+    FATFree();
+
+    return(nError);
+}
+
+/************************************************************/
+/*  CFMount                                                 */
+/************************************************************/
+static void CFMount(int nDrive)
+{
+    BYTE *pSectorBuffer;
+
+    pSectorBuffer = (BYTE *) NutHeapAlloc(MAX_SECTOR_SIZE);
+    if (pSectorBuffer != NULL)
+    {
+        MountDrive(nDrive);
+        NutHeapFree(pSectorBuffer);
+    }
+}
+
+/************************************************************/
+/*  CFUnMount                                               */
+/************************************************************/
+static void CFUnMount(int nDrive)
+{
+    FATUnMountDrive(nDrive);
+}
+
+/************************************************************/
+/*  FATInit                                                 */
+/************************************************************/
+static int FATInit(NUTDEVICE * pDevice)
+{
+    int   nError;
+    int   nHWMode;  
+    BYTE *pSectorBuffer;
+
+    nError        = NUTDEV_ERROR;
+    nHWMode       = 0;
+    pSectorBuffer = NULL;
+
+    if ((nIsInit              == FALSE) && 
+        (pDevice->dev_name[0] == 'F')   &&
+        (pDevice->dev_name[1] == 'A')   &&
+        (pDevice->dev_name[2] == 'T'))
+    {
+        nError = NUTDEV_OK;      
+
+        //
+        // Get the mode.
+        //    
+        switch (pDevice->dev_base)
+        {
+
+#if (FAT_USE_MMC_INTERFACE >= 1)
+            case FAT_MODE_MMC:
+                nHWMode = 0;   
+                break; 
+#endif        
+            default:
+                nError = NUTDEV_ERROR;
+                break;
+        }
+
+        if (nError == NUTDEV_OK)
+        {
+            //
+            // Init my semaphore.
+            //
+            FATSemaInit();
+
+            pSectorBuffer = (BYTE *) NutHeapAlloc(MAX_SECTOR_SIZE);
+            if (pSectorBuffer != NULL)
+            {
+                /*
+                 * HW init
+                 */
+                nError = HWInit(nHWMode, CFMount, CFUnMount);
+                if (nError == HW_OK)
+                {
+                    HWMountAllDevices(nHWMode, pSectorBuffer);
+
+                    /*
+                     * FAT init
+                     */
+                    MountAllDrives();
+
+                    nError  = NUTDEV_OK;
+                    nIsInit = TRUE;    
+                }
+                else
+                {
+                    nError  = NUTDEV_WRONG_HW;
+                }  
+
+                NutHeapFree(pSectorBuffer);
+            } /* endif pSectorBuffer != NULL */
+        } /* endif nError == NUTDEV_OK */
+    }
+    else
+    {
+        if (nIsInit == TRUE)
+        {
+#if (FAT_USE_MMC_INTERFACE >= 1)
+            if ((pDevice->dev_name[0] == 'F')   &&
+                (pDevice->dev_name[1] == 'M')   &&
+                (pDevice->dev_name[2] == '0'))
+            {
+                /*
+                 * Always OK, because the MMC card
+                 * can be inserted later.
+                 */
+                nError = NUTDEV_OK;  
+            }
+#endif /* (FAT_USE_MMC_INTERFACE >= 0) */      
+
+        } /* endif (nIsInit == TRUE) */
+    } /* endif nIsInit == FALSE */
+
+    return(nError);
+}
+
+/************************************************************/
+/*  GetDriveByDevice                                        */
+/************************************************************/
+static DRIVE_INFO* GetDriveByDevice (NUTDEVICE *pDevice)
+{
+    DRIVE_INFO* pDrive = NULL;
+
+    if (pDevice != NULL)
+    {
+        switch (pDevice->dev_name[2])
+        {
+            case 'F':{
+                    pDrive = &sDriveInfo[HW_DRIVE_C];
+                    break;
+                }
+            case '0':{
+                    pDrive = &sDriveInfo[HW_DRIVE_D];
+                    break;
+                }
+            case '1':{
+                    pDrive = &sDriveInfo[HW_DRIVE_E];
+                    break;        
+                }      
+        }
+    }
+
+    return(pDrive);
+}  
+
+/************************************************************/
+/*  FATFileOpen                                             */
+/*                                                          */
+/*  Opens an existing file for reading.                     */
+/*                                                          */
+/*  Parameters: pName points to a string that specifies the */
+/*              name of the file to open. The name must     */
+/*              exactly match the full pathname of the file.*/
+/*                                                          */
+/*  Returns:    A pointer to a FILE structure that can be   */
+/*              used to read the file and retrieve          */
+/*              information about the file.                 */
+/*                                                          */
+/*              A return value of -1 indicates an error.    */
+/************************************************************/
+static NUTFILE *FATFileOpen(NUTDEVICE *pDevice, CONST char *pName, int nMode,
+                            int nAccess)
+{
+    int                    i, x;
+    int                    nError;
+    int                    nEndWhile;
+    DWORD                 dwFileSize;
+    DWORD                 dwCluster;
+    DWORD                 dwDirCluster;
+    FHANDLE               *hFile;
+    DRIVE_INFO            *pDrive;
+    FAT32_DIRECTORY_ENTRY  sDirEntry;
+    FAT_DIR_POS            sDirPos;
+    NUTFILE               *hNUTFile;
+    int                    nLongName;
+    char                  *pLongName;
+    char                  *pShortName;
+    char                  *pExtension;
+
+    //
+    // If the user has forgotten to call NUTDeviceOpen,
+    // we must call FATInit.
+    //
+    if (nIsInit == FALSE)
+    {
+        FATInit(pDevice);
+    }
+
+    FATLock();
+
+    pDrive    = NULL;
+    nError    = TRUE;
+    nLongName = FALSE;
+    pLongName = (char *)pLongName1;
+
+    //
+    // hFile is our FAT-Handle.
+    //
+    hFile = NULL;
+
+    //
+    // hNUTFile is the.... correct, NUT handle.
+    //   
+    hNUTFile = (NUTFILE *) NUTDEV_ERROR;
+
+    pDrive = GetDriveByDevice(pDevice);
+
+    if ((pDrive != NULL) && (pDrive->bSectorsPerCluster != 0) && (pName[0] != 0))
+    {
+
+        //
+        // Create a new file handle.
+        //    
+        hFile = (FHANDLE *) NutHeapAlloc(sizeof(FHANDLE));
+
+        if ((pDrive->dwFAT1StartSector) && (hFile != NULL) && (*pName != '.'))
+        {
+
+            memset(hFile, 0x00, sizeof(FHANDLE));
+
+            //
+            // Start by the ROOT dir...
+            //
+            dwCluster = pDrive->dwRootCluster;
+
+            //
+            // If the first char a "/", jump over, e.g. "/index.html"
+            // 
+            //
+            if (*pName == '/')
+            {
+                pName++;
+            }
+
+            nEndWhile = FALSE;
+            while (nEndWhile == FALSE)
             {  /* master loop */
 
-                nLongName = FALSE;
+                nLongName = FALSE;
+
+                //
+                // Get Name
+                //
+                i = 0;
+                while ((*pName != '/') && (*pName != '\\') && (*pName != 0))
+                {
+
+                    if (i >= (FAT_LONG_NAME_LEN - 1))
+                    {
+                        nEndWhile = TRUE;
+                        break;
+                    }
+
+                    pLongName[i] = toupper(*pName);
+
+                    i++;
+                    pName++;
+                } /* endwhile Name */
+
+                if (nEndWhile == FALSE)
+                {
+                    pLongName[i] = 0;
+
+                    //
+                    // Check if it is a Long Directory Entry.
+                    // Yes, I know that 'i' is the length of the string.
+                    // But the code is easier to read with the next strlen.
+                    //
+                    if (strlen(pLongName) <= FAT_SHORT_NAME_LEN)
+                    {
+                        //
+                        // It could be a ShortName, but "abc.defg" is possible
+                        // and this is a long name too. Therfore we need some tests.
+                        //
+                        pExtension = strchr(pLongName, '.');
+                        if (pExtension == NULL)
+                        {
+                            if (strlen(pLongName) > FAT_NAME_LEN)
+                            {
+                                nLongName = TRUE;
+                            }
+                            else
+                            {
+                                nLongName = FALSE;
+                            }
+                        }
+                        else
+                        {
+                            //
+                            // Check the length of the extensions.
+                            //
+                            pExtension++; /* jump over the '.' */
+                            if (strlen(pExtension) > 3)
+                            {
+                                nLongName = TRUE;
+                            }
+                        }
+                    }
+                    else
+                    {  /* Len > FAT_SHORT_NAME_LEN */
+                        //
+                        // Now we have a LongName, sure.
+                        // See the "nasty Win98" in FindFile :-)
+                        //
+                        nLongName = TRUE;
+                    }
+
+                    //
+                    // Here we knows, if we have a LongName or ShortName.
+                    //
+                    if (nLongName == FALSE)
+                    {
+                        //
+                        // ShortName
+                        //
+                        pShortName = pLongName;
+                        memset(&sDirEntry, 0x00, sizeof(FAT32_DIRECTORY_ENTRY));
+                        memset(sDirEntry.Name, 0x20, FAT_NAME_LEN);
+                        memset(sDirEntry.Extension, 0x20, FAT_EXT_LEN);
+
+                        //
+                        // Get the name
+                        //
+                        i = 0;
+                        while ((pShortName[i] != '.') && (pShortName[i] != 0))
+                        {
+                            sDirEntry.Name[i] = pShortName[i];
+                            i++;
+                        }
+                        //
+                        // And the extension
+                        //
+                        if (pShortName[i] == '.')
+                        {
+                            i++;  /* jump over the '.' */
+                            x = 0;
+                            while (pShortName[i] != 0)
+                            {
+                                sDirEntry.Extension[x] = pShortName[i];
+                                i++;
+                                x++;
+                            }
+                        }
+                    }
+                    //
+                    // The file could be a long or short one.
+                    // I have seen that Win98 store the short filename
+                    // in a long one :-(
+                    //
+                    switch (*pName)
+                    {
+                        //
+                        // The file is an ARCHIVE
+                        //
+                        case 0:{
+                                nEndWhile = TRUE;
+                                sDirEntry.Attribute = DIRECTORY_ATTRIBUTE_ARCHIVE;
+                                sDirPos.dwSector    = FAT_NO_SECTOR;
+                                dwDirCluster        = dwCluster;
+
+                                if (pDrive->bFlags & FLAG_FAT_IS_CDROM)
+                                {
+                                    dwCluster = 0;
+                                }
+                                else
+                                {
+                                    dwCluster =
+                                    LookupFile(pDrive, &sDirEntry, pLongName, dwCluster, &dwFileSize,
+                                               nLongName, &sDirPos);
+                                }
+
+#if (FAT_SUPPORT_WRITE >= 1)
+                                if (nMode & (_O_WRONLY | _O_RDWR))
+                                {
+                                    if (sDirPos.dwSector != FAT_NO_SECTOR)
+                                    {
+                                        if ((nMode & (_O_CREAT | _O_EXCL)) == (_O_CREAT | _O_EXCL))
+                                        {
+                                            //
+                                            // Exists already
+                                            //
+                                            sDirPos.dwSector = FAT_NO_SECTOR;
+                                        }
+                                        else if ((nMode & _O_TRUNC) && (dwCluster != 0))
+                                        {
+                                            if (FreeChain(pDrive, dwCluster) == FAT_OK)
+                                            {
+                                                dwCluster  = 0;
+                                                dwFileSize = 0;
+                                                hFile->bFlags |= FILE_FLAG_DIRTY;
+                                            }
+                                            else
+                                            {
+                                                sDirPos.dwSector = FAT_NO_SECTOR;
+                                            }
+                                        }
+                                    }
+                                    else if ((nMode & _O_CREAT) && (nLongName == FALSE) &&
+                                             ((pDrive->bFlags & FLAG_FAT_IS_CDROM) == 0))
+                                    {
+                                        //
+                                        // Only short names are created, sDirEntry
+                                        // holds the name already
+                                        //
+                                        if (CreateDirEntry(pDrive, &sDirEntry, dwDirCluster, &sDirPos) == FAT_OK)
+                                        {
+                                            dwCluster  = 0;
+                                            dwFileSize = 0;
+                                        }
+                                    }
+                                    else if ((nMode & _O_CREAT) && (nLongName == TRUE))
+                                    {
+                                        //
+                                        // Long names can not be created, say so
+                                        // instead of failing like a missing file
+                                        //
+                                        LogMsg_P(LOG_WARNING, PSTR("No 8.3 name [%s]"), pLongName);
+                                        errno = ENAMETOOLONG;
+                                    }
+
+                                    if (sDirPos.dwSector != FAT_NO_SECTOR)
+                                    {
+                                        //
+                                        // Size and cluster will change, the next open
+                                        // must read them from the directory again
+                                        //
+                                        DentryForget(pDrive->bDevice, &sDirPos);
+                                        hFile->bFlags |= FILE_FLAG_WRITE;
+                                        if (nMode & _O_APPEND)
+                                        {
+                                            hFile->bFlags |= FILE_FLAG_APPEND;
+                                        }
+                                    }
+                                }
+#endif
+
+                                if (sDirPos.dwSector != FAT_NO_SECTOR)
+                                {
+                                    hFile->dwFileSize       = dwFileSize;
+                                    hFile->dwStartCluster   = dwCluster;
+                                    hFile->dwReadCluster    = dwCluster;
+                                    hFile->dwFilePointer    = 0;
+                                    hFile->dwClusterPointer = 0;
+                                    hFile->pDrive           = pDrive;
+                                    hFile->bMountGen        = bMountGen;
+                                    hFile->nLastError       = FAT_OK;
+                                    hFile->nEOF             = (dwFileSize == 0);
+                                    hFile->sDirPos          = sDirPos;
+
+                                    nError                  = FALSE;
+                                }
+                                break;
+                            } /* endcase 0 */
+
+                            //
+                            // The file is a DIRECTORY
+                            //
+                        case '/':
+                        case '\\':{
+                                pName++;  /* jump over the char */
+
+                                sDirEntry.Attribute = DIRECTORY_ATTRIBUTE_DIRECTORY;
+
+                                if (pDrive->bFlags & FLAG_FAT_IS_CDROM)
+                                {
+                                    dwCluster = 0;
+                                }
+                                else
+                                {
+                                    dwCluster =
+                                    LookupFile(pDrive, &sDirEntry, pLongName, dwCluster, &dwFileSize,
+                                               nLongName, &sDirPos);
+                                }
+                                if (dwCluster != 0)
+                                {
+
+                                    //
+                                    // The new Cluster is the Cluster of the directory
+                                    //
+
+                                }
+                                else
+                                {
+                                    nEndWhile = TRUE;
+                                }
+                                break;
+                            } /* endcase / \ */
+
+                        default:{
+                                nEndWhile = TRUE;
+                                break;
+                            }
+                    } /* end switch */
+
+                }
+                /*
+                 * endif nEndWhile == FALSE 
+                 */
+            } /* end while */
+
+        }
+        /*
+         * endif pDrive->dwFAT1StartSector 
+         */
+        if (nError == TRUE)
+        {
+            //
+            // We found no file, therefore we can delete our FAT-Handle
+            //
+            if (hFile != NULL)
+            {
+                NutHeapFree(hFile);
+            }
+        }
+        else
+        {
+            //
+            // We have found a FILE and can create a NUT-Handle.
+            //
+            hNUTFile = NutHeapAlloc(sizeof(NUTFILE));
+            if (hNUTFile != NULL)
+            {
+                hNUTFile->nf_next = 0;
+                hNUTFile->nf_dev  = pDevice;
+                hNUTFile->nf_fcb  = hFile;
+
+                hFile->pBuffer     = HandleBufferGet();
+                hFile->dwBufSector = FAT_NO_SECTOR;
+
+#if (FAT_SUPPORT_WRITE >= 1)
+                if (hFile->bFlags & FILE_FLAG_WRITE)
+                {
+                    hFile->pNextWrite = pWriteList;
+                    pWriteList        = hFile;
+                }
+#endif
+            }
+            else
+            {
+                //
+                // Error, no mem for the NUT-Handle, therefore we 
+                // can delete our FAT-Handle too.
+                //
+#if (FAT_SUPPORT_WRITE >= 1)
+                if (hFile->bFlags & FILE_FLAG_WRITE)
+                {
+                    FlushFile(hFile);
+                }
+#endif
+                NutHeapFree(hFile);
+            }
+        }
+
+    }
+    /*
+     * endif pName[0] != 0 
+     */
+    FATFree();
+
+    return(hNUTFile);
+}
+
+/************************************************************/
+/*  FATFileClose                                            */
+/*                                                          */
+/*  Close a previously opened file.                         */
+/*                                                          */
+/*  Parameters: hNUTFile Identifies the file to close.      */
+/*              This pointer must have been created by      */
+/*              calling FAT32FileOpen().                    */
+/*                                                          */
+/*  Returns:    0 if the function is successfully closed,   */
+/*              -1 otherwise.                               */
+/************************************************************/
+static int FATFileClose(NUTFILE * hNUTFile)
+{
+    int      nError;
+    FHANDLE *hFile;
+
+    nError = NUTDEV_ERROR;
+
+    FATLock();
+
+    if (hNUTFile != NULL)
+    {
+        nError = NUTDEV_OK;
+
+        hFile = (FHANDLE *) hNUTFile->nf_fcb;
+        if (hFile != NULL)
+        {
+#if (FAT_SUPPORT_WRITE >= 1)
+            if (hFile->bFlags & FILE_FLAG_WRITE)
+            {
+                FHANDLE **ppLink;
+
+                if (FlushFile(hFile) != HW_OK)
+                {
+                    nError = NUTDEV_ERROR;
+                }
+
+                for (ppLink = &pWriteList; *ppLink != NULL; ppLink = &(*ppLink)->pNextWrite)
+                {
+                    if (*ppLink == hFile)
+                    {
+                        *ppLink = hFile->pNextWrite;
+                        break;
+                    }
+                }
+            }
+#endif
+            if (hFile->pExtent != NULL)
+            {
+                NutHeapFree(hFile->pExtent);
+            }
+            HandleBufferPut(hFile->pBuffer);
+            //
+            // Clear our FAT-Handle
+            //
+            NutHeapFree(hFile);
+        }
+        //
+        // Clear the NUT-Handle
+        //
+        NutHeapFree(hNUTFile);
+    }
+
+    FATFree();
+
+    return(nError);
+}
+
+/************************************************************/
+/*  FATFileSize                                             */
+/*                                                          */
+/*  Retrieve the size of a file.                            */
+/*                                                          */
+/*  Parameters: pFile Identifies the file to query.         */
+/*              This pointer must have been created by      */
+/*              calling FAT32FileOpen().                    */
+/*                                                          */
+/*  Returns:    The number of bytes in this file or         */
+/*              -1 if an error occured                      */
+/************************************************************/
+long FATFileSize(NUTFILE * hNUTFile)
+{
+    long     lSize;
+    FHANDLE *hFile;
+
+    FATLock();
+
+    lSize = NUTDEV_ERROR;
+
+    if (hNUTFile != NULL)
+    {
+        hFile = (FHANDLE *) hNUTFile->nf_fcb;
+        if (hFile != NULL)
+        {
+            lSize = hFile->dwFileSize;
+        }
+    }
+
+    FATFree();
+
+    return(lSize);
+}
+
+/************************************************************/
+/*  FATFileSeek                                             */
+/*                                                          */
+/*  Move the file pointer to a new position.                */
+/*  It points to the next byte to be read from a file.      */
+/*  The file pointer is automatically incremented for       */
+/*  each byte read. When the file is opened, it is at       */
+/*  position 0, the beginning of the file.                  */
+/*                                                          */
+/*  The cluster is looked up in the extent map of the       */
+/*  file, which is built on the first seek or read.         */
+/*                                                          */
+/*  Parameters: hNUTFile Identifies the file to seek.       */
+/*              This pointer must have been created by      */
+/*              calling FAT32FileOpen().                    */
+/*                                                          */
+/*              pPos Points to the offset, receives the     */
+/*              new absolute position of the file pointer.  */
+/*                                                          */
+/*              nWhence SEEK_SET, SEEK_CUR or SEEK_END.     */
+/*                                                          */
+/*  Returns:    0 if the function is successful,            */
+/*              -1 otherwise.                               */
+/************************************************************/
+static int FATFileSeek(NUTFILE * hNUTFile, long *pPos, int nWhence)
+{
+    int         nError;
+    long        lPos;
+    FHANDLE    *hFile;
+
+    FATLock();
+
+    hFile  = NULL;
+    nError = NUTDEV_ERROR;
+
+    if (hNUTFile != NULL)
+    {
+        hFile = (FHANDLE *) hNUTFile->nf_fcb;
+    }
+
+    if ((hFile != NULL) && (pPos != NULL))
+    {
+        switch (nWhence)
+        {
+            case SEEK_CUR:
+                lPos = (long) hFile->dwFilePointer + *pPos;
+                break;
+            case SEEK_END:
+                lPos = (long) hFile->dwFileSize + *pPos;
+                break;
+            default:
+                lPos = *pPos;
+                break;
+        }
+
+        if ((lPos >= 0) && ((DWORD) lPos <= hFile->dwFileSize))
+        {
+            if (SetFilePosition(hFile, (DWORD) lPos) == FAT_OK)
+            {
+                *pPos  = lPos;
+                nError = NUTDEV_OK;
+            }
+        }
+    }
+
+    FATFree();
+
+    return(nError);
+}
+
+/************************************************************/
+/*  FATFileRead                                             */
+/*                                                          */
+/*  Read data from a file.                                  */
+/*                                                          */
+/*  Parameters: pFile Identifies the file to read from.     */
+/*              This pointer must have been created by      */
+/*              calling FAT32FileOpen().                    */
+/*                                                          */
+/*              pData Points to the buffer that receives    */
+/*              the data.                                   */
+/*                                                          */
+/*              nSize Specifies the number of bytes to      */
+/*              read from the file.                         */
+/*                                                          */
+/*  Returns:    The number of bytes read from the file or   */
+/*               -1 if an error occured.                    */
+/************************************************************/
+int FATFileRead(NUTFILE * hNUTFile, void *pData, int nSize)
+{
+    int         nError;
+    int         nBytesRead;
+    int         nBytesToRead;
+    FHANDLE    *hFile;
+    DRIVE_INFO *pDrive;
+    BYTE       *pByte;
+    DWORD      dwReadSector;
+    DWORD      dwSector;
+    DWORD      dwRunCluster;
+    DWORD      dwNextCluster;
+    int         nSectorCount;
+    int         nSectorOffset;
+    int         nSectors;
+    int         nRunSectors;
+    WORD        wSectorSize;
+    FAT_EXTENT *pExtent;
+    BYTE       *pBounce;
+
+    nBytesRead = 0;
+
+    FATLock();
+
+    hFile  = NULL;
+    nError = NUTDEV_ERROR;
+
+    if (hNUTFile != NULL)
+    {
+        hFile = (FHANDLE *) hNUTFile->nf_fcb;
+    }
+
+    if ((hFile != NULL) && (hFile->bMountGen != bMountGen))
+    {
+        //
+        // Opened on a card that was removed since
+        //
+        hFile->nLastError = FAT_ERROR_IDE;
+        hFile = NULL;
+    }
+
+    if ((hFile != NULL) && (nSize != 0))
+    {
+        if (hFile->dwFilePointer < hFile->dwFileSize)
+        {
 
-                //
-                // Get Name
-                //
-                i = 0;
-                while ((*pName != '/') && (*pName != '\\') && (*pName != 0))
-                {
+            if ((hFile->dwFilePointer + nSize) > hFile->dwFileSize)
+            {
+                nSize = (int) (hFile->dwFileSize - hFile->dwFilePointer);
+            }
 
-                    if (i >= (FAT_LONG_NAME_LEN - 1))
-                    {
-                        nEndWhile = TRUE;
-                        break;
-                    }
+            pDrive = (DRIVE_INFO *) hFile->pDrive;
+            pByte  = (BYTE *) pData;
 
-                    pLongName[i] = toupper(*pName);
+            if ((hFile->bExtentState == FAT_EXTENT_NONE) && (hFile->dwFilePointer == 0))
+            {
+                BuildExtentMap(hFile);
+            }
 
-                    i++;
-                    pName++;
-                } /* endwhile Name */
+            nBytesRead  = nSize;
+            wSectorSize = pDrive->wSectorSize;
 
-                if (nEndWhile == FALSE)
-                {
-                    pLongName[i] = 0;
+            //
+            // The data is read without the FAT lock, it is only
+            // taken when the FAT or the shared sector buffer is used.
+            // So reads from different files can interleave. A card
+            // change in the meantime is caught by bMountGen when the
+            // lock is taken again to move the file pointer.
+            //
+            FATFree();
+
+            while (nSize)
+            {
+                dwSector = GetFirstSectorOfCluster(pDrive, hFile->dwReadCluster);
+                nSectorCount = hFile->dwClusterPointer / wSectorSize;
+                nSectorOffset = hFile->dwClusterPointer % wSectorSize;
+
+                //
+                // (Sector + SectorCount) is the sector to read
+                // SectorOffset is the start position in the sector itself
+                //
+                dwReadSector = dwSector + nSectorCount;
 
+                if ((nSectorOffset == 0) && (nSize >= (int) wSectorSize))
+                {
                     //
-                    // Check if it is a Long Directory Entry.
-                    // Yes, I know that 'i' is the length of the string.
-                    // But the code is easier to read with the next strlen.
+                    // Whole sectors, read them straight into the caller's
+                    // buffer. Follow the chain as long as the clusters are
+                    // contiguous on the card, so the run is one request.
                     //
-                    if (strlen(pLongName) <= FAT_SHORT_NAME_LEN)
+                    nSectors     = nSize / wSectorSize;
+                    nRunSectors  = pDrive->bSectorsPerCluster - nSectorCount;
+                    dwRunCluster = hFile->dwReadCluster;
+                    pExtent      = NULL;
+                    if (hFile->bExtentIndex < hFile->bExtents)
+                    {
+                        pExtent = &hFile->pExtent[hFile->bExtentIndex];
+                        if ((dwRunCluster < pExtent->dwCluster) ||
+                            (dwRunCluster >= (pExtent->dwCluster + pExtent->dwLength)))
+                        {
+                            pExtent = NULL;
+                        }
+                    }
+                    if (pExtent != NULL)
                     {
                         //
-                        // It could be a ShortName, but "abc.defg" is possible
-                        // and this is a long name too. Therfore we need some tests.
+                        // The extent map knows the end of the run,
+                        // no need to look at the FAT
                         //
-                        pExtension = strchr(pLongName, '.');
-                        if (pExtension == NULL)
+                        dwNextCluster = pExtent->dwCluster + pExtent->dwLength - 1 - dwRunCluster;
+                        if (dwNextCluster > (DWORD) (nSectors / pDrive->bSectorsPerCluster))
                         {
-                            if (strlen(pLongName) > FAT_NAME_LEN)
-                            {
-                                nLongName = TRUE;
-                            }
-                            else
-                            {
-                                nLongName = FALSE;
-                            }
+                            dwNextCluster = (DWORD) (nSectors / pDrive->bSectorsPerCluster) + 1;
                         }
-                        else
+                        nRunSectors += (int) dwNextCluster * pDrive->bSectorsPerCluster;
+                    }
+                    else
+                    {
+                        FATLock();
+                        while (nSectors > nRunSectors)
                         {
-                            //
-                            // Check the length of the extensions.
-                            //
-                            pExtension++; /* jump over the '.' */
-                            if (strlen(pExtension) > 3)
+                            dwNextCluster = GetNextCluster(pDrive, dwRunCluster);
+                            if (dwNextCluster != (dwRunCluster + 1))
                             {
-                                nLongName = TRUE;
+                                break;
                             }
+                            dwRunCluster = dwNextCluster;
+                            nRunSectors += pDrive->bSectorsPerCluster;
                         }
+                        FATFree();
+                    }
+                    if (nSectors > nRunSectors)
+                    {
+                        nSectors = nRunSectors;
+                    }
+                    nBytesToRead = nSectors * wSectorSize;
+
+                    nError = HWReadSectors(pDrive->bDevice, pByte, dwReadSector, nSectors);
+                }
+                else
+                {
+                    //
+                    // Unaligned head or tail, bounce it through the sector
+                    // buffer of the handle, or the shared one if the handle
+                    // got none. The sector is kept there, so the next call
+                    // continuing in the same sector does not read it again.
+                    //
+                    if (hFile->pBuffer != NULL)
+                    {
+                        pBounce = hFile->pBuffer;
+                        nError  = ReadHandleSector(hFile, dwReadSector);
                     }
                     else
-                    {  /* Len > FAT_SHORT_NAME_LEN */
-                        //
-                        // Now we have a LongName, sure.
-                        // See the "nasty Win98" in FindFile :-)
-                        //
-                        nLongName = TRUE;
+                    {
+                        FATLock();
+                        pBounce = pSectorBuffer;
+                        nError  = ReadSharedSector(pDrive, dwReadSector);
                     }
 
                     //
-                    // Here we knows, if we have a LongName or ShortName.
+                    // Find the size we can read from ONE sector
                     //
-                    if (nLongName == FALSE)
+                    if (nSize > (int) wSectorSize)
                     {
-                        //
-                        // ShortName
-                        //
-                        pShortName = pLongName;
-                        memset(&sDirEntry, 0x00, sizeof(FAT32_DIRECTORY_ENTRY));
-                        memset(sDirEntry.Name, 0x20, FAT_NAME_LEN);
-                        memset(sDirEntry.Extension, 0x20, FAT_EXT_LEN);
+                        nBytesToRead = wSectorSize;
+                    }
+                    else
+                    {
+                        nBytesToRead = nSize;
+                    }
 
+                    //
+                    // Test inside a sector
+                    //
+                    if ((nSectorOffset + nBytesToRead) > (int) wSectorSize)
+                    {
+                        nBytesToRead = wSectorSize - nSectorOffset;
+                    }
+
+                    if (nError == HW_OK)
+                    {
+                        memcpy(pByte, &pBounce[nSectorOffset], nBytesToRead);
+                    }
+                    if (pBounce == pSectorBuffer)
+                    {
+                        FATFree();
+                    }
+                }
+
+                FATLock();
+                if (hFile->bMountGen != bMountGen)
+                {
+                    nError = HW_ERROR;
+                }
+
+                if (nError == HW_OK)
+                {
+                    pByte += nBytesToRead;
+
+                    hFile->dwFilePointer    += nBytesToRead;
+                    hFile->dwClusterPointer += nBytesToRead;
+
+                    //
+                    // Check for EOF
+                    if (hFile->dwFilePointer >= hFile->dwFileSize)
+                    {
+                        hFile->nEOF = TRUE;
+                    }
+
+                    while ((hFile->dwClusterPointer >= pDrive->dwClusterSize) && (hFile->dwReadCluster != 0))
+                    {
                         //
-                        // Get the name
-                        //
-                        i = 0;
-                        while ((pShortName[i] != '.') && (pShortName[i] != 0))
-                        {
-                            sDirEntry.Name[i] = pShortName[i];
-                            i++;
-                        }
-                        //
-                        // And the extension
+                        // We must switch to the next cluster, a merged
+                        // run may have crossed several of them
                         //
-                        if (pShortName[i] == '.')
-                        {
-                            i++;  /* jump over the '.' */
-                            x = 0;
-                            while (pShortName[i] != 0)
-                            {
-                                sDirEntry.Extension[x] = pShortName[i];
-                                i++;
-                                x++;
-                            }
-                        }
+                        hFile->dwReadCluster = GetNextFileCluster(hFile, hFile->dwReadCluster);
+                        hFile->dwClusterPointer -= pDrive->dwClusterSize;
                     }
-                    //
-                    // The file could be a long or short one.
-                    // I have seen that Win98 store the short filename
-                    // in a long one :-(
-                    //
-                    switch (*pName)
+                    FATFree();
+
+                    nSize -= nBytesToRead;
+
+                }
+                else
+                {  /* HWReadSectors Error or card changed */
+
+                    nBytesRead = 0;
+                    hFile->nLastError = FAT_ERROR_IDE;
+                    FATFree();
+                    break;
+                } /* endif nError == HW_OK */
+
+            } /* endwhile */
+
+            FATLock();
+
+        }
+        else
+        {  /* reached the EOF */
+            hFile->nLastError = FAT_ERROR_EOF;
+        } /* endif hFile->dwFilePointer < hFile->dwFileSize */
+
+    }
+    /*
+     * endif (hFile != NULL) && (nSize != 0) 
+     */
+    FATFree();
+
+    return(nBytesRead);
+}
+
+/************************************************************/
+/*  FATFileWrite                                            */
+/*                                                          */
+/*  Write data to a file.                                   */
+/*                                                          */
+/*  Parameters: pFile Identifies the file to write to.      */
+/*              This pointer must have been created by      */
+/*              calling FAT32FileOpen().                    */
+/*                                                          */
+/*              pData Points to the buffer that holds       */
+/*              the data.                                   */
+/*                                                          */
+/*              nSize Specifies the number of bytes to      */
+/*              write to the file.                          */
+/*                                                          */
+/*  Returns:    The number of bytes written to the file or  */
+/*               -1 if an error occured.                    */
+/************************************************************/
+static int FATFileWrite(NUTFILE * hNUTFile, CONST void *pData, int nSize)
+{
+#if (FAT_SUPPORT_WRITE >= 1)
+    int         nError;
+    int         nBytesWritten;
+    int         nBytesToWrite;
+    int         nSectorCount;
+    int         nSectorOffset;
+    int         nSectors;
+    FHANDLE    *hFile;
+    DRIVE_INFO *pDrive;
+    CONST BYTE *pByte;
+    BYTE       *pBounce;
+    DWORD       dwCluster;
+    DWORD       dwWriteSector;
+    WORD        wSectorSize;
+
+    nBytesWritten = NUTDEV_ERROR;
+
+    FATLock();
+
+    hFile = NULL;
+    if (hNUTFile != NULL)
+    {
+        hFile = (FHANDLE *) hNUTFile->nf_fcb;
+    }
+
+    if ((hFile != NULL) && (hFile->bFlags & FILE_FLAG_WRITE))
+    {
+        pDrive        = hFile->pDrive;
+        pByte         = (CONST BYTE *) pData;
+        wSectorSize   = pDrive->wSectorSize;
+        nBytesWritten = 0;
+        nError        = HW_OK;
+
+        if ((hFile->bFlags & FILE_FLAG_APPEND) && (hFile->dwFilePointer != hFile->dwFileSize))
+        {
+            if (SetFilePosition(hFile, hFile->dwFileSize) != FAT_OK)
+            {
+                nError = HW_ERROR;
+            }
+        }
+
+        while ((nSize > 0) && (nError == HW_OK))
+        {
+            if ((hFile->dwReadCluster == 0) || (hFile->dwClusterPointer >= pDrive->dwClusterSize))
+            {
+                //
+                // We are at the end of the chain, append a cluster.
+                // The last cluster is still known if the previous
+                // write ended here, else look it up.
+                //
+                if (hFile->dwStartCluster == 0)
+                {
+                    dwCluster = AllocCluster(pDrive, 0);
+                    hFile->dwStartCluster = dwCluster;
+                }
+                else
+                {
+                    dwCluster = hFile->dwReadCluster;
+                    if (dwCluster == 0)
+                    {
+                        dwCluster = GetFileCluster(hFile, (hFile->dwFilePointer - 1) / pDrive->dwClusterSize);
+                    }
+                    if (dwCluster != 0)
                     {
-                        //
-                        // The file is an ARCHIVE
-                        //
-                        case 0:{
-                                nEndWhile = TRUE;
-                                sDirEntry.Attribute = DIRECTORY_ATTRIBUTE_ARCHIVE;
+                        dwCluster = AllocCluster(pDrive, dwCluster);
+                    }
+                }
+                if (dwCluster == 0)
+                {
+                    nError = HW_ERROR;
+                    break;
+                }
 
-                                if (pDrive->bFlags & FLAG_FAT_IS_CDROM)
-                                {
-                                    dwCluster = 0;
-                                }
-                                else
-                                {
-                                    dwCluster =
-                                    FindFile(pDrive, &sDirEntry, pLongName, dwCluster, &dwFileSize,
-                                             nLongName);
-                                }
-                                if (dwCluster != 0)
-                                {
-                                    hFile->dwFileSize       = dwFileSize;
-                                    hFile->dwStartCluster   = dwCluster;
-                                    hFile->dwReadCluster    = dwCluster;
-                                    hFile->dwFilePointer    = 0;
-                                    hFile->dwClusterPointer = 0;
-                                    hFile->pDrive           = pDrive;
-                                    hFile->nLastError       = FAT_OK;
-                                    hFile->nEOF             = FALSE;
+                //
+                // The chain has changed, drop the extent map
+                //
+                hFile->bExtentState = FAT_EXTENT_NONE;
+                hFile->bExtents     = 0;
+                hFile->bExtentIndex = 0;
+                hFile->bFlags      |= FILE_FLAG_DIRTY;
 
-                                    nError                  = FALSE;
-                                }
-                                break;
-                            } /* endcase 0 */
+                hFile->dwReadCluster    = dwCluster;
+                hFile->dwClusterPointer = 0;
+            }
 
-                            //
-                            // The file is a DIRECTORY
-                            //
-                        case '/':
-                        case '\\':{
-                                pName++;  /* jump over the char */
+            nSectorCount  = hFile->dwClusterPointer / wSectorSize;
+            nSectorOffset = hFile->dwClusterPointer % wSectorSize;
+            dwWriteSector = GetFirstSectorOfCluster(pDrive, hFile->dwReadCluster) + nSectorCount;
 
-                                sDirEntry.Attribute = DIRECTORY_ATTRIBUTE_DIRECTORY;
+            if ((nSectorOffset == 0) && (nSize >= (int) wSectorSize))
+            {
+                //
+                // Whole sectors, write them straight from the
+                // caller's buffer, up to the end of the cluster
+                //
+                nSectors = nSize / wSectorSize;
+                if (nSectors > (pDrive->bSectorsPerCluster - nSectorCount))
+                {
+                    nSectors = pDrive->bSectorsPerCluster - nSectorCount;
+                }
+                nBytesToWrite = nSectors * wSectorSize;
 
-                                if (pDrive->bFlags & FLAG_FAT_IS_CDROM)
-                                {
-                                    dwCluster = 0;
-                                }
-                                else
-                                {
-                                    dwCluster =
-                                    FindFile(pDrive, &sDirEntry, pLongName, dwCluster, &dwFileSize,
-                                             nLongName);
-                                }
-                                if (dwCluster != 0)
-                                {
+                nError = HWWriteSectors(pDrive->bDevice, (void *) pByte, dwWriteSector, nSectors);
 
-                                    //
-                                    // The new Cluster is the Cluster of the directory
-                                    //
+                //
+                // Sectors held in any bounce buffer may be stale now
+                //
+                wWriteGen++;
+            }
+            else
+            {
+                nBytesToWrite = wSectorSize - nSectorOffset;
+                if (nBytesToWrite > nSize)
+                {
+                    nBytesToWrite = nSize;
+                }
 
-                                }
-                                else
-                                {
-                                    nEndWhile = TRUE;
-                                }
-                                break;
-                            } /* endcase / \ */
+                //
+                // Read-modify-write through the sector buffer of the
+                // handle, or the shared one. A sector behind the EOF
+                // holds no data, so it need not be read.
+                //
+                pBounce = (hFile->pBuffer != NULL) ? hFile->pBuffer : pSectorBuffer;
+                if ((hFile->dwFilePointer - nSectorOffset) >= hFile->dwFileSize)
+                {
+                    memset(pBounce, 0x00, wSectorSize);
+                }
+                else if (pBounce == hFile->pBuffer)
+                {
+                    nError = ReadHandleSector(hFile, dwWriteSector);
+                }
+                else
+                {
+                    nError = ReadSharedSector(pDrive, dwWriteSector);
+                }
 
-                        default:{
-                                nEndWhile = TRUE;
-                                break;
-                            }
-                    } /* end switch */
+                if (nError == HW_OK)
+                {
+                    memcpy(&pBounce[nSectorOffset], pByte, nBytesToWrite);
+                    nError = HWWriteSectors(pDrive->bDevice, pBounce, dwWriteSector, 1);
+                }
+                wWriteGen++;
 
+                //
+                // Our own copy is the current one
+                //
+                if (pBounce == hFile->pBuffer)
+                {
+                    hFile->dwBufSector = (nError == HW_OK) ? dwWriteSector : FAT_NO_SECTOR;
+                    hFile->wBufGen     = wWriteGen;
                 }
-                /*
-                 * endif nEndWhile == FALSE 
-                 */
-            } /* end while */
+                else
+                {
+                    dwBufferSector = (nError == HW_OK) ? dwWriteSector : FAT_NO_SECTOR;
+                    bBufferDevice  = pDrive->bDevice;
+                    wBufferGen     = wWriteGen;
+                }
+            }
 
-        }
-        /*
-         * endif pDrive->dwFAT1StartSector 
-         */
-        if (nError == TRUE)
-        {
-            //
-            // We found no file, therefore we can delete our FAT-Handle
-            //
-            if (hFile != NULL)
+            if (nError == HW_OK)
             {
-                NutHeapFree(hFile);
+                pByte         += nBytesToWrite;
+                nSize         -= nBytesToWrite;
+                nBytesWritten += nBytesToWrite;
+
+                hFile->dwFilePointer    += nBytesToWrite;
+                hFile->dwClusterPointer += nBytesToWrite;
+
+                if (hFile->dwFilePointer > hFile->dwFileSize)
+                {
+                    hFile->dwFileSize = hFile->dwFilePointer;
+                    hFile->bFlags    |= FILE_FLAG_DIRTY;
+                }
+                hFile->nEOF = (hFile->dwFilePointer >= hFile->dwFileSize);
+
+                if (hFile->dwClusterPointer >= pDrive->dwClusterSize)
+                {
+                    //
+                    // Switch to the next cluster. At the end of the chain
+                    // stay on the last one, the next write appends to it.
+                    //
+                    dwCluster = GetNextFileCluster(hFile, hFile->dwReadCluster);
+                    if (dwCluster != 0)
+                    {
+                        hFile->dwReadCluster     = dwCluster;
+                        hFile->dwClusterPointer -= pDrive->dwClusterSize;
+                    }
+                }
             }
-        }
-        else
+        } /* endwhile */
+
+        if (nError != HW_OK)
         {
-            //
-            // We have found a FILE and can create a NUT-Handle.
-            //
-            hNUTFile = NutHeapAlloc(sizeof(NUTFILE));
-            if (hNUTFile != NULL)
+            hFile->nLastError = FAT_ERROR_IDE;
+            if (nBytesWritten == 0)
             {
-                hNUTFile->nf_next = 0;
-                hNUTFile->nf_dev  = pDevice;
-                hNUTFile->nf_fcb  = hFile;
+                nBytesWritten = NUTDEV_ERROR;
             }
-            else
+        }
+    }
+
+    FATFree();
+
+    return(nBytesWritten);
+#else
+    return(NUTDEV_ERROR);
+#endif /* (FAT_SUPPORT_WRITE >= 1) */
+}
+
+#ifdef __HARVARD_ARCH__
+/************************************************************/
+/*  FATFileWriteP                                           */
+/*                                                          */
+/*  Same as FATFileWrite, with the data in program memory.  */
+/************************************************************/
+static int FATFileWriteP(NUTFILE * hNUTFile, PGM_P pData, int nSize)
+{
+#if (FAT_SUPPORT_WRITE >= 1)
+    int  nCount;
+    int  nResult;
+    int  nBytesWritten;
+    BYTE aBuffer[32];
+
+    nBytesWritten = 0;
+
+    while (nSize > 0)
+    {
+        nCount = (nSize > (int) sizeof(aBuffer)) ? (int) sizeof(aBuffer) : nSize;
+        memcpy_P(aBuffer, pData, nCount);
+
+        nResult = FATFileWrite(hNUTFile, aBuffer, nCount);
+        if (nResult <= 0)
+        {
+            if (nBytesWritten == 0)
             {
-                //
-                // Error, no mem for the NUT-Handle, therefore we 
-                // can delete our FAT-Handle too.
-                //
-                NutHeapFree(hFile);
+                nBytesWritten = nResult;
             }
+            break;
         }
 
+        nBytesWritten += nResult;
+        pData         += nResult;
+        nSize         -= nResult;
     }
-    /*
-     * endif pName[0] != 0 
-     */
-    FATFree();
 
-    return(hNUTFile);
+    return(nBytesWritten);
+#else
+    return(NUTDEV_ERROR);
+#endif /* (FAT_SUPPORT_WRITE >= 1) */
 }
+#endif
 
 /************************************************************/
-/*  FATFileClose                                            */
-/*                                                          */
-/*  Close a previously opened file.                         */
+/*  FATSync                                                 */
 /*                                                          */
-/*  Parameters: hNUTFile Identifies the file to close.      */
-/*              This pointer must have been created by      */
-/*              calling FAT32FileOpen().                    */
+/*  Write all pending directory entries, FAT sectors and    */
+/*  FSInfo data, see FATWriteBack().                        */
 /*                                                          */
-/*  Returns:    0 if the function is successfully closed,   */
-/*              -1 otherwise.                               */
+/*  Returns:    0 on success, or -1 if a write failed. It   */
+/*              stops at the first error, the card may be   */
+/*              gone already.                               */
 /************************************************************/
-static int FATFileClose(NUTFILE * hNUTFile)
+int FATSync(void)
 {
     int      nError;
-    FHANDLE *hFile;
-
-    nError = NUTDEV_ERROR;
+#if (FAT_SUPPORT_WRITE >= 1)
+    nError = NUTDEV_OK;
 
     FATLock();
 
-    if (hNUTFile != NULL)
+    if (FATWriteBack(0xFF) != HW_OK)
     {
-        hFile = (FHANDLE *) hNUTFile->nf_fcb;
-        if (hFile != NULL)
+        nError = NUTDEV_ERROR;
+    }
+
+    FATFree();
+#else
+    nError = NUTDEV_OK;
+#endif /* (FAT_SUPPORT_WRITE >= 1) */
+
+    return(nError);
+}
+
+/************************************************************/
+/*  DirStart                                                */
+/*                                                          */
+/*  Position the iterator at the first entry of the         */
+/*  directory that starts at dwCluster.                     */
+/************************************************************/
+static void DirStart(FATDIR *pDir, DWORD dwCluster)
+{
+    DRIVE_INFO *pDrive = pDir->pDrive;
+
+    pDir->dwCluster  = dwCluster;
+    pDir->dwSector   = GetFirstSectorOfCluster(pDrive, dwCluster);
+    pDir->wMaxSector = pDrive->bSectorsPerCluster;
+
+    //
+    // Test for special case dwDirCluster and FAT16.
+    //
+    if ((dwCluster == 1) && (pDrive->bIsFAT32 == FALSE))
+    {
+        pDir->dwSector   = pDrive->dwFirstRootDirSector;
+        pDir->wMaxSector = (WORD) pDrive->dwRootDirSectors;
+    }
+
+    pDir->wSector   = 0;
+    pDir->bEntry    = 16;
+    pDir->bEnd      = FALSE;
+    pDir->bLfnValid = FALSE;
+}
+
+/************************************************************/
+/*  DirNextSector                                           */
+/*                                                          */
+/*  Read the next sector of the directory into the buffer   */
+/*  of the iterator, following the cluster chain.           */
+/************************************************************/
+static int DirNextSector(FATDIR *pDir)
+{
+    DRIVE_INFO *pDrive = pDir->pDrive;
+
+    if (pDir->wSector >= pDir->wMaxSector)
+    {
+        if ((pDir->dwCluster == 1) && (pDrive->bIsFAT32 == FALSE))
         {
-            //
-            // Clear our FAT-Handle
-            //
-            NutHeapFree(hFile);
+            pDir->dwCluster = 0;
         }
-        //
-        // Clear the NUT-Handle
-        //
-        NutHeapFree(hNUTFile);
+        else
+        {
+            pDir->dwCluster = GetNextCluster(pDrive, pDir->dwCluster);
+        }
+        if (pDir->dwCluster == 0)
+        {
+            pDir->bEnd = TRUE;
+            return(FAT_ERROR);
+        }
+        pDir->dwSector = GetFirstSectorOfCluster(pDrive, pDir->dwCluster);
+        pDir->wSector  = 0;
+    }
 
-        nError = NUTDEV_OK;
+    if (HWReadSectors(pDrive->bDevice, pDir->pBuffer, pDir->dwSector + pDir->wSector, 1) != HW_OK)
+    {
+        return(FAT_ERROR);
+    }
+    pDir->wSector++;
+    pDir->bEntry = 0;
+
+    return(FAT_OK);
+}
+
+/************************************************************/
+/*  DirPutLongChars                                         */
+/*                                                          */
+/*  Store the 13 characters of a long name entry at their   */
+/*  place in the name. Characters above 0xFF become '?'.    */
+/************************************************************/
+static void DirPutLongChars(FATDIR *pDir, FAT32_DIRECTORY_ENTRY_LONG *pLong, BYTE bSeq)
+{
+    BYTE i;
+    WORD wChar;
+    int  nPos;
+
+    for (i = 0; i < 13; i++)
+    {
+        if (i < 5)
+        {
+            wChar = pLong->Name1[i];
+        }
+        else if (i < 11)
+        {
+            wChar = pLong->Name2[i - 5];
+        }
+        else
+        {
+            wChar = pLong->Name3[i - 11];
+        }
+
+        nPos = ((int) (bSeq - 1) * 13) + i;
+        if ((nPos >= (FAT_DIRENT_NAME_LEN - 1)) || (wChar == 0xFFFF))
+        {
+            continue;
+        }
+        if (wChar == 0)
+        {
+            pDir->szLongName[nPos] = 0;
+        }
+        else
+        {
+            pDir->szLongName[nPos] = (wChar < 0x100) ? (char) wChar : '?';
+        }
     }
+}
+
+/************************************************************/
+/*  DirShortChecksum                                        */
+/************************************************************/
+static BYTE DirShortChecksum(FAT32_DIRECTORY_ENTRY *pShort)
+{
+    BYTE  i;
+    BYTE  bSum = 0;
+    BYTE *pName = pShort->Name;
 
-    FATFree();
+    for (i = 0; i < (FAT_NAME_LEN + FAT_EXT_LEN); i++)
+    {
+        bSum = (BYTE) (((bSum & 1) ? 0x80 : 0) + (bSum >> 1) + pName[i]);
+    }
 
-    return(nError);
+    return(bSum);
 }
 
 /************************************************************/
-/*  FATFileSize                                             */
-/*                                                          */
-/*  Retrieve the size of a file.                            */
-/*                                                          */
-/*  Parameters: pFile Identifies the file to query.         */
-/*              This pointer must have been created by      */
-/*              calling FAT32FileOpen().                    */
+/*  DirShortName                                            */
 /*                                                          */
-/*  Returns:    The number of bytes in this file or         */
-/*              -1 if an error occured                      */
+/*  Build "NAME.EXT" from a short entry, honouring the      */
+/*  lower case flags Windows NT keeps in Reserved[0].       */
 /************************************************************/
-long FATFileSize(NUTFILE * hNUTFile)
+static void DirShortName(FAT32_DIRECTORY_ENTRY *pShort, char *pName)
 {
-    long     lSize;
-    FHANDLE *hFile;
+    BYTE i;
+    char c;
 
-    FATLock();
-
-    lSize = NUTDEV_ERROR;
-
-    if (hNUTFile != NULL)
+    for (i = 0; (i < FAT_NAME_LEN) && (pShort->Name[i] != ' '); i++)
     {
-        hFile = (FHANDLE *) hNUTFile->nf_fcb;
-        if (hFile != NULL)
+        c = (char) pShort->Name[i];
+        if ((i == 0) && (pShort->Name[0] == 0x05))
         {
-            lSize = hFile->dwFileSize;
+            c = (char) 0xE5;
         }
+        *pName++ = (pShort->Reserved[0] & 0x08) ? tolower(c) : c;
     }
 
-    FATFree();
-
-    return(lSize);
+    if (pShort->Extension[0] != ' ')
+    {
+        *pName++ = '.';
+        for (i = 0; (i < FAT_EXT_LEN) && (pShort->Extension[i] != ' '); i++)
+        {
+            c = (char) pShort->Extension[i];
+            *pName++ = (pShort->Reserved[0] & 0x10) ? tolower(c) : c;
+        }
+    }
+    *pName = 0;
 }
 
-#if 0
 /************************************************************/
-/*  FATFileSeek                                             */
+/*  DirReadEntry                                            */
 /*                                                          */
-/*  Move the file pointer to a new position.                */
-/*  It points to the next byte to be read from a file.      */
-/*  The file pointer is automatically incremented for       */
-/*  each byte read. When the file is opened, it is at       */
-/*  position 0, the beginning of the file.                  */
-/*                                                          */
-/*  Parameters: pFile Identifies the file to seek.          */
-/*              This pointer must have been created by      */
-/*              calling FAT32FileOpen().                    */
+/*  Return the next entry of the directory. Long name       */
+/*  entries are assembled on the fly and only used when     */
+/*  their checksum matches the short entry that follows.    */
+/*  Deleted entries, the volume label, "." and ".." are     */
+/*  skipped.                                                */
 /*                                                          */
-/*              lPos Specifies the new absolute position    */
-/*              of the file pointer.                        */
-/*                                                          */
-/*  Returns:    0 if the function is successful,            */
-/*              -1 otherwise.                               */
+/*  Returns:    1 for an entry, 0 at the end of the         */
+/*              directory, -1 on a read error.              */
 /************************************************************/
-int FATFileSeek(FILE * pFile, long lPos)
+static int DirReadEntry(FATDIR *pDir, FATDIRENT *pEntry)
 {
-    int      nError = NUTDEV_ERROR;
-    FHANDLE *hFile;
+    BYTE                        bSeq;
+    FAT32_DIRECTORY_ENTRY      *pShort;
+    FAT32_DIRECTORY_ENTRY_LONG *pLong;
 
-    FATLock();
+    while (pDir->bEnd == FALSE)
+    {
+        if (pDir->bEntry >= 16)
+        {
+            if (DirNextSector(pDir) != FAT_OK)
+            {
+                return((pDir->bEnd == TRUE) ? 0 : -1);
+            }
+        }
 
-    hFile = (FHANDLE *) pFile;
+        pShort = &((FAT_DIR_TABLE *) pDir->pBuffer)->aShort[pDir->bEntry];
+        pLong  = &((FAT_DIR_TABLE *) pDir->pBuffer)->aLong[pDir->bEntry];
+        pDir->bEntry++;
 
-    //
-    // We must do some work here...
-    //
-    nError = FAT32_ERROR;
+        if (pShort->Name[0] == 0x00)
+        {
+            pDir->bEnd = TRUE;
+            break;
+        }
+        if (pShort->Name[0] == 0xE5)
+        {
+            pDir->bLfnValid = FALSE;
+            continue;
+        }
 
-    FATFree();
+        if ((pShort->Attribute & DIRECTORY_ATTRIBUTE_LONG_NAME_MASK) == DIRECTORY_ATTRIBUTE_LONG_NAME)
+        {
+            bSeq = pLong->Order & 0x1F;
+            if (pLong->Order & 0x40)
+            {
+                //
+                // Last part of the name comes first
+                //
+                pDir->bLfnValid    = TRUE;
+                pDir->bLfnNext     = bSeq;
+                pDir->bLfnChecksum = pLong->Chksum;
+                pDir->szLongName[((int) bSeq * 13 < FAT_DIRENT_NAME_LEN) ?
+                                 (int) bSeq * 13 : FAT_DIRENT_NAME_LEN - 1] = 0;
+            }
+            if ((pDir->bLfnValid == TRUE) && (bSeq != 0) &&
+                (bSeq == pDir->bLfnNext) && (pLong->Chksum == pDir->bLfnChecksum))
+            {
+                DirPutLongChars(pDir, pLong, bSeq);
+                pDir->bLfnNext--;
+            }
+            else
+            {
+                pDir->bLfnValid = FALSE;
+            }
+            continue;
+        }
 
-    return(nError);
+        if ((pShort->Attribute & DIRECTORY_ATTRIBUTE_VOLUME_ID) ||
+            ((pShort->Name[0] == '.') && ((pShort->Name[1] == ' ') || (pShort->Name[1] == '.'))))
+        {
+            pDir->bLfnValid = FALSE;
+            continue;
+        }
+
+        if ((pDir->bLfnValid == TRUE) && (pDir->bLfnNext == 0) &&
+            (DirShortChecksum(pShort) == pDir->bLfnChecksum))
+        {
+            strcpy(pEntry->szName, pDir->szLongName);
+            DirShortName(pShort, pEntry->szShortName);
+        }
+        else
+        {
+            DirShortName(pShort, pEntry->szName);
+            strcpy(pEntry->szShortName, pEntry->szName);
+        }
+        pDir->bLfnValid = FALSE;
+
+        pEntry->bAttribute = pShort->Attribute;
+        pEntry->dwSize     = pShort->FileSize;
+        pEntry->dwCluster  = ((DWORD) pShort->HighCluster << 16) | (DWORD) pShort->LowCluster;
+
+        return(1);
+    }
+
+    return(0);
 }
-#endif
 
 /************************************************************/
-/*  FATFileRead                                             */
-/*                                                          */
-/*  Read data from a file.                                  */
+/*  FATDirOpen                                              */
 /*                                                          */
-/*  Parameters: pFile Identifies the file to read from.     */
-/*              This pointer must have been created by      */
-/*              calling FAT32FileOpen().                    */
+/*  Open a directory for enumeration with FATDirRead.       */
+/*  Only one sector of the directory is held in memory.     */
 /*                                                          */
-/*              pData Points to the buffer that receives    */
-/*              the data.                                   */
+/*  Parameters: pDevice Identifies the FAT device.          */
 /*                                                          */
-/*              nSize Specifies the number of bytes to      */
-/*              read from the file.                         */
+/*              pPath Path of the directory, e.g. "/" or    */
+/*              "music/album". Names are compared case      */
+/*              insensitive, long or short.                 */
 /*                                                          */
-/*  Returns:    The number of bytes read from the file or   */
-/*               -1 if an error occured.                    */
+/*  Returns:    A handle for FATDirRead, or NULL on error.  */
 /************************************************************/
-int FATFileRead(NUTFILE * hNUTFile, void *pData, int nSize)
+FATDIR *FATDirOpen(NUTDEVICE *pDevice, CONST char *pPath)
 {
-    int         nError;
-    int         nBytesRead;
-    int         nBytesToRead;
-    FHANDLE    *hFile;
+    FATDIR     *pDir;
+    FATDIRENT   sEntry;
     DRIVE_INFO *pDrive;
-    BYTE       *pByte;
-    DWORD      dwReadSector;
-    DWORD      dwSector;
-    int         nSectorCount;
-    int         nSectorOffset;
-    WORD        wSectorSize;
+    CONST char *pName;
+    int         nLen;
+    int         nResult;
 
-    nBytesRead = 0;
+    if (nIsInit == FALSE)
+    {
+        return(NULL);
+    }
 
     FATLock();
 
-    hFile  = NULL;
-    nError = NUTDEV_ERROR;
+    pDir   = NULL;
+    pDrive = GetDriveByDevice(pDevice);
 
-    if (hNUTFile != NULL)
+    if ((pDrive != NULL) && (pDrive->bSectorsPerCluster != 0) &&
+        ((pDrive->bFlags & FLAG_FAT_IS_CDROM) == 0))
     {
-        hFile = (FHANDLE *) hNUTFile->nf_fcb;
+        pDir = (FATDIR *) NutHeapAlloc(sizeof(FATDIR));
+        if (pDir != NULL)
+        {
+            pDir->pDrive  = pDrive;
+            pDir->pBuffer = (BYTE *) NutHeapAlloc(pDrive->wSectorSize);
+            if (pDir->pBuffer == NULL)
+            {
+                NutHeapFree(pDir);
+                pDir = NULL;
+            }
+        }
     }
 
-    if ((hFile != NULL) && (nSize != 0))
+    if (pDir != NULL)
     {
-        if (hFile->dwFilePointer < hFile->dwFileSize)
-        {
+        DirStart(pDir, pDrive->dwRootCluster);
 
-            if ((hFile->dwFilePointer + nSize) > hFile->dwFileSize)
+        //
+        // Walk down the path, one component at a time
+        //
+        while (*pPath != 0)
+        {
+            while ((*pPath == '/') || (*pPath == '\\'))
             {
-                nSize = (int) (hFile->dwFileSize - hFile->dwFilePointer);
+                pPath++;
             }
-
-            pDrive = (DRIVE_INFO *) hFile->pDrive;
-            pByte  = (BYTE *) pData;
-
-            nBytesRead  = nSize;
-            wSectorSize = pDrive->wSectorSize;
-
-            while (nSize)
+            if (*pPath == 0)
             {
-                dwSector = GetFirstSectorOfCluster(pDrive, hFile->dwReadCluster);
-                nSectorCount = hFile->dwClusterPointer / wSectorSize;
-                nSectorOffset = hFile->dwClusterPointer % wSectorSize;
-
-                //
-                // (Sector + SectorCount) is the sector to read
-                // SectorOffset is the start position in the sector itself
-                //
-                dwReadSector = dwSector + nSectorCount;
-
-                nError = HWReadSectors(pDrive->bDevice, pSectorBuffer, dwReadSector, 1);
-                if (nError == HW_OK)
-                {
-                    //
-                    // Find the size we can read from ONE sector
-                    //
-                    if (nSize > (int) wSectorSize)
-                    {
-                        nBytesToRead = wSectorSize;
-                    }
-                    else
-                    {
-                        nBytesToRead = nSize;
-                    }
-
-                    //
-                    // Test inside a sector
-                    //
-                    if ((nSectorOffset + nBytesToRead) > (int) wSectorSize)
-                    {
-                        nBytesToRead = wSectorSize - nSectorOffset;
-                    }
-
-                    memcpy(pByte, &pSectorBuffer[nSectorOffset], nBytesToRead);
-                    pByte += nBytesToRead;
-
-                    hFile->dwFilePointer    += nBytesToRead;
-                    hFile->dwClusterPointer += nBytesToRead;
-
-                    //
-                    // Check for EOF
-                    if (hFile->dwFilePointer >= hFile->dwFileSize)
-                    {
-                        hFile->nEOF = TRUE;
-                    }
-
-                    if (hFile->dwClusterPointer >= pDrive->dwClusterSize)
-                    {
-                        //
-                        // We must switch to the next cluster
-                        //
-                        hFile->dwReadCluster = GetNextCluster(pDrive, hFile->dwReadCluster);
-                        hFile->dwClusterPointer = 0;
-                    }
-
-                    nSize -= nBytesToRead;
-
-                }
-                else
-                {  /* HWReadSectors Error */
-
-                    nBytesRead = 0;
-                    hFile->nLastError = FAT_ERROR_IDE;
-                    break;
-                } /* endif nError == HW_OK */
+                break;
+            }
 
-            } /* endwhile */
+            pName = pPath;
+            while ((*pPath != '/') && (*pPath != '\\') && (*pPath != 0))
+            {
+                pPath++;
+            }
+            nLen = (int) (pPath - pName);
 
+            do
+            {
+                nResult = DirReadEntry(pDir, &sEntry);
+            } while ((nResult == 1) &&
+                     (((sEntry.bAttribute & DIRECTORY_ATTRIBUTE_DIRECTORY) == 0) ||
+                      (((strlen(sEntry.szName) != (size_t) nLen) ||
+                        (strncasecmp(sEntry.szName, pName, nLen) != 0)) &&
+                       ((strlen(sEntry.szShortName) != (size_t) nLen) ||
+                        (strncasecmp(sEntry.szShortName, pName, nLen) != 0)))));
+
+            if ((nResult != 1) || (sEntry.dwCluster == 0))
+            {
+                NutHeapFree(pDir->pBuffer);
+                NutHeapFree(pDir);
+                pDir = NULL;
+                break;
+            }
+            DirStart(pDir, sEntry.dwCluster);
         }
-        else
-        {  /* reached the EOF */
-            hFile->nLastError = FAT_ERROR_EOF;
-        } /* endif hFile->dwFilePointer < hFile->dwFileSize */
-
     }
-    /*
-     * endif (hFile != NULL) && (nSize != 0) 
-     */
+
     FATFree();
 
-    return(nBytesRead);
+    return(pDir);
 }
 
 /************************************************************/
-/*  FATFileWrite                                            */
-/*                                                          */
-/*  Write data to a file.                                   */
-/*                                                          */
-/*  Parameters: pFile Identifies the file to write to.      */
-/*              This pointer must have been created by      */
-/*              calling FAT32FileOpen().                    */
-/*                                                          */
-/*              pData Points to the buffer that holds       */
-/*              the data.                                   */
+/*  FATDirRead                                              */
 /*                                                          */
-/*              nSize Specifies the number of bytes to      */
-/*              write to the file.                          */
+/*  Get the next entry of a directory opened by FATDirOpen. */
 /*                                                          */
-/*  Returns:    The number of bytes written to the file or  */
-/*               -1 if an error occured.                    */
+/*  Returns:    1 if pEntry is filled, 0 at the end of the  */
+/*              directory, -1 on error.                     */
 /************************************************************/
-static int FATFileWrite(NUTFILE * hNUTFile, CONST void *pData, int nSize)
+int FATDirRead(FATDIR *pDir, FATDIRENT *pEntry)
 {
-    int nError;
+    int nResult;
 
-    nError = NUTDEV_ERROR;
+    if ((pDir == NULL) || (pEntry == NULL))
+    {
+        return(-1);
+    }
 
-    return(nError);
+    FATLock();
+    nResult = DirReadEntry(pDir, pEntry);
+    FATFree();
+
+    return(nResult);
 }
 
-#ifdef __HARVARD_ARCH__
-static int FATFileWriteP(NUTFILE * hNUTFile, PGM_P pData, int nSize)
+/************************************************************/
+/*  FATDirClose                                             */
+/************************************************************/
+void FATDirClose(FATDIR *pDir)
 {
-    int nError;
-
-    nError = NUTDEV_ERROR;
-
-    return(nError);
+    if (pDir != NULL)
+    {
+        NutHeapFree(pDir->pBuffer);
+        NutHeapFree(pDir);
+    }
 }
-#endif
 
 /************************************************************/
 /*  FATIOCtl                                                */
@@ -1753,6 +4107,31 @@ int FATIOCtl(NUTDEVICE *dev, int req, void *conf)
     {
         switch (req)
         {
+            case FS_FILE_SEEK: {
+                    IOCTL_ARG3 *pArgs = (IOCTL_ARG3 *) conf;
+
+                    nError = FATFileSeek((NUTFILE *) pArgs->arg1, (long *) pArgs->arg2,
+                                         (int) (uptr_t) pArgs->arg3);
+                    break;
+                }
+
+            case FAT_IOCTL_GET_CLUSTER_SIZE: {
+                    *((DWORD *) conf) = pDrive->dwClusterSize;
+                    nError = NUTDEV_OK;
+                    break;
+                }
+
+            case FAT_IOCTL_GET_VOLUME_INFO: {
+                    FATVOLINFO *pInfo = (FATVOLINFO *) conf;
+
+                    FATLock();
+                    pInfo->dwVolumeID  = pDrive->dwVolumeID;
+                    pInfo->dwFreeCount = pDrive->dwFreeCount;
+                    pInfo->dwNextFree  = pDrive->dwNextFree;
+                    FATFree();
+                    nError = NUTDEV_OK;
+                    break;
+                }
 
 #if (FAT_SUPPORT_FORMAT >= 1)    
             case FAT_IOCTL_QUICK_FORMAT: {
@@ -18,9 +18,9 @@
 #include <cfg/memory.h>
 
 #include <sys/timer.h>
+#include <sys/event.h>
 
 #include <string.h>
-#include <stdlib.h>
 
 #include "typedefs.h"
 #include "flash.h"
@@ -48,12 +48,24 @@
 #define AT45_WRITE_POLLS        1000
 #endif
 
+#ifndef AT45_XFER_POLLS
+#define AT45_XFER_POLLS         100     /* page to buffer takes 250 us max. */
+#endif
+
 #define DFCMD_READ_PAGE         0xD2    /* Read main memory page. */
 #define DFCMD_READ_STATUS       0xD7    /* Read status register. */
 #define DFCMD_CONT_READ         0xE8    /* Continuos read. */
 #define DFCMD_PAGE_ERASE        0x81    /* Page erase. */
 #define DFCMD_BUF1_WRITE        0x84    /* Buffer 1 write. */
 #define DFCMD_BUF1_FLASH        0x83    /* Buffer 1 flash with page erase. */
+#define DFCMD_BUF1_LOAD         0x53    /* Main memory page to buffer 1 transfer. */
+#define DFCMD_BUF1_COMPARE      0x60    /* Main memory page to buffer 1 compare. */
+#define DFCMD_BUF2_WRITE        0x87    /* Buffer 2 write. */
+#define DFCMD_BUF2_FLASH        0x86    /* Buffer 2 flash with page erase. */
+#define DFCMD_BUF2_COMPARE      0x61    /* Main memory page to buffer 2 compare. */
+
+#define AT45_STATUS_READY       0x80
+#define AT45_STATUS_COMP        0x40    /* Last compare found a difference. */
 
 /*
  *  \brief last page of flash (264 bytes) can be dedicated for parameter storage
@@ -66,6 +78,19 @@
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
+/*!
+ * \brief State of the streaming write, see At45dbWriteBegin().
+ */
+typedef struct _AT45DB_WRITER
+{
+    u_long wr_pgn;              /* page the buffer is filled for */
+    u_int wr_fill;              /* bytes in that buffer */
+    u_char wr_buf;              /* buffer being filled, 0 or 1 */
+    u_char wr_busy;             /* the other buffer is being programmed */
+    u_char wr_open;             /* At45dbWriteBegin() was called */
+    int wr_programmed;          /* pages programmed so far */
+} AT45DB_WRITER;
+
 /*!
  * \brief Known device type entry.
  */
@@ -109,10 +134,21 @@ AT45_DEVTAB at45_devt[] = {
  */
 static AT45DB_DCB dcbtab;
 
+/*!
+ * \brief The one streaming write.
+ */
+static AT45DB_WRITER writer;
+
+/*!
+ * \brief Owner of the SRAM buffers, see At45dbLock().
+ */
+static HANDLE hAt45Mutex = SIGNALED;
+
 /*-------------------------------------------------------------------------*/
 /* local routines (prototyping)                                            */
 /*-------------------------------------------------------------------------*/
 static int At45dbTransfer(CONST void *txbuf, void *rxbuf, int xlen, CONST void *txnbuf, void *rxnbuf, int xnlen);
+static int At45dbWriteFlush(void);
 
 /*!
  * \addtogroup SerialFlash
@@ -138,6 +174,7 @@ static int At45dbTransfer(CONST void *txbuf, void *rxbuf, int xlen, CONST void *
 {   int i;
     u_char *ptTxbuf, *ptRxbuf;
 
+    SPIlock();
     SPIselect(SPI_DEV_FLASH);
 
     ptTxbuf=(u_char*)txbuf;
@@ -150,17 +187,13 @@ static int At45dbTransfer(CONST void *txbuf, void *rxbuf, int xlen, CONST void *
         *ptRxbuf++=SPItransferByte(*ptTxbuf++);
     }
 
-    ptTxbuf=(u_char*)txnbuf;
-    ptRxbuf=(u_char*)rxnbuf;
     /*
      *  send dummy data, store the bytes that were read the same time
      */
-    for (i=0; i<xnlen; ++i)
-    {
-        *ptRxbuf++=SPItransferByte(*ptTxbuf++);
-    }
+    SPItransfer(SPI_DEV_FLASH, txnbuf, rxnbuf, xnlen);
 
     SPIdeselect();
+    SPIunlock();
 
     return(0);  // always...
 
@@ -213,7 +246,7 @@ int At45dbWaitReady(u_long tmo, int poll)
 {
     u_char sr;
 
-    while (((sr = At45dbGetStatus()) & 0x80) == 0)
+    while (((sr = At45dbGetStatus()) & AT45_STATUS_READY) == 0)
     {
         if (!poll)
         {
@@ -280,10 +313,70 @@ int At45dbPageRead(u_long pgn, void *data, u_int len)
     return (At45dbSendCmd(DFCMD_CONT_READ, pgn, 8, data, data, len));
 }
 
+/*!
+ * \brief Read data from flash memory, starting at any byte within a page.
+ *
+ * Uses the continuous read, so the data may cross page boundaries.
+ *
+ * \param pgn  Page number to start reading, starting at 0.
+ * \param off  Byte offset within that page.
+ * \param data Points to a buffer that receives the data.
+ * \param len  Number of bytes to read.
+ *
+ * \return 0 on success or -1 in case of an error.
+ */
+int At45dbRead(u_long pgn, u_int off, void *data, u_int len)
+{
+    if (dcbtab.dcb_devt == NULL)
+    {
+        return (-1);
+    }
+    pgn <<= dcbtab.dcb_devt->devt_offs;
+    return (At45dbSendCmd(DFCMD_CONT_READ, pgn | off, 8, data, data, len));
+}
+
+/*!
+ * \brief Return the page size of the detected device.
+ *
+ * \return Number of bytes in one page, 0 if no device was detected.
+ */
+u_int At45dbPageSize(void)
+{
+    if (dcbtab.dcb_devt == NULL)
+    {
+        return (0);
+    }
+    return (dcbtab.dcb_devt->devt_pagsiz);
+}
+
+/*!
+ * \brief Claim the SRAM buffers of the chip.
+ *
+ * At45dbPageWrite(), the At45dbBuffer routines and a streaming write
+ * from At45dbWriteBegin() to At45dbWriteEnd() change the buffers, so
+ * their callers hold the lock around the whole sequence. Reads of a
+ * page that may be written concurrently take it as well.
+ *
+ * Calls must not be nested.
+ */
+void At45dbLock(void)
+{
+    NutEventWait(&hAt45Mutex, 0);
+}
+
+/*!
+ * \brief Release the SRAM buffers, see At45dbLock().
+ */
+void At45dbUnlock(void)
+{
+    NutEventPost(&hAt45Mutex);
+}
+
 /*!
  * \brief Write data into flash memory.
  *
- * The related sector must have been erased before calling this function.
+ * The page is erased by the chip first. Waits until the page is
+ * programmed, see At45dbWriteBegin() for long writes.
  *
  * \param pgn  Start location within the chip, starting at 0.
  * \param data Points to a buffer that contains the bytes to be written.
@@ -293,24 +386,233 @@ int At45dbPageRead(u_long pgn, void *data, u_int len)
  */
 int At45dbPageWrite(u_long pgn, CONST void *data, u_int len)
 {
-    int rc = -1;
-    void *rp;
+    /* Copy data to dataflash RAM buffer, the bytes read back are dropped. */
+    if (At45dbBufferWrite(0, data, len) == 0)
+    {
+        /* Flash RAM buffer. */
+        return (At45dbBufferFlash(pgn));
+    }
+    return (-1);
+}
+
+/*!
+ * \brief Copy a main memory page into the SRAM buffer.
+ *
+ * Used together with At45dbBufferWrite() and At45dbBufferFlash() to change
+ * a few bytes of a page with a single page program.
+ *
+ * \param pgn  Page number, starting at 0.
+ *
+ * \return 0 on success or -1 in case of an error.
+ */
+int At45dbBufferLoad(u_long pgn)
+{
+    if (dcbtab.dcb_devt == NULL)
+    {
+        return (-1);
+    }
+    pgn <<= dcbtab.dcb_devt->devt_offs;
+    if (At45dbSendCmd(DFCMD_BUF1_LOAD, pgn, 4, NULL, NULL, 0) == 0)
+    {
+        return (At45dbWaitReady(AT45_XFER_POLLS, 1));
+    }
+    return (-1);
+}
+
+/*!
+ * \brief Write data into the SRAM buffer.
+ *
+ * \param off  Byte offset within the buffer.
+ * \param data Points to the bytes to write, NULL writes 0xFF bytes.
+ * \param len  Number of bytes to write.
+ *
+ * \return 0 on success or -1 in case of an error.
+ */
+int At45dbBufferWrite(u_int off, CONST void *data, u_int len)
+{
+    return (At45dbSendCmd(DFCMD_BUF1_WRITE, off, 4, data, NULL, len));
+}
+
+/*!
+ * \brief Program the SRAM buffer into a main memory page.
+ *
+ * The page is erased by the chip first.
+ *
+ * \param pgn  Page number, starting at 0.
+ *
+ * \return 0 on success or -1 in case of an error.
+ */
+int At45dbBufferFlash(u_long pgn)
+{
+    if (dcbtab.dcb_devt == NULL)
+    {
+        return (-1);
+    }
+    pgn <<= dcbtab.dcb_devt->devt_offs;
+    if (At45dbSendCmd(DFCMD_BUF1_FLASH, pgn, 4, NULL, NULL, 0) == 0)
+    {
+        return (At45dbWaitReady(AT45_WRITE_POLLS, 1));
+    }
+    return (-1);
+}
+
+/*!
+ * \brief Program a filled buffer of the streaming write.
+ *
+ * The page is compared with the buffer first and only programmed when
+ * it differs. The program is started but not waited for, the caller
+ * fills the other buffer in the meantime.
+ *
+ * \return 0 on success or -1 in case of an error.
+ */
+static int At45dbWriteFlush(void)
+{
+    u_long addr = writer.wr_pgn << dcbtab.dcb_devt->devt_offs;
+    u_int size = dcbtab.dcb_devt->devt_pagsiz;
 
-    if ((rp = malloc(len)) != NULL)
+    /* The tail of a partly filled page is erased. */
+    if (writer.wr_fill < size)
     {
-        /* Copy data to dataflash RAM buffer. */
-        if (At45dbSendCmd(DFCMD_BUF1_WRITE, 0, 4, data, rp, len) == 0)
+        if (At45dbSendCmd(writer.wr_buf ? DFCMD_BUF2_WRITE : DFCMD_BUF1_WRITE, writer.wr_fill, 4,
+                          NULL, NULL, size - writer.wr_fill))
         {
-            /* Flash RAM buffer. */
-            pgn <<= dcbtab.dcb_devt->devt_offs;
-            if (At45dbSendCmd(DFCMD_BUF1_FLASH, pgn, 4, NULL, NULL, 0) == 0)
-            {
-                rc = At45dbWaitReady(AT45_WRITE_POLLS, 1);
-            }
+            return (-1);
         }
-        free(rp);
     }
-    return (rc);
+
+    /* The compare reads the main memory, so the previous program must be done. */
+    if (writer.wr_busy)
+    {
+        if (At45dbWaitReady(AT45_WRITE_POLLS, 1))
+        {
+            return (-1);
+        }
+        writer.wr_busy = 0;
+    }
+
+    if (At45dbSendCmd(writer.wr_buf ? DFCMD_BUF2_COMPARE : DFCMD_BUF1_COMPARE, addr, 4, NULL, NULL, 0) ||
+        At45dbWaitReady(AT45_XFER_POLLS, 1))
+    {
+        return (-1);
+    }
+
+    if (At45dbGetStatus() & AT45_STATUS_COMP)
+    {
+        if (At45dbSendCmd(writer.wr_buf ? DFCMD_BUF2_FLASH : DFCMD_BUF1_FLASH, addr, 4, NULL, NULL, 0))
+        {
+            return (-1);
+        }
+        writer.wr_busy = 1;
+        writer.wr_programmed++;
+    }
+
+    writer.wr_buf ^= 1;
+    writer.wr_pgn++;
+    writer.wr_fill = 0;
+    return (0);
+}
+
+/*!
+ * \brief Start a streaming write.
+ *
+ * The data passed to At45dbWriteData() goes to consecutive pages. Both
+ * SRAM buffers are used in turn: one is filled while the other one is
+ * being programmed, so a long write runs at about the page program time
+ * of the chip. Pages that already hold the data are not programmed.
+ *
+ * Until At45dbWriteEnd() the buffers belong to the streaming write,
+ * At45dbPageWrite() and the At45dbBuffer routines must not be used.
+ * The caller holds At45dbLock() from here until At45dbWriteEnd().
+ *
+ * \param pgn  First page to write, starting at 0.
+ *
+ * \return 0 on success or -1 in case of an error.
+ */
+int At45dbWriteBegin(u_long pgn)
+{
+    if (dcbtab.dcb_devt == NULL)
+    {
+        return (-1);
+    }
+    memset(&writer, 0, sizeof(writer));
+    writer.wr_pgn = pgn;
+    writer.wr_open = 1;
+    return (0);
+}
+
+/*!
+ * \brief Add data to the streaming write.
+ *
+ * \param data Points to the bytes to write.
+ * \param len  Number of bytes to write, any amount.
+ *
+ * \return 0 on success or -1 in case of an error.
+ */
+int At45dbWriteData(CONST void *data, u_int len)
+{
+    CONST u_char *bp = (CONST u_char *)data;
+    u_int size;
+    u_int part;
+
+    if (!writer.wr_open)
+    {
+        return (-1);
+    }
+    size = dcbtab.dcb_devt->devt_pagsiz;
+
+    while (len > 0)
+    {
+        part = size - writer.wr_fill;
+        if (part > len)
+        {
+            part = len;
+        }
+        if (At45dbSendCmd(writer.wr_buf ? DFCMD_BUF2_WRITE : DFCMD_BUF1_WRITE, writer.wr_fill, 4,
+                          bp, NULL, part))
+        {
+            return (-1);
+        }
+        bp += part;
+        len -= part;
+        writer.wr_fill += part;
+
+        if (writer.wr_fill == size && At45dbWriteFlush())
+        {
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+/*!
+ * \brief Finish the streaming write.
+ *
+ * Programs the last, partly filled, page with the rest of it erased and
+ * waits until the chip is done.
+ *
+ * \return The number of pages programmed or -1 in case of an error.
+ */
+int At45dbWriteEnd(void)
+{
+    if (!writer.wr_open)
+    {
+        return (-1);
+    }
+    writer.wr_open = 0;
+
+    if (writer.wr_fill > 0 && At45dbWriteFlush())
+    {
+        return (-1);
+    }
+    if (writer.wr_busy)
+    {
+        if (At45dbWaitReady(AT45_WRITE_POLLS, 1))
+        {
+            return (-1);
+        }
+        writer.wr_busy = 0;
+    }
+    return (writer.wr_programmed);
 }
 
 #ifdef USE_FLASH_PARAM_PAGE
@@ -347,20 +649,11 @@ int At45dbParamSize(void)
  */
 int At45dbParamRead(u_int pos, void *data, u_int len)
 {
-    int rc = -1;
-    u_char *buff;
-    int csize = At45dbParamSize();
-    u_long cpage = At45dbParamPage();
-
-    /* Load the complete configuration area. */
-    if (csize > len && (buff = malloc(csize)) != NULL)
+    if (pos + len > At45dbParamSize())
     {
-        rc = At45dbPageRead(cpage, buff, csize);
-        /* Copy requested contents to caller's buffer. */
-        memcpy(data, buff + pos, len);
-        free(buff);
+        return (-1);
     }
-    return (rc);
+    return (At45dbRead(At45dbParamPage(), pos, data, len));
 }
 
 /*!
@@ -374,26 +667,30 @@ int At45dbParamRead(u_int pos, void *data, u_int len)
  */
 int At45dbParamWrite(u_int pos, CONST void *data, u_int len)
 {
-    int rc = -1;
-    u_char *buff;
-    int csize = At45dbParamSize();
     u_long cpage = At45dbParamPage();
 
-    /* Load the complete configuration area. */
-    if (csize > len && (buff = malloc(csize)) != NULL)
+    if (pos + len > At45dbParamSize())
     {
-        rc = At45dbPageRead(cpage, buff, csize);
-        /* Compare old with new contents. */
-        if (memcmp(buff + pos, data, len))
-        {
-            /* New contents differs. Copy it into the sector buffer. */
-            memcpy(buff + pos, data, len);
-            /* Erase sector and write new data. */
-            rc = At45dbPageWrite(cpage, buff, csize);
-        }
-        free(buff);
+        return (-1);
     }
-    return (rc);
+
+    /* Patch the new contents into a copy of the page. */
+    if (At45dbBufferLoad(cpage) || At45dbBufferWrite(pos, data, len))
+    {
+        return (-1);
+    }
+
+    /* Only erase and write the page if the contents differs. */
+    if (At45dbSendCmd(DFCMD_BUF1_COMPARE, cpage << dcbtab.dcb_devt->devt_offs, 4, NULL, NULL, 0) ||
+        At45dbWaitReady(AT45_XFER_POLLS, 1))
+    {
+        return (-1);
+    }
+    if (At45dbGetStatus() & AT45_STATUS_COMP)
+    {
+        return (At45dbBufferFlash(cpage));
+    }
+    return (0);
 }
 
 #endif // USE_FLASH_PARAM_PAGE
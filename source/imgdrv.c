@@ -0,0 +1,274 @@
+/****************************************************************************
+*  This file is part of the FAT device driver.
+*
+*  Image file driver, a stand-in for the MMC driver on a host. Select it
+*  with FAT_USE_IMAGE_INTERFACE (see fatdrv.h), fat.c then reads and
+*  writes the image instead of the card. Not part of the firmware, see
+*  tools/fatbench.
+*
+****************************************************************************
+*  History:
+*
+*  19.10.26         First Version
+****************************************************************************/
+#define __IMGDRV_C__
+
+#include <stdio.h>
+#include <string.h>
+
+#include "typedefs.h"
+#include "imgdrv.h"
+
+/*==========================================================*/
+/*  DEFINE: All Structures and Common Constants             */
+/*==========================================================*/
+#define IMG_MAX_SUPPORTED_DEVICE    1
+
+/*
+ * Drive Flags
+ */
+#define IMG_READ_ONLY               0x4000
+#define IMG_READY                   0x8000
+
+typedef struct _drive
+{
+    WORD  wFlags;
+    BYTE  bDevice;
+    FILE *pFile;
+
+    DWORD dTotalSectors;
+    WORD  wSectorSize;
+} DRIVE;
+
+/*==========================================================*/
+/*  DEFINE: Definition of all local Data                    */
+/*==========================================================*/
+static DRIVE           sDrive[IMG_MAX_SUPPORTED_DEVICE];
+static IMG_STATS       sStats;
+static const char     *pImagePath;
+
+static IMG_MOUNT_FUNC *pUserMountFunc;
+static IMG_MOUNT_FUNC *pUserUnMountFunc;
+
+/*==========================================================*/
+/*  DEFINE: Definition of all local Procedures              */
+/*==========================================================*/
+
+/************************************************************/
+/*  GetDrive                                                */
+/************************************************************/
+static DRIVE *GetDrive(BYTE bDevice, DWORD dwStartSector, WORD wSectorCount, int *pError)
+{
+    DRIVE *pDrive;
+
+    if (bDevice >= IMG_MAX_SUPPORTED_DEVICE)
+    {
+        *pError = IMG_DRIVE_NOT_FOUND;
+        return(NULL);
+    }
+
+    pDrive = &sDrive[bDevice];
+    if ((pDrive->wFlags & IMG_READY) == 0)
+    {
+        *pError = IMG_DRIVE_NOT_FOUND;
+        return(NULL);
+    }
+
+    if ((dwStartSector + wSectorCount) > pDrive->dTotalSectors)
+    {
+        *pError = IMG_PARAM_ERROR;
+        return(NULL);
+    }
+
+    *pError = IMG_OK;
+    return(pDrive);
+}
+
+/*==========================================================*/
+/*  DEFINE: All code exported                               */
+/*==========================================================*/
+/************************************************************/
+/*  IMGSetImage                                             */
+/*                                                          */
+/*  Must be called before the FAT device is registered.     */
+/************************************************************/
+int IMGSetImage(const char *pPath)
+{
+    pImagePath = pPath;
+
+    return(IMG_OK);
+} /* IMGSetImage */
+
+/************************************************************/
+/*  IMGGetStats                                             */
+/************************************************************/
+void IMGGetStats(IMG_STATS *pStats)
+{
+    *pStats = sStats;
+} /* IMGGetStats */
+
+/************************************************************/
+/*  IMGResetStats                                           */
+/************************************************************/
+void IMGResetStats(void)
+{
+    memset(&sStats, 0x00, sizeof(IMG_STATS));
+} /* IMGResetStats */
+
+/************************************************************/
+/*  IMGInit                                                 */
+/************************************************************/
+int IMGInit(int nIMGMode, IMG_MOUNT_FUNC *pMountFunc,
+            IMG_MOUNT_FUNC *pUnMountFunc)
+{
+    int    nError = IMG_ERROR;
+    DRIVE *pDrive;
+    long   lSize;
+
+    nIMGMode         = nIMGMode;
+    pUserMountFunc   = pMountFunc;
+    pUserUnMountFunc = pUnMountFunc;
+
+    pDrive = &sDrive[IMG_DRIVE_C];
+    memset((BYTE *)pDrive, 0x00, sizeof(DRIVE));
+    pDrive->bDevice     = IMG_DRIVE_C;
+    pDrive->wSectorSize = IMG_SECTOR_SIZE;
+
+    if (pImagePath != NULL)
+    {
+        pDrive->pFile = fopen(pImagePath, "r+b");
+        if (pDrive->pFile == NULL)
+        {
+            pDrive->pFile = fopen(pImagePath, "rb");
+            pDrive->wFlags |= IMG_READ_ONLY;
+        }
+    }
+
+    if (pDrive->pFile != NULL)
+    {
+        fseek(pDrive->pFile, 0, SEEK_END);
+        lSize = ftell(pDrive->pFile);
+        if (lSize >= IMG_SECTOR_SIZE)
+        {
+            pDrive->dTotalSectors = (DWORD)(lSize / IMG_SECTOR_SIZE);
+            pDrive->wFlags |= IMG_READY;
+            nError = IMG_OK;
+        }
+    }
+
+    IMGResetStats();
+
+    return(nError);
+} /* IMGInit */
+
+/************************************************************/
+/*  IMGMountAllDevices                                      */
+/************************************************************/
+int IMGMountAllDevices(int nIMGMode, BYTE *pSectorBuffer)
+{
+    nIMGMode = nIMGMode;
+
+    return(IMGReadSectors(IMG_DRIVE_C, pSectorBuffer, 0, 1));
+} /* IMGMountAllDevices */
+
+/************************************************************/
+/*  IMGGetSectorSize                                        */
+/************************************************************/
+int IMGGetSectorSize(BYTE bDevice)
+{
+    if (bDevice >= IMG_MAX_SUPPORTED_DEVICE)
+    {
+        return(0);
+    }
+
+    return(sDrive[bDevice].wSectorSize);
+} /* IMGGetSectorSize */
+
+/************************************************************/
+/*  IMGIsCDROMDevice                                        */
+/************************************************************/
+int IMGIsCDROMDevice(BYTE bDevice)
+{
+    return(FALSE);
+} /* IMGIsCDROMDevice */
+
+/************************************************************/
+/*  IMGIsZIPDevice                                          */
+/************************************************************/
+int IMGIsZIPDevice(BYTE bDevice)
+{
+    return(FALSE);
+} /* IMGIsZIPDevice */
+
+/************************************************************/
+/*  IMGUnMountDevice                                        */
+/************************************************************/
+int IMGUnMountDevice(BYTE bDevice)
+{
+    return(IMG_OK);
+} /* IMGUnMountDevice */
+
+/************************************************************/
+/*  IMGGetTotalSectors                                      */
+/************************************************************/
+DWORD IMGGetTotalSectors(BYTE bDevice)
+{
+    if (bDevice >= IMG_MAX_SUPPORTED_DEVICE)
+    {
+        return(0);
+    }
+
+    return(sDrive[bDevice].dTotalSectors);
+} /* IMGGetTotalSectors */
+
+/************************************************************/
+/*  IMGReadSectors                                          */
+/************************************************************/
+int IMGReadSectors(BYTE bDevice, void *pData, DWORD dwStartSector, WORD wSectorCount)
+{
+    int    nError;
+    DRIVE *pDrive;
+
+    pDrive = GetDrive(bDevice, dwStartSector, wSectorCount, &nError);
+    if (pDrive != NULL)
+    {
+        sStats.dwReadCalls++;
+        sStats.dwReadSectors += wSectorCount;
+
+        if ((fseek(pDrive->pFile, (long)dwStartSector * pDrive->wSectorSize, SEEK_SET) != 0) ||
+            (fread(pData, pDrive->wSectorSize, wSectorCount, pDrive->pFile) != wSectorCount))
+        {
+            nError = IMG_ERROR;
+        }
+    }
+
+    return(nError);
+} /* IMGReadSectors */
+
+#if (IMG_SUPPORT_WRITE == 1)
+/************************************************************/
+/*  IMGWriteSectors                                         */
+/************************************************************/
+int IMGWriteSectors(BYTE   bDevice,      void *pData,
+                    DWORD dwStartSector, WORD  wSectorCount)
+{
+    int    nError;
+    DRIVE *pDrive;
+
+    pDrive = GetDrive(bDevice, dwStartSector, wSectorCount, &nError);
+    if (pDrive != NULL)
+    {
+        sStats.dwWriteCalls++;
+        sStats.dwWriteSectors += wSectorCount;
+
+        if ((pDrive->wFlags & IMG_READ_ONLY) ||
+            (fseek(pDrive->pFile, (long)dwStartSector * pDrive->wSectorSize, SEEK_SET) != 0) ||
+            (fwrite(pData, pDrive->wSectorSize, wSectorCount, pDrive->pFile) != wSectorCount))
+        {
+            nError = IMG_ERROR;
+        }
+    }
+
+    return(nError);
+} /* IMGWriteSectors */
+#endif /* (IMG_SUPPORT_WRITE == 1) */
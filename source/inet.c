@@ -32,7 +32,6 @@
 //#pragma text:appcode
 
 #include "system.h"
-#include "version.h"
 #include "log.h"
 #include "settings.h"
 #include "util.h"
@@ -414,14 +413,19 @@ static int CreateRequest(HINET hInet, CONST char *pszMethod, CONST char *pszPath
 
     /*
      * Add the User-Agent
+     *
+     * Disabled until there is a version module. Note that nResult still
+     * holds the length of the request line here, so the whole block has
+     * to go, not only the sprintf_P()
      */
+#if 0
     if (nResult >= 0)
     {
-        //nResult = sprintf_P(&hInet->hRequest->pszRequest[hInet->hRequest->unRequestInUse],
-        //                    cszUserAgent_P,
-                            //VersionGetAppProductName(),
-                            //VersionGetAppString(),
-        //                    szSerialNum);
+        nResult = sprintf_P(&hInet->hRequest->pszRequest[hInet->hRequest->unRequestInUse],
+                            cszUserAgent_P,
+                            VersionGetAppProductName(),
+                            VersionGetAppString(),
+                            szSerialNum);
         if (nResult >= 0)
         {
             hInet->hRequest->unRequestInUse += nResult;
@@ -431,6 +435,7 @@ static int CreateRequest(HINET hInet, CONST char *pszMethod, CONST char *pszPath
             }
         }
     }
+#endif
 
     /*
      * Add the host header if needed
@@ -40,7 +40,11 @@
 #include "mmc.h"
 #include "watchdog.h"
 #include "flash.h"
+#include "settings.h"
+#include "session.h"
+#include "player.h"
 #include "spidrv.h"
+#include "vs10xx.h"
 
 #include <time.h>
 #include "rtc.h"
@@ -49,17 +53,20 @@
 /*-------------------------------------------------------------------------*/
 /* global variable definitions                                             */
 /*-------------------------------------------------------------------------*/
+u_char SystemStatus;
 
 /*-------------------------------------------------------------------------*/
 /* local variable definitions                                              */
 /*-------------------------------------------------------------------------*/
-
+static u_short g_usVolumeSeen;          // volume at the previous check
+static u_short g_usVolumeSaved;         // volume in the settings
 
 /*-------------------------------------------------------------------------*/
 /* local routines (prototyping)                                            */
 /*-------------------------------------------------------------------------*/
 static void SysMainBeatInterrupt(void*);
 static void SysControlMainBeat(u_char);
+static void SysSaveVolume(void);
 
 /*-------------------------------------------------------------------------*/
 /* Stack check variables placed in .noinit section                         */
@@ -97,6 +104,11 @@ static void SysMainBeatInterrupt(void *p)
      */
     KbScan();
     CardCheckCard();
+
+    /*
+     *  advance volume fades and wake up the decoder register writer
+     */
+    VsMainBeat();
 }
 
 
@@ -190,6 +202,39 @@ static void SysControlMainBeat(u_char OnOff)
     }
 }
 
+/*  */
+/*!
+ * \brief Store the volume in the settings once it has settled
+ *
+ * Called from the main loop. A new volume is only written when it did
+ * not change since the previous call and no fade is running, so turning
+ * the volume up or down costs a single record in the dataflash.
+ */
+/*  */
+static void SysSaveVolume(void)
+{
+    u_short usVolume;
+    u_char aucVolume[2];
+
+    if (VsVolumeFading())
+    {
+        return;
+    }
+
+    usVolume = VsGetVolume();
+    if ((usVolume == g_usVolumeSeen) && (usVolume != g_usVolumeSaved))
+    {
+        aucVolume[0] = (u_char)(usVolume >> 8);
+        aucVolume[1] = (u_char)usVolume;
+        if (SettingsSet(SETTINGS_KEY_VOLUME, aucVolume, sizeof(aucVolume)) == 0)
+        {
+            g_usVolumeSaved = usVolume;
+        }
+    }
+    g_usVolumeSeen = usVolume;
+}
+
+
 /*  */
 /*!
  * \brief Main entry of the SIR firmware
@@ -206,6 +251,9 @@ int main(void)
 {
 	int t = 0;
 	int x = 0;
+    int nLen;
+    char szUrl[SETTINGS_MAX_LEN + 1];
+    u_char aucVolume[2];
 	
 	/* 
 	 * Kroeske: time struct uit nut/os time.h (http://www.ethernut.de/api/time_8h-source.html)
@@ -252,6 +300,14 @@ int main(void)
     {
         // ......
     }
+    SettingsInit();
+
+    VsPlayerInit();
+    if (SettingsGet(SETTINGS_KEY_VOLUME, aucVolume, sizeof(aucVolume)) == sizeof(aucVolume))
+    {
+        VsSetVolume(aucVolume[0], aucVolume[1]);
+    }
+    g_usVolumeSaved = g_usVolumeSeen = VsGetVolume();
 
 
     RcInit();
@@ -260,6 +316,32 @@ int main(void)
 
     SysControlMainBeat(ON);             // enable 4.4 msecs hartbeat interrupt
 
+    /*
+     * Bring up the network and play the stream. Without a network the
+     * player falls back to the card and keeps trying the stream
+     */
+    if (SessionInit() == OK)
+    {
+        (void)SessionOpen();
+    }
+
+    if (PlayerInit() == OK)
+    {
+        /*
+         * Without a stored stream the player stays idle
+         */
+        nLen = SettingsGet(SETTINGS_KEY_STREAM_URL, szUrl, sizeof(szUrl) - 1);
+        if (nLen > 0)
+        {
+            szUrl[nLen] = '\0';
+            PlayerPlayStream(szUrl);
+        }
+        else
+        {
+            LogMsg_P(LOG_INFO, PSTR("No stream set"));
+        }
+    }
+
     /*
      * Increase our priority so we can feed the watchdog.
      */
@@ -276,6 +358,8 @@ int main(void)
 			LogMsg_P(LOG_INFO, PSTR("Yes!, I'm alive ... [%d]"),t);
 			
 			LedControl(LED_TOGGLE);
+
+			SysSaveVolume();
 		
 			if( x )
 			{
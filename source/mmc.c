@@ -35,6 +35,8 @@
 #include "display.h"
 #include "log.h"
 #include "fat.h"
+#include "cardindex.h"
+#include "tag.h"
 #include "mmcdrv.h"
 #include "led.h"
 #include "keyboard.h"
@@ -49,6 +51,21 @@
 #define CARD_PRESENT_COUNTER_OK         30
 #define CARD_NOT_PRESENT_COUNTER_OK     20
 
+/* stack of the CardPresent thread, which (re)builds the media index */
+#define CARD_PRESENT_STACK              1024
+
+/*
+ *  read-ahead producer. It runs below the VsCtrl thread (50) and above
+ *  the UI threads (default 64) so that the buffer is topped up before
+ *  the display or keyboard get their turn
+ */
+#define CARD_READAHEAD_PRIORITY         60
+#define CARD_READAHEAD_STACK            768     // TagScanFile runs on it too
+#define CARD_READAHEAD_POLL             50      // ms between fill checks
+#define CARD_LOW_WATERMARK              16384   // refill when less is buffered
+#define CARD_SECTOR_SIZE                512
+#define CARD_SEGBUF_SIZE                0       // 0: use all banked memory
+
 
 /*--------------------------------------------------------------------------*/
 /*  Type declarations                                                       */
@@ -75,9 +92,35 @@ static TCardState CardState;
 /*!\brief Status of this module */
 static TError g_tStatus;
 
+/*!\brief number of playlists (*.pls) found in the root of the card */
+static u_char g_NrofPlayLists;
+
+/*!\brief signals the read-ahead thread that there is a file to play */
+static HANDLE g_hReadAheadEvent;
+
+/*!\brief file handed over by CardPlayMp3File, taken by the read-ahead thread */
+static int g_nPendingFile = -1;
+
+/*!\brief set to make the read-ahead thread drop the file it is playing */
+static volatile u_char g_bReadAheadStop;
+
+/*!\brief the pending file continues the buffer, no decoder stop or buffer reset */
+static u_char g_bReadAheadAppend;
+
+/*!\brief set while the read-ahead thread has a file open */
+static volatile u_char g_bReadAheadBusy;
+
+/*!\brief title and artist of the file handed over last */
+static TTagInfo g_tSongInfo;
+
+/*!\brief set once the segmented buffer has been initialised */
+static u_char g_bSegBufInit;
+
 /*-------------------------------------------------------------------------*/
 /* local routines (prototyping)                                            */
 /*-------------------------------------------------------------------------*/
+static int CardReadAheadFill(int nFile, u_long ulChunk, u_long *pulPos, u_long ulEnd);
+static TError CardHandOver(char *path, u_char bAppend);
 
 
 
@@ -167,33 +210,25 @@ u_char CardCheckPresent()
  * We initialse the card by registering the card and the filesystem
  * that is on the card.
  *
- * Then we start checking if a number of playlists are
- * present on the card. The names of these playlists are hardcoded
- * (1.pls, 2.pls, to 20.pls). We 'search' the card for these list
- * of playlists by trying to open them. If succesfull, we read the
- * number of songs present (int) in that list
- * Finally we update some administration (global) variables
+ * Then we enumerate the root directory of the card once and count
+ * the playlists (*.pls) that are present, see CardGetNumberOfPlayLists
  *
  */
 int CardInitCard()
 {
     int iResult=-1;
-    int fid;        // current file descriptor
-    char szFileName[10];
-    //u_char i;
-	u_char ief;
+    FATDIR *pDir;
+    FATDIRENT tEntry;
 
     /*
      * Register our device for the file system (if not done already.....)
      */
     if (NutDeviceLookup(devFAT.dev_name) == 0)
     {
-        ief = VsPlayerInterrupts(0);
         if ((iResult=NutRegisterDevice(&devFAT, FAT_MODE_MMC, 0)) == 0)
         {
             iResult=NutRegisterDevice(&devFATMMC0, FAT_MODE_MMC, 0);
         }
-        VsPlayerInterrupts(ief);
     }
     else
     {
@@ -204,7 +239,6 @@ int CardInitCard()
          */
 
         FATRelease();
-        ief = VsPlayerInterrupts(0);
         dev=&devFAT;
         if (dev->dev_init == 0 || (*dev->dev_init)(dev) == 0)
         {
@@ -214,35 +248,36 @@ int CardInitCard()
                 iResult=0;
             }
         }
-        VsPlayerInterrupts(ief);
     }
 
     if (iResult==0)
     {
         LogMsg_P(LOG_INFO, PSTR("Card mounted"));
         /*
-         *  try to open the playlists. If an error is returned, we assume the
-         *  playlist does not exist and we do not check any further lists
+         *  walk the root directory once and count the playlists in it
          */
-
-		 /* Kroeske: onderstaande code ter illustratie om file op card te openen */
-		 
- //       for (i=1; i<SETTINGS_NROF_PLAYLISTST; ++i)
- //       {
-            // compose name to open
-            //sprintf_P(szFileName, PSTR("FM0:%d.pls"), i);
-            if ((fid = _open(szFileName, _O_RDONLY)) != -1)
-            {
-                _close(fid);
-            }
-            else
+        g_NrofPlayLists=0;
+        if ((pDir=FATDirOpen(&devFATMMC0, "/")) != NULL)
+        {
+            while (FATDirRead(pDir, &tEntry) == 1)
             {
+                char *pExt=strrchr(tEntry.szName, '.');
 
-                //g_NrofPlayLists=i-1;
-                //LogMsg_P(LOG_INFO, PSTR("Found %d Playlists on the Card"), i-1);
- //               break;
+                if (((tEntry.bAttribute & FAT_ATTR_DIRECTORY) == 0) &&
+                    (pExt != NULL) && (strcasecmp_P(pExt, PSTR(".pls")) == 0) &&
+                    (g_NrofPlayLists < 255))
+                {
+                    ++g_NrofPlayLists;
+                }
             }
-//        }
+            FATDirClose(pDir);
+        }
+        LogMsg_P(LOG_INFO, PSTR("Found %d Playlists on the Card"), g_NrofPlayLists);
+
+        /*
+         *  load the media index, only new or changed directories are scanned
+         */
+        CardIndexOpen();
     }
     else
     {
@@ -281,7 +316,14 @@ THREAD(CardPresent, pArg)
         else if ((CardPresentFlag==CARD_IS_NOT_PRESENT) && (OldCardStatus==CARD_IS_PRESENT))
         {
             LogMsg_P(LOG_INFO, PSTR("Card removed"));
+            /*
+             *  the card is gone, so there is nothing to write back to.
+             *  Changes of files open for writing that were not synced
+             *  are dropped, so nothing of this card ends up on the next
+             *  one
+             */
             CardClose();
+            FATDiscard();
             OldCardStatus=CardPresentFlag;
         }
         else
@@ -292,6 +334,329 @@ THREAD(CardPresent, pArg)
 }
 
 
+/*!
+ * \brief top up the segmented buffer from an open file
+ *
+ * Reads straight into the write region of the buffer, whole sectors up
+ * to the next cluster boundary of the file at a time. After an ID3v2 tag
+ * the first read only goes up to the next sector boundary, from then on
+ * every read starts on a sector and the FAT driver can transfer the
+ * sectors without its sector buffer. Stops when the buffer has no room
+ * for another sector.
+ *
+ * \param   nFile file to read from
+ * \param   ulChunk cluster size
+ * \param   pulPos current position in the file, updated
+ * \param   ulEnd position of the end of the audio data (trailing tags)
+ *
+ * \return  1 if there is more to read, 0 at the end, -1 on error
+ */
+static int CardReadAheadFill(int nFile, u_long ulChunk, u_long *pulPos, u_long ulEnd)
+{
+    char *pBuf;
+    size_t tSize;
+    u_long ulMax;
+    u_long ulSeg;
+    int nRead;
+
+    for (;;)
+    {
+        pBuf = NutSegBufWriteRequest(&tSize);
+        ulMax = ulEnd - *pulPos;
+        if ((tSize < CARD_SECTOR_SIZE) && (tSize < ulMax))
+        {
+            break;                                  // buffer full
+        }
+        if (*pulPos % CARD_SECTOR_SIZE)
+        {
+            ulSeg = CARD_SECTOR_SIZE - (*pulPos % CARD_SECTOR_SIZE);    // realign after the tag
+        }
+        else
+        {
+            ulSeg = ulChunk - (*pulPos % ulChunk);
+        }
+        if (ulMax > ulSeg)
+        {
+            ulMax = ulSeg;
+        }
+        if (tSize > ulMax)
+        {
+            tSize = ulMax;                          // whole sectors, except when realigning or at ulEnd
+        }
+        else if (tSize >= CARD_SECTOR_SIZE)
+        {
+            tSize &= ~((size_t)CARD_SECTOR_SIZE - 1);
+        }
+
+        nRead = (tSize != 0) ? _read(nFile, pBuf, tSize) : 0;
+        if (nRead < 0)
+        {
+            return(-1);
+        }
+        *pulPos += nRead;
+        if (((size_t)nRead < tSize) || (*pulPos >= ulEnd))
+        {
+            NutSegBufWriteLast(nRead);              // end of the audio data
+            return(0);
+        }
+        NutSegBufWriteCommit(nRead);
+    }
+    return(1);
+}
+
+/*!
+ * \brief The CardReadAhead thread.
+ *
+ * Producer for the decoder: takes the file opened by CardPlayMp3File and
+ * keeps the segmented buffer filled from it whenever the amount of
+ * buffered data drops below CARD_LOW_WATERMARK. The decoder is kicked
+ * as soon as there is data, also after it ran empty.
+ *
+ * \param   -
+ *
+ * \return  -
+ */
+THREAD(CardReadAhead, pArg)
+{
+    int nFile = -1;
+    int nState = 0;
+    DWORD dwChunk;
+    u_long ulPos = 0;
+    u_long ulEnd = 0;
+
+    NutThreadSetPriority(CARD_READAHEAD_PRIORITY);
+
+    for (;;)
+    {
+        if (nFile == -1)
+        {
+            if (g_nPendingFile == -1)
+            {
+                NutEventWait(&g_hReadAheadEvent, NUT_WAIT_INFINITE);
+                continue;
+            }
+
+            /*
+             *  take over the new file and start with an empty buffer
+             */
+            nFile = g_nPendingFile;
+            g_nPendingFile = -1;
+            g_bReadAheadStop = 0;
+            g_bReadAheadBusy = 1;
+
+            if (g_bReadAheadAppend == 0)
+            {
+                VsPlayerStop();
+                NutSegBufReset();
+            }
+            if ((FATGetClusterSize(&devFATMMC0, &dwChunk) != 0) || (dwChunk < CARD_SECTOR_SIZE))
+            {
+                dwChunk = CARD_SECTOR_SIZE;
+            }
+            nState = 1;
+
+            /*
+             *  leave out the ID3/APE tags, the decoder would only skip them
+             */
+            ulEnd = _filelength(nFile);
+            if (TagScanFile(nFile, ulEnd, &g_tSongInfo, &ulPos, &ulEnd) != 0)
+            {
+                LogMsg_P(LOG_ERR, PSTR("Read error on card"));
+                g_tStatus = CARD_NO_SONG;
+                nState = -1;
+            }
+        }
+
+        if (g_bReadAheadStop)
+        {
+            _close(nFile);
+            nFile = -1;
+            g_bReadAheadBusy = 0;
+            continue;
+        }
+
+        if ((nState == 1) && (NutSegBufUsed() < CARD_LOW_WATERMARK))
+        {
+            nState = CardReadAheadFill(nFile, dwChunk, &ulPos, ulEnd);
+            if (nState < 0)
+            {
+                LogMsg_P(LOG_ERR, PSTR("Read error on card"));
+                g_tStatus = CARD_NO_SONG;
+                NutSegBufWriteLast(0);
+            }
+        }
+
+        /*
+         *  (re)start the decoder when it is idle or ran out of data
+         */
+        if ((VsGetStatus() != VS_STATUS_RUNNING) && (NutSegBufUsed() > 0))
+        {
+            VsPlayerKick();
+        }
+
+        if (nState != 1)
+        {
+            /*
+             *  everything is in the buffer, the decoder drains the rest
+             */
+            _close(nFile);
+            nFile = -1;
+            g_bReadAheadBusy = 0;
+        }
+        else
+        {
+            NutSleep(CARD_READAHEAD_POLL);
+        }
+    }
+}
+
+/*!
+ * \brief open a file and hand it over to the read-ahead thread
+ *
+ * \param   path full path of the file on the card
+ * \param   bAppend 0 to replace what is playing now, 1 to follow it
+ *
+ * \return  OK, CARD_NO_CARD, CARD_NO_HEAP or CARD_NO_SONG
+ */
+static TError CardHandOver(char *path, u_char bAppend)
+{
+    int nFile;
+
+    if (CardPresentFlag != CARD_IS_PRESENT)
+    {
+        return(CARD_NO_CARD);
+    }
+
+    if (g_bSegBufInit == 0)
+    {
+        return(CARD_NO_HEAP);
+    }
+
+    if ((nFile = _open(path, _O_RDONLY | _O_BINARY)) == -1)
+    {
+        LogMsg_P(LOG_ERR, PSTR("Cannot open [%s]"), path);
+        return(CARD_NO_SONG);
+    }
+
+    /*
+     *  a file handed over earlier that was not picked up yet is replaced
+     */
+    if (g_nPendingFile != -1)
+    {
+        _close(g_nPendingFile);
+    }
+    g_nPendingFile = nFile;
+    g_bReadAheadAppend = bAppend;
+    if (bAppend == 0)
+    {
+        g_bReadAheadStop = 1;
+    }
+    g_tStatus = OK;
+
+    NutEventPost(&g_hReadAheadEvent);
+
+    return(OK);
+}
+
+/*!
+ * \brief play an MP3 file from the card
+ *
+ * Opens the file and hands it over to the read-ahead thread, which
+ * stops whatever is playing now.
+ *
+ * \param   path full path of the file on the card
+ *
+ * \return  OK, CARD_NO_CARD, CARD_NO_HEAP or CARD_NO_SONG
+ */
+TError CardPlayMp3File(char *path)
+{
+    return(CardHandOver(path, 0));
+}
+
+/*!
+ * \brief queue an MP3 file to follow what is in the buffer now
+ *
+ * The decoder is not stopped and the buffer is not emptied, the file
+ * is read once the read-ahead thread is done with the current one. Used
+ * to switch between sources without a gap.
+ *
+ * \param   path full path of the file on the card
+ *
+ * \return  OK, CARD_NO_CARD, CARD_NO_HEAP or CARD_NO_SONG
+ */
+TError CardAppendMp3File(char *path)
+{
+    return(CardHandOver(path, 1));
+}
+
+/*!
+ * \brief stop reading from the card, let the decoder play what is buffered
+ *
+ * Use CardReadAheadBusy() to find out when the buffer is free for
+ * another producer.
+ *
+ */
+void CardReleaseMp3File(void)
+{
+    if (g_nPendingFile != -1)
+    {
+        _close(g_nPendingFile);
+        g_nPendingFile = -1;
+    }
+    g_bReadAheadStop = 1;
+}
+
+/*!
+ * \brief return non-zero while the read-ahead thread has, or gets, a file
+ *
+ */
+u_char CardReadAheadBusy(void)
+{
+    return((g_nPendingFile != -1) || g_bReadAheadBusy);
+}
+
+/*!
+ * \brief stop playing from the card
+ *
+ * The decoder stops immediately, the read-ahead thread closes the file
+ * the next time it runs.
+ *
+ */
+void CardStopMp3File(void)
+{
+    if (g_nPendingFile != -1)
+    {
+        _close(g_nPendingFile);
+        g_nPendingFile = -1;
+    }
+    g_bReadAheadStop = 1;
+    VsPlayerStop();
+}
+
+/*!
+ * \brief return the title of the song that plays from the card
+ *
+ * Taken from the ID3 tag of the file, empty if it has none.
+ *
+ * \param   punLength receives the length of the title
+ *
+ * \return  the title
+ */
+char* CardGetCurrentSongName(unsigned int *punLength)
+{
+    *punLength = strlen(g_tSongInfo.szTitle);
+    return(g_tSongInfo.szTitle);
+}
+
+/*!
+ * \brief return the number of playlists found on the card
+ *
+ */
+u_char CardGetNumberOfPlayLists(void)
+{
+    return(g_NrofPlayLists);
+}
+
 /*!
  * \brief return global variable that indicates the status of this module
  *
@@ -310,7 +675,8 @@ TError CardStatus(void)
  */
 void CardClose(void)
 {
-
+    CardStopMp3File();
+    CardIndexClose();
 }
 
 
@@ -325,6 +691,23 @@ void CardInit()
     CardState=CARD_IDLE;
     CardPresentFlag=CARD_IS_NOT_PRESENT;
 
+    /*
+     *  the segmented buffer is shared with the stream player, set it up
+     *  once here rather than on first use so neither of them resets it
+     *  under the other
+     */
+    if (g_bSegBufInit == 0)
+    {
+        if (NutSegBufInit(CARD_SEGBUF_SIZE) == NULL)
+        {
+            LogMsg_P(LOG_ERR, PSTR("No buffer for playback"));
+        }
+        else
+        {
+            g_bSegBufInit = 1;
+        }
+    }
+
     /*
      * Create a CardPresent thread
      */
@@ -332,12 +715,24 @@ void CardInit()
 
     if (GetThreadByName((char *)ThreadName) == NULL)
     {
-        if (NutThreadCreate((char *)ThreadName, CardPresent, 0, 768) == 0)
+        if (NutThreadCreate((char *)ThreadName, CardPresent, 0, CARD_PRESENT_STACK) == 0)
         {
             LogMsg_P(LOG_EMERG, PSTR("Thread failed"));
         }
     }
 
+    /*
+     * Create the read-ahead thread for playback from the card
+     */
+    strcpy_P(ThreadName, PSTR("CardRdAh"));
+
+    if (GetThreadByName((char *)ThreadName) == NULL)
+    {
+        if (NutThreadCreate((char *)ThreadName, CardReadAhead, 0, CARD_READAHEAD_STACK) == 0)
+        {
+            LogMsg_P(LOG_EMERG, PSTR("Thread failed"));
+        }
+    }
 }
 
 /* ---------- end of module ------------------------------------------------ */
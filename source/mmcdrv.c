@@ -67,6 +67,7 @@
  */
 #define MMC_SUPPORT_LBA             0x0001
 #define MMC_SUPPORT_LBA48           0x0002
+#define MMC_BLOCK_ADDRESS           0x0004  /* SDHC/SDXC: sector instead of byte address */
 
 #define MMC_READ_ONLY               0x4000
 #define MMC_READY                   0x8000
@@ -89,8 +90,48 @@
 
 #define MMC_RESET         0
 #define MMC_INIT          1
+#define MMC_SEND_IF_COND        8
 #define MMC_READ_CSD    9
 #define MMC_READ_CID    10
+#define MMC_STOP_TRANSMISSION   12
+#define MMC_READ_SINGLE_BLOCK   17
+#define MMC_READ_MULTIPLE_BLOCK 18
+#define MMC_SET_WR_BLK_ERASE_COUNT 23   /* ACMD23 */
+#define MMC_WRITE_BLOCK         24
+#define MMC_WRITE_MULTIPLE_BLOCK 25
+#define MMC_SET_BLOCKLEN        16
+#define MMC_SD_SEND_OP_COND     41      /* ACMD41 */
+#define MMC_APP_CMD             55
+#define MMC_READ_OCR            58
+
+#define MMC_R1_IDLE             0x01
+#define MMC_R1_ILLEGAL_COMMAND  0x04
+
+#define MMC_OCR_CCS             0x40000000UL   /* card capacity status */
+#define MMC_ACMD41_HCS          0x40000000UL   /* host supports high capacity */
+
+/*
+ * Number of 10 ms periods to wait for the card to leave the
+ * idle state (1 second)
+ */
+#define MMC_INIT_TIMEOUT        100
+
+#define MMC_TOKEN_START_BLOCK   0xfe
+#define MMC_TOKEN_START_MULTI   0xfc
+#define MMC_TOKEN_STOP_TRAN     0xfd
+
+/*
+ * Busy polls before the card is given time with NutSleep(),
+ * and the number of 1 ms sleeps before giving up (500 ms)
+ */
+#define MMC_BUSY_SPIN           64
+#define MMC_BUSY_TIMEOUT        500
+
+/*
+ * Sectors read with one CMD18. The card stays selected for the whole
+ * burst, the bus is only released between bursts
+ */
+#define MMC_READ_BURST          8
 
 typedef struct _drive
 {
@@ -184,27 +225,108 @@ static BYTE MMCGet(void)
 } /* MMCGet */
 
 /************************************************************
- * void MMCCommand(unsigned char command, unsigned int px, unsigned int py)
+ * void MMCCommand(BYTE command, DWORD dwArg)
  *
- * - send one byte of 0xff, then issue command + params + (fake) crc
+ * - send one byte of 0xff, then issue command + argument + crc
+ * - the crc is only checked for CMD0 and CMD8, which use fixed
+ *   arguments; after that it is ignored
  * - eat up the one command of nothing after the CRC
  ************************************************************/
-static void MMCCommand(unsigned char command, unsigned int px, unsigned int py)
+static void MMCCommand(BYTE command, DWORD dwArg)
 {
     SPIselect(SPI_DEV_MMC);
 
     SPIputByte(0xff);
     SPIputByte(command | 0x40);
-    SPIputByte((unsigned char)((px >> 8)&0x0ff)); /* high byte of param y */
-    SPIputByte((unsigned char)(px & 0x00ff));     /* low byte of param y */
-    SPIputByte((unsigned char)((py >> 8)&0x0ff)); /* high byte of param x */
-    SPIputByte((unsigned char)(py & 0x00ff));     /* low byte of param x */
-    SPIputByte(0x95);            /* correct CRC for first command in SPI          */
-                              /* after that CRC is ignored, so no problem with */
-                              /* always sending 0x95                           */
+    SPIputByte((BYTE)(dwArg >> 24));
+    SPIputByte((BYTE)(dwArg >> 16));
+    SPIputByte((BYTE)(dwArg >> 8));
+    SPIputByte((BYTE)dwArg);
+    SPIputByte((command == MMC_SEND_IF_COND) ? 0x87 : 0x95);
     SPIputByte(0xff);
 } /* MMCCommand */
 
+/************************************************************
+ * DWORD MMCAddress(DRIVE *pDrive, DWORD dSector)
+ *
+ * - returns the command argument for a sector, a byte
+ *   address for MMC/SDSC, the sector for SDHC/SDXC
+ ************************************************************/
+static DWORD MMCAddress(DRIVE *pDrive, DWORD dSector)
+{
+    if (pDrive->wFlags & MMC_BLOCK_ADDRESS)
+    {
+        return(dSector);
+    }
+    return(dSector << 9);
+} /* MMCAddress */
+
+/************************************************************
+ * DWORD MMCGetLong(void)
+ *
+ * - reads the 4 bytes that follow an R3/R7 response
+ ************************************************************/
+static DWORD MMCGetLong(void)
+{
+    BYTE  i;
+    DWORD dwValue = 0;
+
+    for (i = 0; i < 4; i++)
+    {
+        dwValue = (dwValue << 8) | SPIgetByte();
+    }
+    return(dwValue);
+} /* MMCGetLong */
+
+/************************************************************
+ * WORD MMCReadBlock(BYTE *pBuffer)
+ *
+ * - reads the 512 data bytes of a sector and the 2 CRC bytes
+ *   that follow, the data token must have been read already
+ * - the next byte is started right after SPDR is read, so
+ *   storing the byte overlaps with the transfer of the next
+ * - returns the CRC
+ ************************************************************/
+#define MMC_READ_NEXT(_p)                       \
+    do                                          \
+    {                                           \
+        while (!(SPSR & (1<<SPIF)));            \
+        bData = SPDR;                           \
+        SPDR = 0xff;                            \
+        *(_p)++ = bData;                        \
+    } while (0)
+
+static WORD MMCReadBlock(BYTE *pBuffer)
+{
+    BYTE bData;
+    BYTE bCount;
+    WORD wCRC;
+
+    SPDR = 0xff;                        /* start first data byte */
+
+    bCount = 512 / 8;
+    do
+    {
+        MMC_READ_NEXT(pBuffer);
+        MMC_READ_NEXT(pBuffer);
+        MMC_READ_NEXT(pBuffer);
+        MMC_READ_NEXT(pBuffer);
+        MMC_READ_NEXT(pBuffer);
+        MMC_READ_NEXT(pBuffer);
+        MMC_READ_NEXT(pBuffer);
+        MMC_READ_NEXT(pBuffer);
+    } while (--bCount);
+
+    /* first CRC byte is already in progress */
+    while (!(SPSR & (1<<SPIF)));
+    wCRC = (WORD)SPDR << 8;
+    SPDR = 0xff;
+    while (!(SPSR & (1<<SPIF)));
+    wCRC |= SPDR;
+
+    return(wCRC);
+} /* MMCReadBlock */
+
 /************************************************************/
 /* GetCSD                                                   */
 /************************************************************/
@@ -219,9 +341,12 @@ static int GetCSD (DRIVE *pDrive)
     WORD wDummy;
     DWORD dTotalSectors = 0;
 
-    MMCCommand(MMC_READ_CSD, 0, 0);
+    SPIlock();
+    MMCCommand(MMC_READ_CSD, 0);
     if (MMCDataToken() != 0xfe)
     {
+        SPIdeselect();
+        SPIunlock();
         LogMsg_P(LOG_ERR, PSTR("error during CSD read"));
     }
     else
@@ -235,6 +360,22 @@ static int GetCSD (DRIVE *pDrive)
         SPIputByte(0xff);    /* checksum -> don't care about it for now */
 
         SPIdeselect();
+        SPIunlock();
+
+        if ((bData[0] >> 6) == 1)
+        {
+            /*
+             * CSD version 2.0 (SDHC/SDXC): 22 bit C_SIZE in
+             * units of 512 kByte
+             */
+            dTotalSectors  = ((DWORD)(bData[7] & 0x3F) << 16) | ((WORD)bData[8] << 8) | bData[9];
+            dTotalSectors  = (dTotalSectors + 1) << 10;
+
+            pDrive->dTotalSectors = dTotalSectors;
+            pDrive->wSectorSize   = 512;
+
+            return(MMC_OK);
+        }
 
         /*
          * Get the READ_BL_LEN
@@ -259,7 +400,7 @@ static int GetCSD (DRIVE *pDrive)
          * Get the wC_SIZE_MULT
          */
         wC_SIZE_MULT  = (bData[9] & 0x03);
-        wC_SIZE_MULT |= wC_SIZE_MULT << 1;
+        wC_SIZE_MULT  = wC_SIZE_MULT << 1;
         wDummy        = (bData[10] & 0x80);
         wDummy        = wDummy >> 7;
         wC_SIZE_MULT |= wDummy;
@@ -268,8 +409,17 @@ static int GetCSD (DRIVE *pDrive)
         dTotalSectors  = wC_SIZE+1;
         dTotalSectors *= wC_SIZE_MULT;
 
+        /*
+         * Cards with READ_BL_LEN 1024 or 2048 still transfer 512
+         * byte blocks (set by CMD16), count in those
+         */
+        if (wREAD_BL_LEN > 512)
+        {
+            dTotalSectors *= (wREAD_BL_LEN / 512);
+        }
+
         pDrive->dTotalSectors = dTotalSectors;
-        pDrive->wSectorSize   = wREAD_BL_LEN;
+        pDrive->wSectorSize   = 512;
 
         nError = MMC_OK;
     }
@@ -286,7 +436,7 @@ static void GetCID(void)
     int i;
     BYTE bData[16];
 
-    MMCCommand(MMC_READ_CID, 0, 0);
+    MMCCommand(MMC_READ_CID, 0);
     if (MMCDataToken() != 0xfe)
     {
         printf("MMC: error during CID read\n");
@@ -318,11 +468,18 @@ static void GetCID(void)
 /* - flushes card receive buffer                            */
 /* - selects card                                           */
 /* - sends the reset command                                */
+/* - CMD8 to detect SD version 2.00 cards                   */
 /* - sends the initialization command, waits for card ready */
+/*   (ACMD41 with HCS for SD cards, CMD1 for MMC cards)     */
+/* - CMD58 to find out if the card uses block addressing    */
+/* - switches the card to the fast clock                    */
 /************************************************************/
-static int InitMMCCard(void)
+static int InitMMCCard(DRIVE *pDrive)
 {
     WORD i;
+    BYTE bR1;
+    BYTE bVersion2;
+    BYTE bUseCMD1;
 
     /* PragmaLab: disable initit of PINS and SPI, already done in 'SystemInitIO()'
     SPIDDR = SCLK + MOSI + CS;
@@ -340,6 +497,11 @@ static int InitMMCCard(void)
     // start off with 80 bits of high data with card deselected
 
     PragmaLab: why send dummy bytes with card DEselected? This messes up the VS10XX init */
+
+    /* card identification runs at a low clock */
+    SPIsetSpeed(SPI_DEV_MMC, SPEED_SLOW);
+
+    SPIlock();
     for (i = 0; i < 10; i++)
     {
         SPIputByte(0xff);
@@ -348,117 +510,297 @@ static int InitMMCCard(void)
     /*end PragmaLab */
 
     /* send CMD0 - go to idle state */
-    MMCCommand(MMC_RESET, 0, 0);
+    MMCCommand(MMC_RESET, 0);
 
-    if (MMCGet() != 1)
+    if (MMCGet() != MMC_R1_IDLE)
     {
         SPIdeselect();
+        SPIunlock();
         return(MMC_ERROR);  // MMC Not detected
     }
 
-    /* send CMD1 until we get a 0 back, indicating card is done initializing */
-    i = 0xffff;
-    while ((SPIgetByte() != 0) && (--i))
+    /*
+     * CMD8 - check voltage range, SD version 2.00 cards echo the
+     * argument, older cards do not know the command
+     */
+    bVersion2 = FALSE;
+    MMCCommand(MMC_SEND_IF_COND, 0x000001AAUL);
+    if ((MMCGet() & MMC_R1_ILLEGAL_COMMAND) == 0)
     {
-        MMCCommand(MMC_INIT, 0, 0);
+        if ((MMCGetLong() & 0x0FFF) != 0x01AA)
+        {
+            SPIdeselect();
+            SPIunlock();
+            return(MMC_ERROR);  // unusable card
+        }
+        bVersion2 = TRUE;
+    }
+
+    /*
+     * ACMD41 until the card leaves the idle state, telling version 2
+     * cards that we support high capacity. MMC cards do not know
+     * ACMD41, send CMD1 to these
+     */
+    bR1 = MMC_R1_IDLE;
+    bUseCMD1 = FALSE;
+    for (i = 0; (i < MMC_INIT_TIMEOUT) && (bR1 != 0); i++)
+    {
+        if (bUseCMD1 == FALSE)
+        {
+            MMCCommand(MMC_APP_CMD, 0);
+            MMCGet();
+            MMCCommand(MMC_SD_SEND_OP_COND, (bVersion2 == TRUE) ? MMC_ACMD41_HCS : 0);
+            bR1 = MMCGet();
+            if (bR1 & MMC_R1_ILLEGAL_COMMAND)
+            {
+                bUseCMD1 = TRUE;
+            }
+        }
+        if (bUseCMD1 == TRUE)
+        {
+            MMCCommand(MMC_INIT, 0);
+            bR1 = MMCGet();
+        }
+
+        if (bR1 != 0)
+        {
+            /* give the card (and the decoder) some time */
+            SPIdeselect();
+            SPIunlock();
+            NutSleep(10);
+            SPIlock();
+            SPIselect(SPI_DEV_MMC);
+        }
     }
-    if (i == 0)
+    if (bR1 != 0)
     {
         SPIdeselect();
+        SPIunlock();
         return(MMC_ERROR);  // Init Fail
     }
 
+    /* CMD58 - the CCS bit in the OCR tells if the card uses block addresses */
+    if (bVersion2 == TRUE)
+    {
+        MMCCommand(MMC_READ_OCR, 0);
+        if ((MMCGet() == 0) && (MMCGetLong() & MMC_OCR_CCS))
+        {
+            pDrive->wFlags |= MMC_BLOCK_ADDRESS;
+        }
+    }
+
+    /* byte addressed cards: make sure blocks are 512 bytes */
+    if ((pDrive->wFlags & MMC_BLOCK_ADDRESS) == 0)
+    {
+        MMCCommand(MMC_SET_BLOCKLEN, 512);
+        MMCGet();
+    }
+
     SPIdeselect();
+    SPIunlock();
+
+    /* card is ready, it can run at full speed now */
+    SPIsetSpeed(SPI_DEV_MMC, SPEED_ULTRA_FAST);
+
     return(MMC_OK);
 } /* InitMMCCard */
 
 /************************************************************/
 /*  ReadSectors                                             */
+/*                                                          */
+/* - one sector is read with CMD17, a run of sectors with   */
+/*   CMD18 and a CMD12 at the end                           */
+/* - the card stays selected from the command up to the    */
+/*   CMD12. Long runs are split in bursts of               */
+/*   MMC_READ_BURST sectors, the bus is released between   */
+/*   bursts so the decoder can be fed                       */
 /************************************************************/
 static int ReadSectors(DRIVE *pDrive, BYTE *pBuffer, DWORD dStartSector, WORD wSectorCount)
 {
     int   nError = MMC_OK;
-    int   nSector;
-    WORD  wDataCount;
-    DWORD dReadSector;
-
-    pDrive = pDrive;
+    WORD  wSector;
+    WORD  wBurst;
+    WORD  wCount;
 
-    for (nSector=0; nSector<wSectorCount; nSector++)
+    while ((wSectorCount > 0) && (nError == MMC_OK))
     {
-        dReadSector = dStartSector + nSector;
+        wBurst = (wSectorCount > MMC_READ_BURST) ? MMC_READ_BURST : wSectorCount;
+
+        SPIlock();
+        MMCCommand((wBurst == 1) ? MMC_READ_SINGLE_BLOCK : MMC_READ_MULTIPLE_BLOCK,
+                   MMCAddress(pDrive, dStartSector));
 
-        MMCCommand(17,(dReadSector>>7) & 0xffff, (dReadSector<<9) & 0xffff);
-        if (MMCDataToken() != 0xfe)
+        for (wSector=0; wSector<wBurst; wSector++)
         {
-            nError = MMC_ERROR;
-            SPIdeselect();
-            break;
+            if (MMCDataToken() != 0xfe)
+            {
+                nError = MMC_ERROR;
+                break;
+            }
+
+            MMCReadBlock(pBuffer);  /* checksum -> don't care about it for now */
+            pBuffer += 512;
         }
 
-        for (wDataCount=0; wDataCount<512; wDataCount++)
-        { /* read the sector */
-            *pBuffer = SPIgetByte();
-            pBuffer++;
+        if (wBurst > 1)
+        {
+            /* stop the transfer, R1b response: wait until not busy */
+            MMCCommand(MMC_STOP_TRANSMISSION, 0);
+            MMCGet();
+            wCount = 0xffff;
+            while ((SPIgetByte() == 0x00) && (--wCount));
         }
 
-        SPIputByte(0xff);    /* checksum -> don't care about it for now */
-        SPIputByte(0xff);    /* checksum -> don't care about it for now */
         SPIdeselect();
+        SPIunlock();
+
+        dStartSector += wBurst;
+        wSectorCount -= wBurst;
     }
 
     return(nError);
 } /* ReadSectors */
 
 #if (MMC_SUPPORT_WRITE == 1)
+/************************************************************
+ * int MMCWaitBusy(void)
+ *
+ * - waits until the card has finished programming
+ * - polls a few times first, then releases the bus and
+ *   gives other threads (and the decoder) time between polls
+ * - the card must be selected and the bus claimed, which
+ *   is also the case on return
+ ************************************************************/
+static int MMCWaitBusy(void)
+{
+    WORD wTimeout;
+    BYTE bCount;
+
+    for (bCount = 0; bCount < MMC_BUSY_SPIN; bCount++)
+    {
+        if (SPIgetByte() != 0x00)
+        {
+            return(MMC_OK);
+        }
+    }
+
+    for (wTimeout = MMC_BUSY_TIMEOUT; wTimeout; wTimeout--)
+    {
+        SPIdeselect();
+        SPIunlock();
+
+        NutSleep(1);
+
+        SPIlock();
+        SPIselect(SPI_DEV_MMC);
+        if (SPIgetByte() != 0x00)
+        {
+            return(MMC_OK);
+        }
+    }
+
+    return(MMC_ERROR);
+} /* MMCWaitBusy */
+
+/************************************************************
+ * int MMCSendBlock(BYTE bToken, BYTE *pBuffer)
+ *
+ * - sends one data block with its start token
+ * - checks the data response and waits while busy
+ ************************************************************/
+static int MMCSendBlock(BYTE bToken, BYTE *pBuffer)
+{
+    SPIputByte(bToken);
+
+    SPItransfer(SPI_DEV_MMC, pBuffer, NULL, 512);
+
+    SPIputByte(0xff);  /* checksum -> don't care about it for now */
+    SPIputByte(0xff);  /* checksum -> don't care about it for now */
+
+    /* Read "data response byte", xxx0 0101 is data accepted */
+    if ((SPIgetByte() & 0x1f) != 0x05)
+    {
+        return(MMC_ERROR);
+    }
+
+    return(MMCWaitBusy());
+} /* MMCSendBlock */
+
 /************************************************************/
 /*  WriteSectors                                            */
+/*                                                          */
+/* - one sector is written with CMD24, a run of sectors     */
+/*   with ACMD23 (pre-erase) and CMD25 and a stop token     */
 /************************************************************/
 static BYTE WriteSectors(DRIVE *pDrive, BYTE *pBuffer, DWORD dStartSector, WORD wSectorCount)
 {
     int   nError = MMC_OK;
-    int   nSector;
-    WORD  wDataCount;
-    DWORD dWriteSector;
-
-    pDrive = pDrive;
+    WORD  wSector;
 
-    for (nSector=0; nSector<wSectorCount; nSector++)
+    if (wSectorCount == 0)
     {
-        dWriteSector = dStartSector + nSector;
+        return(nError);
+    }
 
-        MMCCommand(24, (dWriteSector>>7)& 0xffff, (dWriteSector<<9)& 0xffff);
-        if (MMCGet() == 0xff)
+    SPIlock();
+
+    if (wSectorCount == 1)
+    {
+        MMCCommand(MMC_WRITE_BLOCK, MMCAddress(pDrive, dStartSector));
+        if (MMCGet() != 0x00)
         {
             nError = MMC_ERROR;
-            SPIdeselect();
-            break;
         }
-
-        SPIputByte(0xfe);  // Send Start Byte
-
-        for (wDataCount=0; wDataCount<512; wDataCount++)
-        { /* read the sector */
-            SPIputByte(*pBuffer);
-            pBuffer++;
+        else
+        {
+            nError = MMCSendBlock(MMC_TOKEN_START_BLOCK, pBuffer);
         }
+    }
+    else
+    {
+        /*
+         * Tell the card how many blocks follow, so it can erase them
+         * in advance. MMC cards do not know ACMD23, ignore the result
+         */
+        MMCCommand(MMC_APP_CMD, 0);
+        MMCGet();
+        MMCCommand(MMC_SET_WR_BLK_ERASE_COUNT, wSectorCount);
+        MMCGet();
 
-        SPIputByte(0xff);  /* checksum -> don't care about it for now */
-        SPIputByte(0xff);  /* checksum -> don't care about it for now */
-        SPIputByte(0xff);  /* Read "data response byte"               */
-
-        wDataCount = 0xffff;
-        while ((SPIgetByte() == 0x00) && (--wDataCount)); /* wait for write finish */
-        if (wDataCount == 0)
+        MMCCommand(MMC_WRITE_MULTIPLE_BLOCK, MMCAddress(pDrive, dStartSector));
+        if (MMCGet() != 0x00)
         {
             nError = MMC_ERROR;
-            SPIdeselect();
-            break;
         }
+        else
+        {
+            for (wSector=0; wSector<wSectorCount; wSector++)
+            {
+                nError = MMCSendBlock(MMC_TOKEN_START_MULTI, pBuffer);
+                if (nError != MMC_OK)
+                {
+                    break;
+                }
+                pBuffer += 512;
 
-        SPIdeselect();
+                /*
+                 * the card stays selected up to the next start token,
+                 * MMCWaitBusy() lets the decoder in while it programs
+                 */
+            }
+
+            SPIputByte(MMC_TOKEN_STOP_TRAN);
+            SPIgetByte();       /* stuff byte before busy */
+            if (MMCWaitBusy() != MMC_OK)
+            {
+                nError = MMC_ERROR;
+            }
+        }
     }
 
+    SPIdeselect();
+    SPIunlock();
+
     return(nError);
 }
 #endif /* WriteSectors */
@@ -488,10 +830,10 @@ int MMCInit(int nMMCMode, MMC_MOUNT_FUNC *pMountFunc,
 
     MMCSemaInit();
 
-    nError = InitMMCCard();
+    nError = InitMMCCard(&sDrive[MMC_DRIVE_C]);
     if (nError == MMC_OK)
     {
-        sDrive[MMC_DRIVE_C].wFlags = MMC_READY;
+        sDrive[MMC_DRIVE_C].wFlags |= MMC_READY;
         //GetCID();
     }
 
@@ -0,0 +1,477 @@
+/* ========================================================================
+ * [PROJECT]    SIR100
+ * [MODULE]     Player
+ * [TITLE]      Audio source selection
+ * [FILE]       player.c
+ * [VSN]        1.0
+ * [CREATED]    19 october 2026
+ * [LASTCHNGD]  19 october 2026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    feeds the decoder from an internet stream and falls back
+ *              to the card when the stream cannot be played
+ * ======================================================================== */
+
+#define LOG_MODULE  LOG_PLAYER_MODULE
+
+#include <string.h>
+
+#include <sys/event.h>
+#include <sys/thread.h>
+#include <sys/timer.h>
+#include <sys/bankmem.h>
+
+#include "system.h"
+#include "log.h"
+#include "inet.h"
+#include "mmc.h"
+#include "cardindex.h"
+#include "tag.h"
+#include "vs10xx.h"
+#include "player.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+
+/*
+ *  the player thread is a producer like the card read-ahead (60), it
+ *  runs just below it so that a card refill is never held up by a read
+ *  on the socket
+ */
+#define PLAYER_PRIORITY             62
+#define PLAYER_STACK                1024    // DNS lookup and connect run on it
+#define PLAYER_POLL                 50      // ms to wait for room in the buffer
+#define PLAYER_RECV_TIMEOUT         5000    // ms, a read that times out counts as a failure
+#define PLAYER_URL_LEN              128
+
+#define PLAYER_MAX_RECONNECTS       3       // failed (re)connects before falling back
+#define PLAYER_RECONNECT_DELAY      1000    // ms between two connect attempts
+#define PLAYER_PROBE_INTERVAL       30      // seconds between attempts to get the stream back
+#define PLAYER_START_LEVEL          8192    // buffered bytes before the decoder is started
+#define PLAYER_LOW_LEVEL            4096    // fall back early when the buffer is this low
+
+/*-------------------------------------------------------------------------*/
+/* local variable definitions                                              */
+/*-------------------------------------------------------------------------*/
+
+/*!\brief wakes up the player thread when there is something to play */
+static HANDLE g_hPlayerEvent;
+
+/*!\brief URL of the stream, empty when stopped */
+static char g_szUrl[PLAYER_URL_LEN];
+
+/*!\brief set by PlayerPlayStream/PlayerStop, the thread drops what it plays */
+static volatile u_char g_bPlayerRestart;
+
+/*!\brief Status of this module */
+static TError g_tStatus = PLAYER_WAITPLAY;
+
+/*!\brief where the decoder gets its data from, PLAYER_SOURCE_xxx */
+static u_char g_ucSource = PLAYER_SOURCE_NONE;
+
+/*!\brief next entry of the media index to play during a fallback */
+static u_short g_usFallbackSong;
+
+/*!\brief path of the file handed to the card, kept off the thread stack */
+static char g_szPath[CARD_INDEX_PATH_LEN];
+
+/*-------------------------------------------------------------------------*/
+/* local routines (prototyping)                                            */
+/*-------------------------------------------------------------------------*/
+static HINET PlayerConnect(void);
+static int PlayerFeedStream(HINET hInet, TTagParser *ptParser);
+static void PlayerFeedCard(void);
+static int PlayerStartFallback(void);
+static void PlayerEndFallback(void);
+
+
+
+/*!
+ * \addtogroup Player
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief connect to the stream and check that it is MP3
+ *
+ * \return  the handle, NULL if the stream cannot be played
+ */
+static HINET PlayerConnect(void)
+{
+    HINET hInet;
+
+    if ((hInet = InetOpen()) == NULL)
+    {
+        return(NULL);
+    }
+
+    if ((InetConnect(hInet, g_szUrl, PLAYER_RECV_TIMEOUT, 0, 0) == OK) &&
+        (InetHttpOpenRequest(hInet, NULL, NULL, NULL, 0) == OK) &&
+        (InetHttpSendRequest(hInet) == OK) &&
+        (InetGetMimeType(hInet) == MIME_TYPE_MP3))
+    {
+        return(hInet);
+    }
+
+    LogMsg_P(LOG_WARNING, PSTR("Cannot play [%s]"), g_szUrl);
+    InetClose(hInet);
+    return(NULL);
+}
+
+/*!
+ * \brief move one read from the socket into the segmented buffer
+ *
+ * ID3 tags sent in front of the audio are taken out before the data is
+ * committed. The decoder is started once PLAYER_START_LEVEL bytes are
+ * buffered, and restarted the same way after it ran empty or was reset.
+ *
+ * \param   hInet connected stream
+ * \param   ptParser tag parser of this connection
+ *
+ * \return  >0 when data was read or the buffer is full, <=0 when the
+ *          stream is lost
+ */
+static int PlayerFeedStream(HINET hInet, TTagParser *ptParser)
+{
+    u_char *pucBuf;
+    size_t tSize;
+    u_short usTag;
+    int nRead;
+
+    pucBuf = (u_char *)NutSegBufWriteRequest(&tSize);
+    if (tSize == 0)
+    {
+        /* full, restart the decoder when it was reset by its supervisor */
+        if (VsGetStatus() != VS_STATUS_RUNNING)
+        {
+            VsPlayerKick();
+            g_tStatus = STREAMER_PLAYING;
+        }
+        NutSleep(PLAYER_POLL);
+        return(1);
+    }
+
+    nRead = InetRead(hInet, (char *)pucBuf, tSize);
+    if (nRead <= 0)
+    {
+        return(nRead);
+    }
+
+    usTag = TagParserFeed(ptParser, pucBuf, nRead);
+    if (usTag != 0)
+    {
+        nRead -= usTag;
+        memmove(pucBuf, pucBuf + usTag, nRead);
+    }
+    NutSegBufWriteCommit(nRead);
+
+    if (VsGetStatus() != VS_STATUS_RUNNING)
+    {
+        if (NutSegBufUsed() >= PLAYER_START_LEVEL)
+        {
+            VsPlayerKick();
+            g_tStatus = STREAMER_PLAYING;
+        }
+        else
+        {
+            g_tStatus = STREAMER_BUFFERING;
+        }
+    }
+    return(1);
+}
+
+/*!
+ * \brief queue the next song of the card behind what is buffered
+ *
+ * Does nothing while the card still reads the previous one. The songs
+ * are taken from the media index in order and wrap around at the end.
+ *
+ */
+static void PlayerFeedCard(void)
+{
+    u_short usFiles;
+
+    if (CardReadAheadBusy())
+    {
+        return;
+    }
+
+    usFiles = CardIndexGetNrofFiles();
+    if (usFiles == 0)
+    {
+        return;
+    }
+    if (g_usFallbackSong >= usFiles)
+    {
+        g_usFallbackSong = 0;
+    }
+
+    if (CardIndexGetPath(g_usFallbackSong, g_szPath, sizeof(g_szPath)) == 0)
+    {
+        (void)CardAppendMp3File(g_szPath);
+    }
+    ++g_usFallbackSong;
+}
+
+/*!
+ * \brief switch to the card when the stream is gone
+ *
+ * The first song is appended to whatever the stream left in the buffer,
+ * so the listener does not hear a gap.
+ *
+ * \return  0 when playing from the card, -1 if there is nothing to play
+ */
+static int PlayerStartFallback(void)
+{
+    if ((CardCheckPresent() != CARD_IS_PRESENT) || (CardIndexGetNrofFiles() == 0))
+    {
+        return(-1);
+    }
+
+    LogMsg_P(LOG_INFO, PSTR("Stream lost, playing from card"));
+
+    SystemStatus |= STATUS_FALLBACK_ACTIVE;
+    g_ucSource = PLAYER_SOURCE_CARD;
+    g_tStatus = STREAMER_FALLBACK;
+
+    PlayerFeedCard();
+    return(0);
+}
+
+/*!
+ * \brief leave the fallback, the card reader finishes its current read
+ *
+ */
+static void PlayerEndFallback(void)
+{
+    CardReleaseMp3File();
+    SystemStatus &= ~STATUS_FALLBACK_ACTIVE;
+    g_ucSource = PLAYER_SOURCE_NONE;
+}
+
+/*!
+ * \brief thread that feeds the decoder from the stream or from the card
+ *
+ * Reads the stream into the segmented buffer. When the stream cannot be
+ * (re)connected PLAYER_MAX_RECONNECTS times in a row, or the buffer is
+ * about to run dry while reconnecting, songs from the card are appended
+ * behind the last stream data and STATUS_FALLBACK_ACTIVE is set. Every
+ * PLAYER_PROBE_INTERVAL seconds the stream is tried again; once it is
+ * back the card is released and the stream data follows its last read.
+ *
+ * \param   -
+ *
+ * \return  -
+ */
+THREAD(Player, pArg)
+{
+    HINET hInet = NULL;
+    TTagParser tParser;
+    u_char ucFailures = 0;
+    u_long ulProbe = 0;
+
+    NutThreadSetPriority(PLAYER_PRIORITY);
+
+    for (;;)
+    {
+        if (g_bPlayerRestart)
+        {
+            g_bPlayerRestart = 0;
+            if (hInet != NULL)
+            {
+                InetClose(hInet);
+                hInet = NULL;
+            }
+            if (g_ucSource == PLAYER_SOURCE_CARD)
+            {
+                PlayerEndFallback();
+            }
+            g_ucSource = PLAYER_SOURCE_NONE;
+            ucFailures = 0;
+
+            /*
+             *  a new stream starts on an empty buffer, once the card has
+             *  stopped writing to it
+             */
+            if (g_szUrl[0] != '\0')
+            {
+                while (CardReadAheadBusy())
+                {
+                    NutSleep(PLAYER_POLL);
+                }
+                VsPlayerStop();
+                NutSegBufReset();
+            }
+        }
+
+        if (g_szUrl[0] == '\0')
+        {
+            g_tStatus = PLAYER_WAITPLAY;
+            NutEventWait(&g_hPlayerEvent, NUT_WAIT_INFINITE);
+            continue;
+        }
+
+        if (hInet == NULL)
+        {
+            if (g_ucSource == PLAYER_SOURCE_CARD)
+            {
+                PlayerFeedCard();
+                if ((NutGetSeconds() - ulProbe) < PLAYER_PROBE_INTERVAL)
+                {
+                    NutSleep(PLAYER_POLL);
+                    continue;
+                }
+                ulProbe = NutGetSeconds();
+            }
+            else
+            {
+                g_tStatus = STREAMER_CONNECTING;
+            }
+
+            if ((hInet = PlayerConnect()) == NULL)
+            {
+                if (g_ucSource != PLAYER_SOURCE_CARD)
+                {
+                    if ((++ucFailures < PLAYER_MAX_RECONNECTS) && (NutSegBufUsed() >= PLAYER_LOW_LEVEL))
+                    {
+                        NutSleep(PLAYER_RECONNECT_DELAY);
+                    }
+                    else if (PlayerStartFallback() == 0)
+                    {
+                        ulProbe = NutGetSeconds();
+                    }
+                    else
+                    {
+                        g_tStatus = STREAM_DISCONNECTED;
+                        NutSleep(PLAYER_RECONNECT_DELAY);
+                    }
+                }
+                continue;
+            }
+
+            if (g_ucSource == PLAYER_SOURCE_CARD)
+            {
+                LogMsg_P(LOG_INFO, PSTR("Stream is back"));
+                PlayerEndFallback();
+            }
+            g_ucSource = PLAYER_SOURCE_STREAM;
+            g_tStatus = STREAMER_BUFFERING;
+            TagParserInit(&tParser, NULL);
+        }
+
+        /*
+         *  the card may still be busy with its last read, the stream data
+         *  goes behind it
+         */
+        if (CardReadAheadBusy())
+        {
+            NutSleep(PLAYER_POLL);
+            continue;
+        }
+
+        if (PlayerFeedStream(hInet, &tParser) > 0)
+        {
+            ucFailures = 0;
+            continue;
+        }
+
+        LogMsg_P(LOG_WARNING, PSTR("Stream lost"));
+        InetClose(hInet);
+        hInet = NULL;
+        g_ucSource = PLAYER_SOURCE_NONE;
+        ++ucFailures;
+    }
+}
+
+/*!
+ * \brief play an internet stream
+ *
+ * Whatever plays now is dropped. The connection is made by the player
+ * thread, use PlayerStatus() to follow it.
+ *
+ * \param   pszUrl URL of the stream
+ *
+ * \return  OK or PLAYER_NO_SOURCE when the URL is empty or too long
+ */
+TError PlayerPlayStream(CONST char *pszUrl)
+{
+    if ((pszUrl == NULL) || (pszUrl[0] == '\0') || (strlen(pszUrl) >= sizeof(g_szUrl)))
+    {
+        return(PLAYER_NO_SOURCE);
+    }
+
+    CardStopMp3File();
+    strcpy(g_szUrl, pszUrl);
+    g_bPlayerRestart = 1;
+    NutEventPost(&g_hPlayerEvent);
+
+    return(OK);
+}
+
+/*!
+ * \brief stop the stream, or the card when it stands in for the stream
+ *
+ */
+void PlayerStop(void)
+{
+    g_szUrl[0] = '\0';
+    g_bPlayerRestart = 1;
+    if (g_ucSource == PLAYER_SOURCE_CARD)
+    {
+        CardStopMp3File();
+    }
+    VsPlayerStop();
+    NutEventPost(&g_hPlayerEvent);
+}
+
+/*!
+ * \brief return the status of this module
+ *
+ * \return  PLAYER_WAITPLAY, STREAMER_xxx or STREAM_DISCONNECTED
+ */
+TError PlayerStatus(void)
+{
+    return(g_tStatus);
+}
+
+/*!
+ * \brief return where the decoder gets its data from
+ *
+ * \return  PLAYER_SOURCE_xxx
+ */
+u_char PlayerGetSource(void)
+{
+    return(g_ucSource);
+}
+
+/*!
+ * \brief create the player thread
+ *
+ * The segmented buffer it writes to is set up by CardInit(), which must
+ * have been called before.
+ *
+ * \return  OK or PLAYER_NO_THREAD
+ */
+TError PlayerInit(void)
+{
+    char ThreadName[10];
+
+    strcpy_P(ThreadName, PSTR("Player"));
+
+    if (GetThreadByName((char *)ThreadName) == NULL)
+    {
+        if (NutThreadCreate((char *)ThreadName, Player, 0, PLAYER_STACK) == 0)
+        {
+            LogMsg_P(LOG_EMERG, PSTR("Thread failed"));
+            return(PLAYER_NO_THREAD);
+        }
+    }
+    return(OK);
+}
+
+/*@}*/
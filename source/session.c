@@ -55,7 +55,6 @@
 #include "log.h"
 //#include "settings.h"
 #include "display.h"
-#include "version.h"
 
 /*!
  * \addtogroup Session
@@ -348,6 +347,19 @@ static INLINE TError NetConfig(CONST char *szIfName)
         // TryGetDhcp(20000L);
         // SetDhcpDnsServers(0,0);
     // }
+
+    /*
+     * Until the settings above are ported: the MAC address and the
+     * previous network settings come from the EEPROM, the address
+     * (and the DNS servers) from DHCP
+     */
+    LogMsg_P(LOG_DEBUG, PSTR("Configuring ethernet %s"), szIfName);
+    if (NutNetLoadConfig(szIfName) != 0)
+    {
+        LogMsg_P(LOG_WARNING, PSTR("No network settings in EEPROM"));
+    }
+    TryGetDhcp(20000L);
+
     return(OK);
 }
 
@@ -363,7 +375,7 @@ static INLINE TError NetConfig(CONST char *szIfName)
 static INLINE TError StartNet(void)
 {
     TError tError = OK;
-    u_char byTempValue = 0;
+    u_char byTempValue = 1;             // always DHCP, see NetConfig()
 
     /*
      * Check if we use DHCP
@@ -0,0 +1,575 @@
+/* ========================================================================
+ * [PROJECT]    SIR100
+ * [MODULE]     Settings
+ * [TITLE]      Persistent settings
+ * [FILE]       settings.c
+ * [VSN]        1.0
+ * [CREATED]    19 october 2026
+ * [LASTCHNGD]  19 october 2026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    key/value settings kept as a log in the serial dataflash
+ * ======================================================================== */
+
+#define LOG_MODULE  LOG_SETTINGS_MODULE
+
+#include <string.h>
+
+#include "system.h"
+#include "log.h"
+#include "flash.h"
+#include "settings.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+
+/*
+ *  The settings live in FLASH_SETTINGS_NROF_PAGES pages of the dataflash.
+ *  One of them is active: every SettingsSet() appends a record to it
+ *
+ *      key, length, data, checksum
+ *
+ *  with a single page program (page to buffer, patch buffer, program).
+ *  The newest record of a key wins. When the active page is full the
+ *  newest record of every key is copied into the next page of the ring
+ *  with a streaming write, the page gets a higher sequence number and
+ *  becomes the active page. This way all pages of the range take their
+ *  share of the program cycles.
+ *
+ *  Both ways go through the SRAM buffers of the dataflash, so a write
+ *  holds At45dbLock() from start to end.
+ *
+ *  Only the first SETTINGS_AREA_SIZE bytes of a page are used, so the
+ *  layout is the same on every dataflash type.
+ */
+#define SETTINGS_AREA_SIZE          264     // page size of the smallest dataflash
+#define SETTINGS_MAGIC              0x5354  // 'ST'
+#define SETTINGS_HDR_SIZE           6       // magic, sequence number
+#define SETTINGS_REC_SIZE(len)      ((u_short)(len) + 3)
+#define SETTINGS_ERASED             0xFF
+#define SETTINGS_NO_PAGE            0xFF
+#define SETTINGS_CHUNK              16      // bytes on the stack when copying
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+
+/*!\brief Start of every page in use (6 bytes) */
+typedef struct _TSettingsPageHdr
+{
+    u_short usMagic;
+    u_long  ulSeq;                  // the highest one is the active page
+} TSettingsPageHdr;
+
+/*!\brief Where the newest record of a key is */
+typedef struct _TSettingsIndex
+{
+    u_char  ucPage;                 // SETTINGS_NO_PAGE if never written
+    u_char  ucLen;
+    u_short usOffset;               // of the key byte
+} TSettingsIndex;
+
+/*-------------------------------------------------------------------------*/
+/* local variable definitions                                              */
+/*-------------------------------------------------------------------------*/
+
+/*!\brief RAM index, built by SettingsInit() */
+static TSettingsIndex g_atIndex[SETTINGS_MAX_KEYS];
+
+/*!\brief page the records are appended to */
+static u_char g_ucActive = SETTINGS_NO_PAGE;
+
+/*!\brief first free byte of the active page */
+static u_short g_usFill;
+
+/*!\brief sequence number of the active page */
+static u_long g_ulSeq;
+
+/*-------------------------------------------------------------------------*/
+/* local routines (prototyping)                                            */
+/*-------------------------------------------------------------------------*/
+static u_char SettingsFlashSum(u_char ucPage, u_short usOffset, u_short usLen);
+static u_short SettingsScanPage(u_char ucPage);
+static int SettingsEqual(TSettingsIndex *ptIndex, CONST u_char *pucData);
+static u_char SettingsRecordSum(u_char ucKey, CONST void *pData, u_char ucLen);
+static int SettingsBufferRecord(u_short usOffset, u_char ucKey, CONST void *pData, u_char ucLen);
+static int SettingsStreamRecord(u_char ucKey, CONST void *pData, u_char ucLen);
+static int SettingsStreamCopy(TSettingsIndex *ptIndex);
+static int SettingsCompact(u_char ucKey, CONST void *pData, u_char ucLen);
+static int SettingsStore(u_char ucKey, CONST void *pData, u_char ucLen);
+
+
+
+/*!
+ * \addtogroup Settings
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief add up bytes of a settings page
+ *
+ * \param   ucPage page of the settings range
+ * \param   usOffset first byte
+ * \param   usLen number of bytes
+ *
+ * \return  the 8 bit sum
+ */
+static u_char SettingsFlashSum(u_char ucPage, u_short usOffset, u_short usLen)
+{
+    u_char aucChunk[SETTINGS_CHUNK];
+    u_char ucSum = 0;
+    u_short usPart;
+    u_char i;
+
+    while (usLen > 0)
+    {
+        usPart = (usLen > SETTINGS_CHUNK) ? SETTINGS_CHUNK : usLen;
+        At45dbRead(FLASH_SETTINGS_PAGE + ucPage, usOffset, aucChunk, usPart);
+        for (i = 0; i < usPart; ++i)
+        {
+            ucSum += aucChunk[i];
+        }
+        usOffset += usPart;
+        usLen -= usPart;
+    }
+    return(ucSum);
+}
+
+/*!
+ * \brief enter the records of a page into the index
+ *
+ * Stops at the first erased byte or at a record that does not check
+ * out, e.g. after a power failure while programming.
+ *
+ * \param   ucPage page of the settings range
+ *
+ * \return  offset of the first free byte, SETTINGS_AREA_SIZE if no
+ *          record may be appended
+ */
+static u_short SettingsScanPage(u_char ucPage)
+{
+    u_short usOffset = SETTINGS_HDR_SIZE;
+    u_char aucRec[2];
+    u_char ucSum;
+
+    while (usOffset + SETTINGS_REC_SIZE(0) <= SETTINGS_AREA_SIZE)
+    {
+        At45dbRead(FLASH_SETTINGS_PAGE + ucPage, usOffset, aucRec, sizeof(aucRec));
+        if (aucRec[0] == SETTINGS_ERASED)
+        {
+            return(usOffset);
+        }
+
+        if ((aucRec[0] >= SETTINGS_MAX_KEYS) || (aucRec[1] > SETTINGS_MAX_LEN) ||
+            (usOffset + SETTINGS_REC_SIZE(aucRec[1]) > SETTINGS_AREA_SIZE))
+        {
+            break;
+        }
+        At45dbRead(FLASH_SETTINGS_PAGE + ucPage, usOffset + 2 + aucRec[1], &ucSum, 1);
+        if ((u_char)~SettingsFlashSum(ucPage, usOffset, 2 + aucRec[1]) != ucSum)
+        {
+            break;
+        }
+
+        g_atIndex[aucRec[0]].ucPage = ucPage;
+        g_atIndex[aucRec[0]].ucLen = aucRec[1];
+        g_atIndex[aucRec[0]].usOffset = usOffset;
+
+        usOffset += SETTINGS_REC_SIZE(aucRec[1]);
+    }
+
+    /*
+     *  the loop only ends early on a bad record, otherwise the page is full
+     */
+    if (usOffset + SETTINGS_REC_SIZE(0) <= SETTINGS_AREA_SIZE)
+    {
+        LogMsg_P(LOG_WARNING, PSTR("Bad record at %d/%d"), ucPage, usOffset);
+    }
+    return(SETTINGS_AREA_SIZE);
+}
+
+/*!
+ * \brief compare the stored value of a key with new data
+ *
+ * \return  1 if equal, 0 if not
+ */
+static int SettingsEqual(TSettingsIndex *ptIndex, CONST u_char *pucData)
+{
+    u_char aucChunk[SETTINGS_CHUNK];
+    u_short usOffset = ptIndex->usOffset + 2;
+    u_char ucLeft = ptIndex->ucLen;
+    u_char ucPart;
+
+    while (ucLeft > 0)
+    {
+        ucPart = (ucLeft > SETTINGS_CHUNK) ? SETTINGS_CHUNK : ucLeft;
+        At45dbRead(FLASH_SETTINGS_PAGE + ptIndex->ucPage, usOffset, aucChunk, ucPart);
+        if (memcmp(aucChunk, pucData, ucPart) != 0)
+        {
+            return(0);
+        }
+        pucData += ucPart;
+        usOffset += ucPart;
+        ucLeft -= ucPart;
+    }
+    return(1);
+}
+
+/*!
+ * \brief checksum byte of a record
+ *
+ * \return  the inverted 8 bit sum of key, length and data
+ */
+static u_char SettingsRecordSum(u_char ucKey, CONST void *pData, u_char ucLen)
+{
+    u_char ucSum;
+    u_char i;
+
+    ucSum = ucKey + ucLen;
+    for (i = 0; i < ucLen; ++i)
+    {
+        ucSum += ((CONST u_char *)pData)[i];
+    }
+    return(~ucSum);
+}
+
+/*!
+ * \brief put a record into the dataflash buffer
+ *
+ * \return  0 on success or -1 in case of an error
+ */
+static int SettingsBufferRecord(u_short usOffset, u_char ucKey, CONST void *pData, u_char ucLen)
+{
+    u_char aucRec[2];
+    u_char ucSum;
+
+    aucRec[0] = ucKey;
+    aucRec[1] = ucLen;
+    ucSum = SettingsRecordSum(ucKey, pData, ucLen);
+
+    if ((At45dbBufferWrite(usOffset, aucRec, sizeof(aucRec)) != 0) ||
+        (At45dbBufferWrite(usOffset + 2, pData, ucLen) != 0) ||
+        (At45dbBufferWrite(usOffset + 2 + ucLen, &ucSum, 1) != 0))
+    {
+        return(-1);
+    }
+    return(0);
+}
+
+/*!
+ * \brief add a record to the streaming write
+ *
+ * \return  0 on success or -1 in case of an error
+ */
+static int SettingsStreamRecord(u_char ucKey, CONST void *pData, u_char ucLen)
+{
+    u_char aucRec[2];
+    u_char ucSum;
+
+    aucRec[0] = ucKey;
+    aucRec[1] = ucLen;
+    ucSum = SettingsRecordSum(ucKey, pData, ucLen);
+
+    if ((At45dbWriteData(aucRec, sizeof(aucRec)) != 0) ||
+        (At45dbWriteData(pData, ucLen) != 0) ||
+        (At45dbWriteData(&ucSum, 1) != 0))
+    {
+        return(-1);
+    }
+    return(0);
+}
+
+/*!
+ * \brief copy a stored record into the streaming write
+ *
+ * The area is no bigger than the smallest page, so the streaming write
+ * does not start a page program before At45dbWriteEnd() and the old
+ * page can still be read here.
+ *
+ * \return  0 on success or -1 in case of an error
+ */
+static int SettingsStreamCopy(TSettingsIndex *ptIndex)
+{
+    u_char aucChunk[SETTINGS_CHUNK];
+    u_short usFrom = ptIndex->usOffset;
+    u_short usLeft = SETTINGS_REC_SIZE(ptIndex->ucLen);
+    u_short usPart;
+
+    while (usLeft > 0)
+    {
+        usPart = (usLeft > SETTINGS_CHUNK) ? SETTINGS_CHUNK : usLeft;
+        if ((At45dbRead(FLASH_SETTINGS_PAGE + ptIndex->ucPage, usFrom, aucChunk, usPart) != 0) ||
+            (At45dbWriteData(aucChunk, usPart) != 0))
+        {
+            return(-1);
+        }
+        usFrom += usPart;
+        usLeft -= usPart;
+    }
+    return(0);
+}
+
+/*!
+ * \brief start the next page of the ring with the newest record of every key
+ *
+ * The new value of ucKey goes in with the same page program, the rest
+ * of the page is erased by the streaming write.
+ *
+ * \return  0 on success or -1 in case of an error
+ */
+static int SettingsCompact(u_char ucKey, CONST void *pData, u_char ucLen)
+{
+    TSettingsPageHdr tHdr;
+    u_char ucPage;
+    u_short usOffset;
+    u_char i;
+    int iResult;
+
+    /*
+     *  check that everything fits before touching the buffer
+     */
+    usOffset = SETTINGS_HDR_SIZE + SETTINGS_REC_SIZE(ucLen);
+    for (i = 0; i < SETTINGS_MAX_KEYS; ++i)
+    {
+        if ((i != ucKey) && (g_atIndex[i].ucPage != SETTINGS_NO_PAGE))
+        {
+            usOffset += SETTINGS_REC_SIZE(g_atIndex[i].ucLen);
+        }
+    }
+    if (usOffset > SETTINGS_AREA_SIZE)
+    {
+        LogMsg_P(LOG_ERR, PSTR("Settings full"));
+        return(-1);
+    }
+
+    ucPage = (g_ucActive == SETTINGS_NO_PAGE) ? 0 : (g_ucActive + 1) % FLASH_SETTINGS_NROF_PAGES;
+    tHdr.usMagic = SETTINGS_MAGIC;
+    tHdr.ulSeq = g_ulSeq + 1;
+
+    if (At45dbWriteBegin(FLASH_SETTINGS_PAGE + ucPage) != 0)
+    {
+        return(-1);
+    }
+
+    iResult = At45dbWriteData(&tHdr, SETTINGS_HDR_SIZE);
+    for (i = 0; (i < SETTINGS_MAX_KEYS) && (iResult == 0); ++i)
+    {
+        if ((i != ucKey) && (g_atIndex[i].ucPage != SETTINGS_NO_PAGE))
+        {
+            iResult = SettingsStreamCopy(&g_atIndex[i]);
+        }
+    }
+    if (iResult == 0)
+    {
+        iResult = SettingsStreamRecord(ucKey, pData, ucLen);
+    }
+
+    /*
+     *  always end the streaming write, it waits for the page program
+     */
+    if ((At45dbWriteEnd() < 0) || (iResult != 0))
+    {
+        return(-1);
+    }
+
+    /*
+     *  the records are on the flash, now move the index over
+     */
+    usOffset = SETTINGS_HDR_SIZE;
+    for (i = 0; i < SETTINGS_MAX_KEYS; ++i)
+    {
+        if ((i != ucKey) && (g_atIndex[i].ucPage != SETTINGS_NO_PAGE))
+        {
+            g_atIndex[i].ucPage = ucPage;
+            g_atIndex[i].usOffset = usOffset;
+            usOffset += SETTINGS_REC_SIZE(g_atIndex[i].ucLen);
+        }
+    }
+    g_atIndex[ucKey].ucPage = ucPage;
+    g_atIndex[ucKey].ucLen = ucLen;
+    g_atIndex[ucKey].usOffset = usOffset;
+
+    g_ucActive = ucPage;
+    g_ulSeq = tHdr.ulSeq;
+    g_usFill = usOffset + SETTINGS_REC_SIZE(ucLen);
+
+    LogMsg_P(LOG_INFO, PSTR("Settings moved to page %d"), ucPage);
+    return(0);
+}
+
+/*!
+ * \brief build the index of the settings
+ *
+ * Reads the header of every page of the settings range, then the
+ * records of the pages in use, oldest page first. Must be called after
+ * At45dbInit().
+ *
+ * \return  0 on success or -1 if there is no (usable) dataflash
+ */
+int SettingsInit(void)
+{
+    TSettingsPageHdr tHdr;
+    u_char ucNewest = SETTINGS_NO_PAGE;
+    u_char ucPage;
+    u_char i;
+    u_short usFill = SETTINGS_AREA_SIZE;
+
+    memset(g_atIndex, SETTINGS_NO_PAGE, sizeof(g_atIndex));
+    g_ucActive = SETTINGS_NO_PAGE;
+    g_ulSeq = 0;
+
+    if (At45dbPageSize() < SETTINGS_AREA_SIZE)
+    {
+        LogMsg_P(LOG_ERR, PSTR("No dataflash"));
+        return(-1);
+    }
+
+    for (ucPage = 0; ucPage < FLASH_SETTINGS_NROF_PAGES; ++ucPage)
+    {
+        At45dbRead(FLASH_SETTINGS_PAGE + ucPage, 0, &tHdr, SETTINGS_HDR_SIZE);
+        if ((tHdr.usMagic == SETTINGS_MAGIC) &&
+            ((ucNewest == SETTINGS_NO_PAGE) || (tHdr.ulSeq > g_ulSeq)))
+        {
+            ucNewest = ucPage;
+            g_ulSeq = tHdr.ulSeq;
+        }
+    }
+
+    if (ucNewest == SETTINGS_NO_PAGE)
+    {
+        LogMsg_P(LOG_INFO, PSTR("No settings stored"));
+        return(0);
+    }
+
+    /*
+     *  pages are taken in ring order, so the one after the newest is the
+     *  oldest. Newer records overwrite the index entries of older ones
+     */
+    for (i = 1; i <= FLASH_SETTINGS_NROF_PAGES; ++i)
+    {
+        ucPage = (ucNewest + i) % FLASH_SETTINGS_NROF_PAGES;
+        At45dbRead(FLASH_SETTINGS_PAGE + ucPage, 0, &tHdr, SETTINGS_HDR_SIZE);
+        if (tHdr.usMagic == SETTINGS_MAGIC)
+        {
+            usFill = SettingsScanPage(ucPage);
+        }
+    }
+
+    g_ucActive = ucNewest;
+    g_usFill = usFill;
+
+    return(0);
+}
+
+/*!
+ * \brief read a setting
+ *
+ * \param   ucKey SETTINGS_KEY_xxx
+ * \param   pData receives the value
+ * \param   ucLen size of pData, a longer value is cut off
+ *
+ * \return  the number of bytes read, -1 if the setting was never written
+ */
+int SettingsGet(u_char ucKey, void *pData, u_char ucLen)
+{
+    TSettingsIndex *ptIndex;
+    int iResult;
+
+    if ((ucKey >= SETTINGS_MAX_KEYS) || (g_atIndex[ucKey].ucPage == SETTINGS_NO_PAGE))
+    {
+        return(-1);
+    }
+
+    /*
+     *  a concurrent SettingsSet() may move the record or program its page
+     */
+    At45dbLock();
+    ptIndex = &g_atIndex[ucKey];
+    if (ucLen > ptIndex->ucLen)
+    {
+        ucLen = ptIndex->ucLen;
+    }
+    iResult = ucLen;
+    if (At45dbRead(FLASH_SETTINGS_PAGE + ptIndex->ucPage, ptIndex->usOffset + 2, pData, ucLen) != 0)
+    {
+        iResult = -1;
+    }
+    At45dbUnlock();
+    return(iResult);
+}
+
+/*!
+ * \brief append a record or compact, with At45dbLock() held
+ *
+ * \return  0 on success or -1 in case of an error
+ */
+static int SettingsStore(u_char ucKey, CONST void *pData, u_char ucLen)
+{
+    TSettingsIndex *ptIndex;
+    u_long ulPage;
+
+    ptIndex = &g_atIndex[ucKey];
+    if ((ptIndex->ucPage != SETTINGS_NO_PAGE) && (ptIndex->ucLen == ucLen) &&
+        SettingsEqual(ptIndex, pData))
+    {
+        return(0);
+    }
+
+    if ((g_ucActive == SETTINGS_NO_PAGE) ||
+        (g_usFill + SETTINGS_REC_SIZE(ucLen) > SETTINGS_AREA_SIZE))
+    {
+        return(SettingsCompact(ucKey, pData, ucLen));
+    }
+
+    ulPage = FLASH_SETTINGS_PAGE + g_ucActive;
+    if ((At45dbBufferLoad(ulPage) != 0) ||
+        (SettingsBufferRecord(g_usFill, ucKey, pData, ucLen) != 0) ||
+        (At45dbBufferFlash(ulPage) != 0))
+    {
+        return(-1);
+    }
+
+    ptIndex->ucPage = g_ucActive;
+    ptIndex->ucLen = ucLen;
+    ptIndex->usOffset = g_usFill;
+    g_usFill += SETTINGS_REC_SIZE(ucLen);
+
+    return(0);
+}
+
+/*!
+ * \brief write a setting
+ *
+ * Nothing is written if the value did not change. Otherwise the record
+ * is appended to the active page, or goes into the next page together
+ * with all other settings when the active page is full.
+ *
+ * \param   ucKey SETTINGS_KEY_xxx
+ * \param   pData the value
+ * \param   ucLen its size, up to SETTINGS_MAX_LEN bytes
+ *
+ * \return  0 on success or -1 in case of an error
+ */
+int SettingsSet(u_char ucKey, CONST void *pData, u_char ucLen)
+{
+    int iResult;
+
+    if ((ucKey >= SETTINGS_MAX_KEYS) || (ucLen > SETTINGS_MAX_LEN) ||
+        (At45dbPageSize() < SETTINGS_AREA_SIZE))
+    {
+        return(-1);
+    }
+
+    At45dbLock();
+    iResult = SettingsStore(ucKey, pData, ucLen);
+    At45dbUnlock();
+
+    return(iResult);
+}
+
+/*@}*/
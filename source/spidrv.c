@@ -26,21 +26,36 @@
 #include "vs10xx.h"
 
 #include <sys/timer.h>
+#include <sys/event.h>
+#include <sys/atom.h>
 
 /*-------------------------------------------------------------------------*/
 /* local defines                                                           */
 /*-------------------------------------------------------------------------*/
+#define SPI_DEV_NONE    SPI_NROF_DEVICES    // no clock settings applied yet
+
 /*-------------------------------------------------------------------------*/
 /* typedefs & structs                                                      */
 /*-------------------------------------------------------------------------*/
+/*!
+ * \brief SPI clock settings of a device
+ */
+typedef struct
+{
+    u_char bSpcr;
+    u_char bSpsr;
+} TSPIClock;
+
 /*-------------------------------------------------------------------------*/
 /* local variable definitions                                              */
 /*-------------------------------------------------------------------------*/
 static u_char g_Speedmode;
 
-/*-------------------------------------------------------------------------*/
-/* local routines (prototyping)                                            */
-/*-------------------------------------------------------------------------*/
+static TSPIClock g_tClock[SPI_NROF_DEVICES];
+static volatile u_char g_bActive = SPI_DEV_NONE;   // device the SPI registers are set for
+
+static HANDLE hSPIMutex;
+static u_char g_bLockIef;                           // decoder interrupt state before SPIlock()
 
 /*!
  * \addtogroup Drivers
@@ -72,56 +87,12 @@ static u_char g_Speedmode;
 
 void SPIselect(TSPIDevice Device)
 {
-
-    // set SPI-speed for selected device
-    if (Device==SPI_DEV_VS10XX)
-    {
-        if (g_Speedmode==SPEED_SLOW)
-        {
-            // set speed to Fosc/8
-            outb(SPSR, BV(SPI2X));
-            outb(SPCR, BV(MSTR) | BV(SPE) | BV(SPR0));
-        }
-        else if (g_Speedmode==SPEED_FAST)
-        {
-            // set speed to Fosc/4
-            outb(SPSR, 0);
-            outb(SPCR, BV(MSTR) | BV(SPE));
-        }
-        else if (g_Speedmode==SPEED_ULTRA_FAST)
-        {
-            // set speed to Fosc/2
-            outb(SPSR, BV(SPI2X));
-            outb(SPCR, BV(MSTR) | BV(SPE));
-        }
-        else
-        {
-            LogMsg_P(LOG_ERR,PSTR("invalid Speed"));
-        }
-    }
-    else if (Device==SPI_DEV_FLASH)
+    // set SPI-speed for selected device, only when it differs from the last one
+    if (Device != g_bActive)
     {
-        // set speed for flash to Fosc/2
-        outb(SPSR, BV(SPI2X));
-        outb(SPCR, BV(MSTR) | BV(SPE));
-    }
-    else
-    {
-        // set speed for flash to Fosc/2
-//        outb(SPSR, BV(SPI2X));
-//        outb(SPCR, BV(MSTR) | BV(SPE));
-
-        // set speed for card to Fosc/4
-        outb(SPSR, 0);
-        outb(SPCR, BV(MSTR) | BV(SPE));
-
-        // set speed for card to Fosc/8
-//        outb(SPSR, BV(SPI2X));
-//        outb(SPCR, BV(MSTR) | BV(SPE) | BV(SPR0));
-
-        // set speed for card to Fosc/16
-//        outb(SPSR, 0);
-//        outb(SPCR, BV(MSTR) | BV(SPE) | BV(SPR0));
+        outb(SPSR, g_tClock[Device].bSpsr);
+        outb(SPCR, g_tClock[Device].bSpcr);
+        g_bActive = Device;
     }
 
     // enable selected device
@@ -163,19 +134,100 @@ void SPIdeselect()
     sbi(MMCVS_OUT_WRITE, MMC_ENABLE);      // disable MMC/SDHC
 }
 
+/*!
+ * \brief Set the clock of a device.
+ *
+ * The SPI registers are written on the next SPIselect() of that device.
+ *
+ * \param Device  device to set the clock for
+ * \param bSpeed  SPEED_SLOW (Fosc/8), SPEED_FAST (Fosc/4) or SPEED_ULTRA_FAST (Fosc/2)
+ */
+void SPIsetSpeed(TSPIDevice Device, u_char bSpeed)
+{
+    TSPIClock tClock;
+
+    if (bSpeed==SPEED_SLOW)
+    {
+        // set speed to Fosc/8
+        tClock.bSpsr = BV(SPI2X);
+        tClock.bSpcr = BV(MSTR) | BV(SPE) | BV(SPR0);
+    }
+    else if (bSpeed==SPEED_FAST)
+    {
+        // set speed to Fosc/4
+        tClock.bSpsr = 0;
+        tClock.bSpcr = BV(MSTR) | BV(SPE);
+    }
+    else if (bSpeed==SPEED_ULTRA_FAST)
+    {
+        // set speed to Fosc/2
+        tClock.bSpsr = BV(SPI2X);
+        tClock.bSpcr = BV(MSTR) | BV(SPE);
+    }
+    else
+    {
+        LogMsg_P(LOG_ERR,PSTR("invalid Speed"));
+        return;
+    }
+
+    g_tClock[Device] = tClock;
+    if (g_bActive == Device)
+    {
+        g_bActive = SPI_DEV_NONE;   // force re-apply on next select
+    }
+}
+
 /*!
  * \brief not all devices can operate always on maximum speed. This routine determines the several speed modes.
  *
+ * Sets the speed for the VS10XX, which uses a slow clock for register
+ * access and a faster one for the data interface.
  */
 void SPImode(u_char data)
 {
-    g_Speedmode = data;
+    if (data != g_Speedmode)
+    {
+        g_Speedmode = data;
+        SPIsetSpeed(SPI_DEV_VS10XX, data);
+    }
 }
 
 u_char SPIgetmode(void)
 {
     return(g_Speedmode);
 }
+
+/*!
+ * \brief Claim the SPI bus for one transaction.
+ *
+ * Threads must hold the bus from selecting a device until it is
+ * deselected again. Decoder interrupts are disabled while the bus is
+ * claimed, so the audio feeder cannot select the VS10XX in the middle
+ * of a transfer. Long card or flash transfers must release the bus
+ * between blocks (sectors, pages) to let a pending feeder interrupt in.
+ *
+ * Calls must not be nested.
+ */
+void SPIlock(void)
+{
+    u_char ief;
+
+    NutEventWait(&hSPIMutex, 0);
+    ief = VsPlayerInterrupts(0);
+    g_bLockIef = ief;
+}
+
+/*!
+ * \brief Release the SPI bus claimed with SPIlock().
+ *
+ * Decoder interrupts are restored, a DREQ edge seen in the meantime is
+ * handled right away.
+ */
+void SPIunlock(void)
+{
+    VsPlayerInterrupts(g_bLockIef);
+    NutEventPost(&hSPIMutex);
+}
 /*!
  * \brief send a byte using SPI, ignore result
  *
@@ -208,6 +260,32 @@ u_char SPItransferByte(u_char data)
     return(SPDR);                    // return with byte shifted in from receiver
 }
 
+/*!
+ * \brief Transfer a block of bytes to/from the selected device.
+ *
+ * The transfer is polled. The card and the dataflash run at Fosc/4 and
+ * Fosc/2, where a byte takes 32 or 16 CPU cycles. That is less than
+ * entering and leaving an interrupt, so handing bytes to an interrupt
+ * would not free the CPU for other threads.
+ *
+ * \param Device  device, must have been selected by the caller
+ * \param pTx     data to send, NULL to send 0xFF
+ * \param pRx     buffer for the received data, may be NULL
+ * \param wLen    number of bytes
+ */
+void SPItransfer(TSPIDevice Device, CONST u_char *pTx, u_char *pRx, u_short wLen)
+{
+    while (wLen--)
+    {
+        SPDR = (pTx != NULL) ? *pTx++ : 0xFF;
+        while (!(SPSR & (1<<SPIF)));     // wait for completion
+        if (pRx != NULL)
+        {
+            *pRx++ = SPDR;
+        }
+    }
+}
+
 /*!
  * \brief Initialise SPI registers (speed)
  *
@@ -220,6 +298,15 @@ void SPIinit()
     sbi(FLASH_OUT_WRITE, FLASH_ENABLE);    // disable serial Flash
     cbi(MMCVS_OUT_WRITE, VS_ENABLE);       // disable VS10XX
     sbi(MMCVS_OUT_WRITE, MMC_ENABLE);      // disable MMC/SDHC
+
+    g_Speedmode = SPEED_SLOW;
+    SPIsetSpeed(SPI_DEV_VS10XX, SPEED_SLOW);
+    SPIsetSpeed(SPI_DEV_FLASH, SPEED_ULTRA_FAST);
+    SPIsetSpeed(SPI_DEV_MMC, SPEED_FAST);
+    g_bActive = SPI_DEV_NONE;
+
+    // bus is free
+    NutEventPost(&hSPIMutex);
 }
 
 
@@ -0,0 +1,637 @@
+/* ========================================================================
+ * [PROJECT]    SIR100
+ * [MODULE]     Tag
+ * [TITLE]      ID3/APE tag parser
+ * [FILE]       tag.c
+ * [VSN]        1.0
+ * [CREATED]    19 october 2026
+ * [LASTCHNGD]  19 october 2026
+ * [COPYRIGHT]  Copyright (C) STREAMIT BV 2010
+ * [PURPOSE]    keep ID3 and APE tags away from the decoder, pick up the
+ *              title and artist on the way
+ * ======================================================================== */
+
+/*
+ *  MP3 files and some streams start with one or more ID3v2 tags, often
+ *  with tens of kilobytes of album art. The decoder skips them, but only
+ *  after they have been clocked in over SPI.
+ *
+ *  TagParserFeed() takes the data in chunks, as it arrives from a stream,
+ *  and tells how many bytes at the start of each chunk belong to a tag.
+ *  Frames that are not needed end up in TAG_STATE_SKIP, a file source can
+ *  use TagParserSkip()/TagParserSkipped() to seek over them instead of
+ *  reading them. TagScanFile() does exactly that and also finds the ID3v1
+ *  and APEv2 tags at the end of a file.
+ */
+
+/*--------------------------------------------------------------------------*/
+/*  Include files                                                           */
+/*--------------------------------------------------------------------------*/
+#include <string.h>
+#include <stdio.h>
+#include <io.h>
+
+#include "system.h"
+#include "tag.h"
+
+/*-------------------------------------------------------------------------*/
+/* local defines                                                           */
+/*-------------------------------------------------------------------------*/
+#define TAG_STATE_HEADER        0       // collecting a tag header
+#define TAG_STATE_EXTHDR        1       // collecting the extended header size
+#define TAG_STATE_FRAMEHDR      2       // collecting a frame header
+#define TAG_STATE_TEXT          3       // title or artist frame
+#define TAG_STATE_SKIP          4       // ulSkip bytes to drop
+#define TAG_STATE_AUDIO         5       // no (more) tags
+
+#define TAG_ENC_UNKNOWN         0xFF    // encoding byte not seen yet
+#define TAG_ENC_UTF16           1
+#define TAG_ENC_UTF16BE         2
+#define TAG_ENC_UTF8            3
+
+#define TAG_SCAN_CHUNK          32      // bytes read at a time, fits an APE footer
+
+/*-------------------------------------------------------------------------*/
+/* local routines (prototyping)                                            */
+/*-------------------------------------------------------------------------*/
+static u_char TagHeaderValid(TTagParser *ptParser);
+static void TagSkipBytes(TTagParser *ptParser, u_long ulBytes);
+static void TagNextInTag(TTagParser *ptParser);
+static void TagBeginTag(TTagParser *ptParser);
+static void TagBeginFrame(TTagParser *ptParser);
+static void TagPutChar(TTagParser *ptParser, u_char c);
+static void TagPutText(TTagParser *ptParser, u_char c);
+static void TagFieldV1(char *pszText, CONST u_char *pucField);
+
+
+/*!
+ * \addtogroup Tag
+ */
+
+/*@{*/
+
+/*-------------------------------------------------------------------------*/
+/*                         start of code                                   */
+/*-------------------------------------------------------------------------*/
+
+/*!
+ * \brief check the bytes of a tag header collected so far
+ *
+ * "ID3", major version 2..4, revision, flags and a syncsafe size.
+ */
+static u_char TagHeaderValid(TTagParser *ptParser)
+{
+    u_char ucIdx = ptParser->ucCount - 1;
+    u_char c = ptParser->aucHdr[ucIdx];
+
+    switch (ucIdx)
+    {
+        case 0:  return(c == 'I');
+        case 1:  return(c == 'D');
+        case 2:  return(c == '3');
+        case 3:  return((c >= 2) && (c <= 4));
+        case 4:  return(c != 0xFF);
+        case 5:  return(1);
+        default: return(c < 0x80);
+    }
+}
+
+/*!
+ * \brief drop the next bytes of the current tag
+ */
+static void TagSkipBytes(TTagParser *ptParser, u_long ulBytes)
+{
+    if (ulBytes > ptParser->ulTagLeft)
+    {
+        ulBytes = ptParser->ulTagLeft;
+    }
+    ptParser->ulTagLeft -= ulBytes;
+    ptParser->ulSkip = ulBytes;
+    ptParser->ucState = TAG_STATE_SKIP;
+    if (ulBytes == 0)
+    {
+        TagNextInTag(ptParser);
+    }
+}
+
+/*!
+ * \brief decide what comes after a header, a frame or a skipped part
+ *
+ * Once title and artist are known, the rest of the tag is skipped in one
+ * go. After the tag (and its footer) another tag may follow.
+ */
+static void TagNextInTag(TTagParser *ptParser)
+{
+    u_char ucHdrLen = (ptParser->ucVersion == 2) ? 6 : 10;
+
+    ptParser->ucCount = 0;
+    if (ptParser->ulTagLeft == 0)
+    {
+        if (ptParser->ucFooter)
+        {
+            ptParser->ucFooter = 0;
+            ptParser->ulSkip = 10;
+            ptParser->ucState = TAG_STATE_SKIP;
+        }
+        else
+        {
+            ptParser->ucState = TAG_STATE_HEADER;
+        }
+    }
+    else if ((ptParser->ptInfo == NULL) ||
+             ((ptParser->ptInfo->szTitle[0] != 0) && (ptParser->ptInfo->szArtist[0] != 0)) ||
+             (ptParser->ulTagLeft < ucHdrLen))
+    {
+        TagSkipBytes(ptParser, ptParser->ulTagLeft);
+    }
+    else
+    {
+        ptParser->ucState = TAG_STATE_FRAMEHDR;
+    }
+}
+
+/*!
+ * \brief a complete tag header is in aucHdr
+ */
+static void TagBeginTag(TTagParser *ptParser)
+{
+    u_char *pucHdr = ptParser->aucHdr;
+    u_char ucFlags = pucHdr[5];
+
+    ptParser->ucVersion = pucHdr[3];
+    ptParser->ulTagLeft = ((u_long)pucHdr[6] << 21) | ((u_long)pucHdr[7] << 14) |
+                          ((u_long)pucHdr[8] << 7) | (u_long)pucHdr[9];
+    ptParser->ucFooter = (ptParser->ucVersion == 4) && (ucFlags & 0x10);
+    ptParser->ucCount = 0;
+
+    /*
+     *  before v2.4 unsynchronisation applies to the whole tag, frame sizes
+     *  do not count the inserted bytes. Those tags are skipped as a whole,
+     *  as are v2.2 tags with compression
+     */
+    if ((ptParser->ptInfo == NULL) ||
+        ((ptParser->ucVersion < 4) && (ucFlags & 0x80)) ||
+        ((ptParser->ucVersion == 2) && (ucFlags & 0x40)))
+    {
+        TagSkipBytes(ptParser, ptParser->ulTagLeft);
+    }
+    else if (ucFlags & 0x40)
+    {
+        ptParser->ucState = TAG_STATE_EXTHDR;
+    }
+    else
+    {
+        TagNextInTag(ptParser);
+    }
+}
+
+/*!
+ * \brief a complete frame header is in aucHdr
+ */
+static void TagBeginFrame(TTagParser *ptParser)
+{
+    u_char *pucHdr = ptParser->aucHdr;
+    TTagInfo *ptInfo = ptParser->ptInfo;
+    u_long ulSize;
+    u_char ucFlags = 0;
+    u_char ucUnusable;
+    char *pszText = NULL;
+
+    if (ptParser->ucVersion == 2)
+    {
+        ulSize = ((u_long)pucHdr[3] << 16) | ((u_long)pucHdr[4] << 8) | pucHdr[5];
+        if (memcmp_P(pucHdr, PSTR("TT2"), 3) == 0)
+        {
+            pszText = ptInfo->szTitle;
+        }
+        else if (memcmp_P(pucHdr, PSTR("TP1"), 3) == 0)
+        {
+            pszText = ptInfo->szArtist;
+        }
+        ucUnusable = 0;
+    }
+    else
+    {
+        if (ptParser->ucVersion == 3)
+        {
+            ulSize = ((u_long)pucHdr[4] << 24) | ((u_long)pucHdr[5] << 16) |
+                     ((u_long)pucHdr[6] << 8) | pucHdr[7];
+            ucUnusable = pucHdr[9] & 0xE0;      // compression, encryption, grouping
+        }
+        else
+        {
+            ulSize = ((u_long)(pucHdr[4] & 0x7F) << 21) | ((u_long)(pucHdr[5] & 0x7F) << 14) |
+                     ((u_long)(pucHdr[6] & 0x7F) << 7) | (pucHdr[7] & 0x7F);
+            ucFlags = pucHdr[9];
+            ucUnusable = ucFlags & 0x4C;        // grouping, compression, encryption
+        }
+        if (memcmp_P(pucHdr, PSTR("TIT2"), 4) == 0)
+        {
+            pszText = ptInfo->szTitle;
+        }
+        else if (memcmp_P(pucHdr, PSTR("TPE1"), 4) == 0)
+        {
+            pszText = ptInfo->szArtist;
+        }
+    }
+
+    if (ulSize > ptParser->ulTagLeft)
+    {
+        ulSize = ptParser->ulTagLeft;
+    }
+
+    if ((pszText == NULL) || (*pszText != 0) || ucUnusable || (ulSize == 0))
+    {
+        TagSkipBytes(ptParser, ulSize);
+        return;
+    }
+
+    ptParser->pszText = pszText;
+    ptParser->ulFrameLeft = ulSize;
+    ptParser->ucTextIdx = 0;
+    ptParser->ucTextEnc = TAG_ENC_UNKNOWN;
+    ptParser->ucTextBE = 0;
+    ptParser->ucTextHave = 0;
+    ptParser->ucTextSkip = (ucFlags & 0x01) ? 4 : 0;    // data length indicator
+    ptParser->ucUnsync = (ucFlags & 0x02) ? 1 : 0;
+    ptParser->ucLastFF = 0;
+    ptParser->ucState = TAG_STATE_TEXT;
+}
+
+/*!
+ * \brief append a Latin-1 character to the text, '\0' ends it
+ */
+static void TagPutChar(TTagParser *ptParser, u_char c)
+{
+    if (ptParser->ucTextIdx < TAG_TEXT_LEN - 1)
+    {
+        if (c == 0)
+        {
+            ptParser->ucTextIdx = TAG_TEXT_LEN - 1;     // done
+        }
+        else
+        {
+            ptParser->pszText[ptParser->ucTextIdx++] = c;
+            ptParser->pszText[ptParser->ucTextIdx] = 0;
+        }
+    }
+}
+
+/*!
+ * \brief decode one byte of a text frame to Latin-1
+ *
+ * Characters that do not fit in Latin-1 become '?'.
+ */
+static void TagPutText(TTagParser *ptParser, u_char c)
+{
+    u_char ucHigh;
+    u_char ucLow;
+
+    if (ptParser->ucTextSkip)
+    {
+        ptParser->ucTextSkip--;
+        return;
+    }
+    if (ptParser->ucUnsync)
+    {
+        if (ptParser->ucLastFF && (c == 0))
+        {
+            ptParser->ucLastFF = 0;
+            return;
+        }
+        ptParser->ucLastFF = (c == 0xFF);
+    }
+    if (ptParser->ucTextEnc == TAG_ENC_UNKNOWN)
+    {
+        ptParser->ucTextEnc = c;
+        ptParser->ucTextBE = (c == TAG_ENC_UTF16BE);
+        return;
+    }
+
+    switch (ptParser->ucTextEnc)
+    {
+        case TAG_ENC_UTF16:
+        case TAG_ENC_UTF16BE:
+            if (ptParser->ucTextHave == 0)
+            {
+                ptParser->ucTextPrev = c;
+                ptParser->ucTextHave = 1;
+                break;
+            }
+            ptParser->ucTextHave = 0;
+            if ((ptParser->ucTextPrev == 0xFE) && (c == 0xFF))
+            {
+                ptParser->ucTextBE = 1;                 // byte order mark
+                break;
+            }
+            if ((ptParser->ucTextPrev == 0xFF) && (c == 0xFE))
+            {
+                ptParser->ucTextBE = 0;
+                break;
+            }
+            ucHigh = ptParser->ucTextBE ? ptParser->ucTextPrev : c;
+            ucLow = ptParser->ucTextBE ? c : ptParser->ucTextPrev;
+            TagPutChar(ptParser, (ucHigh == 0) ? ucLow : '?');
+            break;
+
+        case TAG_ENC_UTF8:
+            if (c < 0x80)
+            {
+                TagPutChar(ptParser, c);
+            }
+            else if ((c & 0xC0) == 0xC0)
+            {
+                ptParser->ucTextPrev = c;               // lead byte
+                ptParser->ucTextHave = (c >= 0xF0) ? 3 : ((c >= 0xE0) ? 2 : 1);
+            }
+            else if ((ptParser->ucTextHave != 0) && (--ptParser->ucTextHave == 0))
+            {
+                TagPutChar(ptParser, ((ptParser->ucTextPrev & 0xFE) == 0xC2) ?
+                           (u_char)((ptParser->ucTextPrev << 6) | (c & 0x3F)) : '?');
+            }
+            break;
+
+        default:
+            TagPutChar(ptParser, c);
+            break;
+    }
+}
+
+/*!
+ * \brief start looking for tags at the start of a file or stream
+ *
+ * \param   ptParser parser state
+ * \param   ptInfo receives title and artist, NULL to skip tags only
+ */
+void TagParserInit(TTagParser *ptParser, TTagInfo *ptInfo)
+{
+    memset(ptParser, 0, sizeof(TTagParser));
+    ptParser->ptInfo = ptInfo;
+    ptParser->ucState = TAG_STATE_HEADER;
+    if (ptInfo != NULL)
+    {
+        ptInfo->szTitle[0] = 0;
+        ptInfo->szArtist[0] = 0;
+    }
+}
+
+/*!
+ * \brief pass the next chunk of a file or stream through the parser
+ *
+ * Tags are only recognised at the start of the data (possibly more than
+ * one), so the tag bytes always form the start of a chunk. The bytes of
+ * an incomplete or broken header are counted as tag bytes and dropped,
+ * at most 9 bytes.
+ *
+ * \param   ptParser parser state
+ * \param   pucData next chunk
+ * \param   usLen number of bytes in pucData
+ *
+ * \return  number of bytes at the start of pucData that are not audio
+ */
+u_short TagParserFeed(TTagParser *ptParser, CONST u_char *pucData, u_short usLen)
+{
+    u_short usPos = 0;
+    u_short usRun;
+    u_char c;
+
+    while ((usPos < usLen) && (ptParser->ucState != TAG_STATE_AUDIO))
+    {
+        if (ptParser->ucState == TAG_STATE_SKIP)
+        {
+            usRun = usLen - usPos;
+            if (ptParser->ulSkip < usRun)
+            {
+                usRun = (u_short)ptParser->ulSkip;
+            }
+            usPos += usRun;
+            TagParserSkipped(ptParser, usRun);
+            continue;
+        }
+
+        c = pucData[usPos++];
+
+        if (ptParser->ucState == TAG_STATE_HEADER)
+        {
+            ptParser->aucHdr[ptParser->ucCount++] = c;
+            if (TagHeaderValid(ptParser) == 0)
+            {
+                ptParser->ucState = TAG_STATE_AUDIO;
+                return(usPos - 1);
+            }
+            if (ptParser->ucCount == 10)
+            {
+                TagBeginTag(ptParser);
+            }
+            continue;
+        }
+
+        ptParser->ulTagLeft--;
+        switch (ptParser->ucState)
+        {
+            case TAG_STATE_EXTHDR:
+                ptParser->aucHdr[ptParser->ucCount++] = c;
+                if (ptParser->ucCount == 4)
+                {
+                    /*
+                     *  v2.3: size excludes these 4 bytes, v2.4: syncsafe and includes them
+                     */
+                    if (ptParser->ucVersion == 3)
+                    {
+                        TagSkipBytes(ptParser, ((u_long)ptParser->aucHdr[0] << 24) | ((u_long)ptParser->aucHdr[1] << 16) |
+                                               ((u_long)ptParser->aucHdr[2] << 8) | ptParser->aucHdr[3]);
+                    }
+                    else
+                    {
+                        u_long ulSize = ((u_long)(ptParser->aucHdr[0] & 0x7F) << 21) | ((u_long)(ptParser->aucHdr[1] & 0x7F) << 14) |
+                                        ((u_long)(ptParser->aucHdr[2] & 0x7F) << 7) | (ptParser->aucHdr[3] & 0x7F);
+
+                        TagSkipBytes(ptParser, (ulSize > 4) ? ulSize - 4 : 0);
+                    }
+                }
+                break;
+
+            case TAG_STATE_FRAMEHDR:
+                if ((ptParser->ucCount == 0) && (c == 0))
+                {
+                    TagSkipBytes(ptParser, ptParser->ulTagLeft);    // padding
+                    break;
+                }
+                ptParser->aucHdr[ptParser->ucCount++] = c;
+                if (ptParser->ucCount == ((ptParser->ucVersion == 2) ? 6 : 10))
+                {
+                    TagBeginFrame(ptParser);
+                }
+                break;
+
+            case TAG_STATE_TEXT:
+                TagPutText(ptParser, c);
+                if (--ptParser->ulFrameLeft == 0)
+                {
+                    TagNextInTag(ptParser);
+                }
+                break;
+        }
+    }
+
+    return(usPos);
+}
+
+/*!
+ * \brief return the number of bytes that can be skipped without parsing
+ *
+ * A file source may seek over these and report it with TagParserSkipped.
+ */
+u_long TagParserSkip(TTagParser *ptParser)
+{
+    return((ptParser->ucState == TAG_STATE_SKIP) ? ptParser->ulSkip : 0);
+}
+
+/*!
+ * \brief report bytes skipped, at most TagParserSkip() of them
+ */
+void TagParserSkipped(TTagParser *ptParser, u_long ulSkipped)
+{
+    if (ptParser->ucState == TAG_STATE_SKIP)
+    {
+        ptParser->ulSkip -= (ulSkipped < ptParser->ulSkip) ? ulSkipped : ptParser->ulSkip;
+        if (ptParser->ulSkip == 0)
+        {
+            TagNextInTag(ptParser);
+        }
+    }
+}
+
+/*!
+ * \brief return non-zero once the audio data has been reached
+ */
+u_char TagParserDone(TTagParser *ptParser)
+{
+    return(ptParser->ucState == TAG_STATE_AUDIO);
+}
+
+/*!
+ * \brief copy a 30 byte ID3v1 field, without the padding
+ */
+static void TagFieldV1(char *pszText, CONST u_char *pucField)
+{
+    u_char ucLen;
+
+    memcpy(pszText, pucField, 30);
+    pszText[30] = 0;
+    ucLen = strlen(pszText);
+    while ((ucLen > 0) && (pszText[ucLen - 1] == ' '))
+    {
+        pszText[--ucLen] = 0;
+    }
+}
+
+/*!
+ * \brief find the audio data of a file
+ *
+ * Leading ID3v2 tags are parsed, seeking over the frames that are not
+ * needed. At the end of the file an ID3v1 tag and an APEv2 tag (in that
+ * order from the end) are recognised, the ID3v1 title and artist fill
+ * in what the ID3v2 tag did not have.
+ *
+ * On return the file is positioned at *pulStart.
+ *
+ * \param   nFile file to scan
+ * \param   ulSize size of the file
+ * \param   ptInfo receives title and artist, may be NULL
+ * \param   pulStart receives the offset of the first audio byte
+ * \param   pulEnd receives the offset just past the last audio byte
+ *
+ * \return  0 on success, -1 on a read error
+ */
+int TagScanFile(int nFile, u_long ulSize, TTagInfo *ptInfo, u_long *pulStart, u_long *pulEnd)
+{
+    TTagParser tParser;
+    u_char aucBuf[TAG_SCAN_CHUNK];
+    u_long ulStart = 0;
+    u_long ulEnd = ulSize;
+    u_long ulSkip;
+    u_long ulApe;
+    u_short usTag;
+    int nRead;
+
+    TagParserInit(&tParser, ptInfo);
+    while ((ulStart < ulSize) && (TagParserDone(&tParser) == 0))
+    {
+        if ((ulSkip = TagParserSkip(&tParser)) > sizeof(aucBuf))
+        {
+            ulStart += ulSkip;
+            TagParserSkipped(&tParser, ulSkip);
+            if ((ulStart < ulSize) && (_seek(nFile, ulStart, SEEK_SET) < 0))
+            {
+                return(-1);
+            }
+            continue;
+        }
+        if ((nRead = _read(nFile, aucBuf, sizeof(aucBuf))) <= 0)
+        {
+            break;
+        }
+        usTag = TagParserFeed(&tParser, aucBuf, nRead);
+        ulStart += usTag;
+        if (usTag < (u_short)nRead)
+        {
+            break;
+        }
+    }
+    if (ulStart >= ulSize)
+    {
+        ulStart = 0;                                // broken tag, leave it to the decoder
+    }
+
+    /*
+     *  ID3v1: "TAG", title[30], artist[30], ... in the last 128 bytes
+     */
+    if ((ulEnd >= ulStart + 128) &&
+        (_seek(nFile, ulEnd - 128, SEEK_SET) >= 0) &&
+        (_read(nFile, aucBuf, 3) == 3) &&
+        (memcmp_P(aucBuf, PSTR("TAG"), 3) == 0))
+    {
+        ulEnd -= 128;
+        if ((ptInfo != NULL) && (_read(nFile, aucBuf, 30) == 30))
+        {
+            if (ptInfo->szTitle[0] == 0)
+            {
+                TagFieldV1(ptInfo->szTitle, aucBuf);
+            }
+            if ((ptInfo->szArtist[0] == 0) && (_read(nFile, aucBuf, 30) == 30))
+            {
+                TagFieldV1(ptInfo->szArtist, aucBuf);
+            }
+        }
+    }
+
+    /*
+     *  APEv2 footer: "APETAGEX", version, size (items + footer), count, flags
+     */
+    if ((ulEnd >= ulStart + 32) &&
+        (_seek(nFile, ulEnd - 32, SEEK_SET) >= 0) &&
+        (_read(nFile, aucBuf, 32) == 32) &&
+        (memcmp_P(aucBuf, PSTR("APETAGEX"), 8) == 0))
+    {
+        ulApe = ((u_long)aucBuf[15] << 24) | ((u_long)aucBuf[14] << 16) |
+                ((u_long)aucBuf[13] << 8) | aucBuf[12];
+        if (aucBuf[23] & 0x80)
+        {
+            ulApe += 32;                            // tag has a header too
+        }
+        if (ulApe <= ulEnd - ulStart)
+        {
+            ulEnd -= ulApe;
+        }
+    }
+
+    *pulStart = ulStart;
+    *pulEnd = ulEnd;
+
+    return((_seek(nFile, ulStart, SEEK_SET) < 0) ? -1 : 0);
+}
+
+/* ---------- end of module ------------------------------------------------ */
+
+/*@}*/
@@ -44,11 +44,16 @@
 #define LOG_MODULE  LOG_VS10XX_MODULE
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <io.h>
+#include <fcntl.h>
 
 #include <sys/atom.h>
 #include <sys/event.h>
 #include <sys/timer.h>
 #include <sys/heap.h>
+#include <sys/thread.h>
 
 #include <dev/irqreg.h>
 
@@ -66,6 +71,7 @@
 #include "portio.h"    // for debug purposes only
 #include "spidrv.h"    // for debug purposes only
 #include "watchdog.h"
+#include "flash.h"
 
 
 /*-------------------------------------------------------------------------*/
@@ -85,6 +91,72 @@
 #define VsDeselectVs()  SPIdeselect()
 #define VsSelectVs()    SPIselect(SPI_DEV_VS10XX)
 
+/*
+ *  Keep the patch that is compiled into the firmware as a fallback for
+ *  players without a plugin image in the dataflash or on the card.
+ *  Disable to save about 1.3 kB of program space
+ */
+#define VS_USE_BUILTIN_PATCH
+
+#define VS_PLUGIN_MAGIC     0x5350  /* 'PS' */
+#define VS_PLUGIN_CHUNK     32      /* words read from the source at a time */
+
+/* what is loaded in the decoder since its last reset */
+#define VS_PLUGIN_NONE      0
+#define VS_PLUGIN_BUILTIN   1
+#define VS_PLUGIN_IMAGE     2
+
+/* priority of the thread that writes queued registers (feeder is an ISR) */
+#define VS_CTRL_PRIORITY    50
+#define VS_CTRL_STACK       512     /* register flush, telemetry and LogMsg_P() */
+
+/* number of telemetry samples (one per second) kept */
+#define VS_TELEMETRY_SAMPLES    16
+
+/*
+ *  the decoder is considered hung when the decode time does not advance
+ *  for VS_HANG_SECONDS while at least VS_HANG_MIN_DATA bytes are waiting
+ *  in the segmented buffer
+ */
+#define VS_HANG_SECONDS         3
+#define VS_HANG_MIN_DATA        4096
+
+/*-------------------------------------------------------------------------*/
+/* typedefs & structs                                                      */
+/*-------------------------------------------------------------------------*/
+/*!
+ * \brief Header of a plugin image in the dataflash or in a file on the card.
+ *
+ * The header is followed by 'wWords' 16-bit words (little endian) in the
+ * VLSI compressed plugin format: records of (address, count, data). If
+ * bit 15 of count is set, the single data word that follows is written
+ * (count & 0x7FFF) times, otherwise count data words follow.
+ */
+typedef struct _VS_PLUGIN_HDR
+{
+    u_short wMagic;                 // VS_PLUGIN_MAGIC
+    u_char  bType;                  // decoder type (VS_VS1003, ...) this image is made for
+    u_char  bReserved;
+    u_short wWords;                 // number of words following this header
+    u_short wChecksum;              // 16-bit sum of all words following this header
+} TVsPluginHdr;
+
+/*!
+ * \brief Source of a plugin image while it is streamed into the decoder.
+ */
+typedef struct _VS_PLUGIN_SRC
+{
+    TVsPluginHdr tHdr;
+    int     iFid;                   // file on the card, -1 when reading from the dataflash
+    u_long  ulPage;                 // dataflash: first page of the image
+    u_long  ulPos;                  // dataflash: byte position relative to ulPage
+    u_short wLeft;                  // words not yet read from the source
+    u_short wSum;                   // running checksum
+    u_char  bCount;                 // words available in awBuffer
+    u_char  bIndex;                 // next word in awBuffer
+    u_short awBuffer[VS_PLUGIN_CHUNK];
+} TVsPluginSrc;
+
 
 /*-------------------------------------------------------------------------*/
 /* local variable definitions                                              */
@@ -93,13 +165,71 @@ static volatile u_char vs_status = VS_STATUS_STOPPED;
 static u_short g_vs_type;
 static u_char VsPlayMode;
 
+static u_char g_vs_plugin_state = VS_PLUGIN_NONE;
+static u_short g_vs_plugin_sum;
+
+/*
+ *  shadow copy of the decoder registers. For the registers in
+ *  VS_SHADOW_MASK it holds the last value written or queued, so these
+ *  can be read without an SCI transaction. Queued writes have their bit
+ *  set in g_vs_dirty until the VsCtrl thread has written them
+ */
+#define VS_SHADOW_MASK  ((1U << VS_MODE_REG)    | (1U << VS_BASS_REG)    | \
+                         (1U << VS_CLOCKF_REG)  | (1U << VS_VOL_REG)     | \
+                         (1U << VS_AICTRL0_REG) | (1U << VS_AICTRL1_REG) | \
+                         (1U << VS_AICTRL2_REG) | (1U << VS_AICTRL3_REG))
+
+static HANDLE hVsCtrlEvent;
+static HANDLE hVsKickMutex = SIGNALED;  // serialises VsPlayerKick() and VsRecover()
+static u_short g_vs_shadow[NROF_VS_REGS];
+static volatile u_short g_vs_dirty;
+
+/*
+ *  volume ramp (8.8 fixed point attenuation), updated by the mainbeat
+ */
+static u_short g_vs_vol_left;
+static u_short g_vs_vol_right;
+static short g_vs_vol_step_left;
+static short g_vs_vol_step_right;
+static u_char g_vs_vol_target_left;
+static u_char g_vs_vol_target_right;
+static volatile u_short g_vs_vol_ticks;
+
+/*
+ *  telemetry ring, g_vs_tm_head is the next entry to be written
+ */
+static TVsSample g_vs_tm_ring[VS_TELEMETRY_SAMPLES];
+static u_char g_vs_tm_head;
+static u_char g_vs_tm_count;
+static u_char g_vs_tm_ticks;
+static volatile u_char g_vs_tm_due;
+static u_char g_vs_dreq_ticks;      // mainbeats with DREQ high in the current second
+static u_char g_vs_dreq_duty;       // DREQ high in the last second (percent)
+
+/*
+ *  hang supervisor
+ */
+static u_short g_vs_hang_decode_time;
+static u_char g_vs_hang_secs;
+static u_short g_vs_recoveries;
+
+/* MPEG layer III bitrates in units of 8 kbps, [0] MPEG1, [1] MPEG2/2.5 */
+static prog_char g_vs_mp3_rate[2][15] =
+{
+    {0, 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40},
+    {0, 1, 2, 3, 4, 5,  6,  7,  8, 10, 12, 14, 16, 18, 20}
+};
+
 
 static void VsLoadProgramCode(void);
+static void VsTelemetrySample(void);
+static void VsSupervise(void);
 
 /*-------------------------------------------------------------------------*/
 /* local routines (prototyping)                                            */
 /*-------------------------------------------------------------------------*/
 
+#ifdef VS_USE_BUILTIN_PATCH
 #define CODE_SIZE 437
 static prog_char atab[CODE_SIZE] = { /* Register addresses */
     7, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
@@ -189,6 +319,7 @@ prog_int dtab[CODE_SIZE] = { /* Data to write */
     0x36f0, 0x5802, 0x3405, 0x9014, 0x36f3, 0x0024, 0x36f2, 0x1815,
     0x2000, 0x0000, 0x36f2, 0x9817, 0x0030
 };
+#endif /* VS_USE_BUILTIN_PATCH */
 
 /*!
  * \addtogroup VS1003B
@@ -208,6 +339,7 @@ prog_int dtab[CODE_SIZE] = { /* Data to write */
  */
 static void VsSdiWrite(CONST u_char * data, u_short len)
 {
+    SPIlock();
     VsSelectVs();
 
     while (len--)
@@ -217,6 +349,7 @@ static void VsSdiWrite(CONST u_char * data, u_short len)
     }
 
     VsDeselectVs();
+    SPIunlock();
     return;
 }
 
@@ -229,6 +362,7 @@ static void VsSdiWrite(CONST u_char * data, u_short len)
  */
 static void VsSdiWrite_P(PGM_P data, u_short len)
 {
+    SPIlock();
     VsSelectVs();
 
     while (len--)
@@ -238,22 +372,16 @@ static void VsSdiWrite_P(PGM_P data, u_short len)
     }
 
     VsDeselectVs();
+    SPIunlock();
     return;
 }
 
 
 /*!
- * \brief Write to a decoder register.
- *
- * Decoder interrupts must have been disabled before calling this function.
+ * \brief Single SCI write transaction at the current SPI speed.
  */
-void VsRegWrite(u_char reg, u_short data)
+static void VsSciWrite(u_char reg, u_short data)
 {
-    u_char spimode;
-
-    spimode = SPIgetmode();
-    SPImode(SPEED_SLOW);
-
     VsSelectVs();
 
     cbi(VS_XCS_PORT, VS_XCS_BIT);
@@ -266,12 +394,173 @@ void VsRegWrite(u_char reg, u_short data)
     sbi(VS_XCS_PORT, VS_XCS_BIT);
 
     VsDeselectVs();
+}
+
+/*!
+ * \brief Write to a decoder register.
+ *
+ * The shadow copy is updated and a queued write to the same register
+ * is dropped, as it holds an older value.
+ *
+ * Decoder interrupts must have been disabled before calling this function.
+ */
+void VsRegWrite(u_char reg, u_short data)
+{
+    u_char spimode;
+
+    NutEnterCritical();
+    /* software reset bit clears itself */
+    g_vs_shadow[reg] = (reg == VS_MODE_REG) ? (data & ~VS_SM_RESET) : data;
+    g_vs_dirty &= ~(1U << reg);
+    NutExitCritical();
+
+    SPIlock();
+    spimode = SPIgetmode();
+    SPImode(SPEED_SLOW);
+
+    VsSciWrite(reg, data);
 
     SPImode(spimode);
+    SPIunlock();
 
     return;
 }
 
+/*!
+ * \brief Queue a write to a decoder register.
+ *
+ * The write is done by the VsCtrl thread. When the same register is
+ * queued again before that, only the latest value is written.
+ */
+void VsRegQueue(u_char reg, u_short data)
+{
+    NutEnterCritical();
+    g_vs_shadow[reg] = data;
+    g_vs_dirty |= (1U << reg);
+    NutExitCritical();
+
+    NutEventPostAsync(&hVsCtrlEvent);
+}
+
+/*!
+ * \brief Write all queued registers in one go.
+ *
+ * The SPI speed is changed once for the whole batch instead of for
+ * each register.
+ */
+static void VsRegFlush(void)
+{
+    u_char ief;
+    u_char spimode;
+    u_char reg;
+    u_short dirty;
+    u_short data;
+
+    ief = VsPlayerInterrupts(0);
+
+    SPIlock();
+    spimode = SPIgetmode();
+    SPImode(SPEED_SLOW);
+
+    for (;;)
+    {
+        NutEnterCritical();
+        dirty = g_vs_dirty;
+        g_vs_dirty = 0;
+        NutExitCritical();
+
+        if (dirty == 0)
+        {
+            break;
+        }
+
+        for (reg = 0; reg < NROF_VS_REGS; reg++)
+        {
+            if (dirty & (1U << reg))
+            {
+                NutEnterCritical();
+                data = g_vs_shadow[reg];
+                NutExitCritical();
+                VsSciWrite(reg, data);
+            }
+        }
+    }
+
+    SPImode(spimode);
+    SPIunlock();
+
+    VsPlayerInterrupts(ief);
+}
+
+/*!
+ * \brief The VsCtrl thread.
+ *
+ * Writes queued registers when signalled by VsRegQueue() or VsMainBeat()
+ * and takes a telemetry sample once per second, which is also used to
+ * detect a hung decoder.
+ */
+THREAD(VsCtrl, pArg)
+{
+    NutThreadSetPriority(VS_CTRL_PRIORITY);
+
+    for (;;)
+    {
+        NutEventWait(&hVsCtrlEvent, NUT_WAIT_INFINITE);
+        VsRegFlush();
+
+        if (g_vs_tm_due)
+        {
+            g_vs_tm_due = 0;
+            VsTelemetrySample();
+            VsSupervise();
+        }
+    }
+}
+
+/*!
+ * \brief Advance the volume ramp.
+ *
+ * Called from the mainbeat interrupt (every 4.44 msecs). Queues the new
+ * attenuation and wakes up the VsCtrl thread when something is pending
+ * or a telemetry sample is due.
+ */
+void VsMainBeat(void)
+{
+    if (g_vs_vol_ticks != 0)
+    {
+        if (--g_vs_vol_ticks == 0)
+        {
+            g_vs_vol_left = (u_short)g_vs_vol_target_left << 8;
+            g_vs_vol_right = (u_short)g_vs_vol_target_right << 8;
+        }
+        else
+        {
+            g_vs_vol_left += g_vs_vol_step_left;
+            g_vs_vol_right += g_vs_vol_step_right;
+        }
+        g_vs_shadow[VS_VOL_REG] = (g_vs_vol_left & 0xFF00) | (g_vs_vol_right >> 8);
+        g_vs_dirty |= (1U << VS_VOL_REG);
+    }
+
+    if (bit_is_set(VS_DREQ_PIN, VS_DREQ_BIT))
+    {
+        g_vs_dreq_ticks++;
+    }
+
+    if (++g_vs_tm_ticks >= ONE_SECOND)
+    {
+        g_vs_dreq_duty = (u_char)(((u_short)g_vs_dreq_ticks * 100) / ONE_SECOND);
+        g_vs_dreq_ticks = 0;
+        g_vs_tm_ticks = 0;
+        g_vs_tm_due = 1;
+    }
+
+    if (g_vs_dirty || g_vs_tm_due)
+    {
+        NutEventPostFromIrq(&hVsCtrlEvent);
+    }
+}
+
 /*!
  * \brief determine if the stream is valid. If true, returns value; if false returns 0
  *
@@ -328,6 +617,7 @@ static u_short VsRegRead(u_char reg)
     u_short data;
     u_char spimode;
 
+    SPIlock();
     spimode = SPIgetmode();
     SPImode(SPEED_SLOW);
 
@@ -345,6 +635,7 @@ static u_short VsRegRead(u_char reg)
 
     VsDeselectVs();
     SPImode(spimode);
+    SPIunlock();
 
     return(data);
 }
@@ -352,12 +643,22 @@ static u_short VsRegRead(u_char reg)
 /*!
  * \brief read data from a specified register from the VS10XX
  *
+ * Writable registers (see VS_SHADOW_MASK) are returned from the shadow
+ * copy, only the others need an SCI read with decoder interrupts off.
  */
 u_short VsRegInfo(u_char reg)
 {
     u_char ief;
     u_short value;
 
+    if (VS_SHADOW_MASK & (1U << reg))
+    {
+        NutEnterCritical();
+        value = g_vs_shadow[reg];
+        NutExitCritical();
+        return(value);
+    }
+
     ief = VsPlayerInterrupts(0);
     value = VsRegRead(reg);
     VsPlayerInterrupts(ief);
@@ -365,6 +666,246 @@ u_short VsRegInfo(u_char reg)
     return(value);
 }
 
+/*!
+ * \brief Reload the shadow copy from the decoder.
+ *
+ * Registers with a queued write are skipped, the queued value is newer.
+ *
+ * Decoder interrupts must have been disabled before calling this function.
+ */
+static void VsShadowSync(void)
+{
+    u_char reg;
+    u_short value;
+
+    for (reg = 0; reg < NROF_VS_REGS; reg++)
+    {
+        if (VS_SHADOW_MASK & (1U << reg))
+        {
+            value = VsRegRead(reg);
+            NutEnterCritical();
+            if ((g_vs_dirty & (1U << reg)) == 0)
+            {
+                g_vs_shadow[reg] = value;
+            }
+            NutExitCritical();
+        }
+    }
+}
+
+/*!
+ * \brief Take a telemetry sample.
+ *
+ * The registers are read in one go with decoder interrupts disabled.
+ */
+static void VsTelemetrySample(void)
+{
+    TVsSample *ptSample;
+    u_char ief;
+    u_short wHdat0;
+    u_short wAudata;
+
+    ptSample = &g_vs_tm_ring[g_vs_tm_head];
+
+    ief = VsPlayerInterrupts(0);
+    ptSample->wDecodeTime = VsRegRead(VS_DECODE_TIME_REG);
+    wHdat0 = VsRegRead(VS_HDAT0_REG);
+    ptSample->wFormat = VsRegRead(VS_HDAT1_REG);
+    wAudata = VsRegRead(VS_AUDATA_REG);
+    VsPlayerInterrupts(ief);
+
+    ptSample->ulWallTime = NutGetSeconds();
+    ptSample->wSampleRate = wAudata & 0xFFFE;
+    ptSample->bChannels = (wAudata & 1) + 1;
+    ptSample->bStatus = vs_status;
+    ptSample->bDreqDuty = g_vs_dreq_duty;
+
+    if (ptSample->wFormat >= 0xFFE0)
+    {
+        /* MPEG audio, HDAT1 bit 3 clear for MPEG2/2.5 */
+        ptSample->wBitrate = 8 * PRG_RDB(&g_vs_mp3_rate[(ptSample->wFormat & 0x0008) ? 0 : 1][(wHdat0 >> 12) % 15]);
+    }
+    else
+    {
+        /* other formats report the byte rate */
+        ptSample->wBitrate = (u_short)(((u_long)wHdat0 * 8) / 1000);
+    }
+
+    g_vs_tm_head = (g_vs_tm_head + 1) % VS_TELEMETRY_SAMPLES;
+    if (g_vs_tm_count < VS_TELEMETRY_SAMPLES)
+    {
+        g_vs_tm_count++;
+    }
+}
+
+/*!
+ * \brief Get a telemetry sample.
+ *
+ * \param bIndex    0 for the latest sample, 1 for the one before, etc.
+ * \param ptSample  filled in with the sample
+ *
+ * \return 0 on success, -1 when no such sample exists.
+ */
+int VsTelemetryGet(u_char bIndex, TVsSample *ptSample)
+{
+    if (bIndex >= g_vs_tm_count)
+    {
+        return(-1);
+    }
+    *ptSample = g_vs_tm_ring[(g_vs_tm_head + VS_TELEMETRY_SAMPLES - 1 - bIndex) % VS_TELEMETRY_SAMPLES];
+
+    return(0);
+}
+
+/*!
+ * \brief Compare decode time with wall time over the samples available.
+ *
+ * A decoder that plays at the right rate returns about 0. A large
+ * negative value means it runs slow or has stalled, a positive value
+ * means it plays too fast (e.g. wrong sample rate).
+ *
+ * \return decoded seconds minus wall clock seconds.
+ */
+int VsTelemetryDrift(void)
+{
+    TVsSample *ptOld;
+    TVsSample *ptNew;
+
+    if (g_vs_tm_count < 2)
+    {
+        return(0);
+    }
+    ptNew = &g_vs_tm_ring[(g_vs_tm_head + VS_TELEMETRY_SAMPLES - 1) % VS_TELEMETRY_SAMPLES];
+    ptOld = &g_vs_tm_ring[(g_vs_tm_head + VS_TELEMETRY_SAMPLES - g_vs_tm_count) % VS_TELEMETRY_SAMPLES];
+
+    return((int)(ptNew->wDecodeTime - ptOld->wDecodeTime) - (int)(ptNew->ulWallTime - ptOld->ulWallTime));
+}
+
+/*!
+ * \brief Write the telemetry samples to the log, oldest first.
+ */
+void VsTelemetryDump(void)
+{
+    TVsSample tSample;
+    u_char bIndex;
+
+    LogMsg_P(LOG_INFO, PSTR("time   dec  fmt  kbps  Hz    ch st dreq"));
+    for (bIndex = g_vs_tm_count; bIndex-- > 0; )
+    {
+        VsTelemetryGet(bIndex, &tSample);
+        LogMsg_P(LOG_INFO, PSTR("%6lu %5u %04X %4u %5u %u  %u  %3u%%"),
+                 tSample.ulWallTime, tSample.wDecodeTime, tSample.wFormat,
+                 tSample.wBitrate, tSample.wSampleRate, tSample.bChannels, tSample.bStatus,
+                 tSample.bDreqDuty);
+    }
+    LogMsg_P(LOG_INFO, PSTR("drift %d s, %u recoveries"), VsTelemetryDrift(), g_vs_recoveries);
+}
+
+/*!
+ * \brief Soft reset the decoder and restore its registers.
+ *
+ * The registers are restored from the shadow copy. The reset also clears
+ * the patch memory. Decoder interrupts must have been disabled before
+ * calling this function.
+ */
+static void VsSoftReset(void)
+{
+    u_char reg;
+    u_short wTimeout;
+
+    VsRegWrite(VS_MODE_REG, g_vs_shadow[VS_MODE_REG] | VS_SM_RESET);
+    NutDelay(2);
+    for (wTimeout = 100; wTimeout && bit_is_clear(VS_DREQ_PIN, VS_DREQ_BIT); wTimeout--)
+    {
+        NutDelay(1);
+    }
+
+    /* clock first, the other registers may be written in any order */
+    VsRegWrite(VS_CLOCKF_REG, g_vs_shadow[VS_CLOCKF_REG]);
+    for (reg = 0; reg < NROF_VS_REGS; reg++)
+    {
+        if ((VS_SHADOW_MASK & (1U << reg)) && reg != VS_CLOCKF_REG && reg != VS_MODE_REG)
+        {
+            VsRegWrite(reg, g_vs_shadow[reg]);
+        }
+    }
+
+    g_vs_plugin_state = VS_PLUGIN_NONE;
+}
+
+/*!
+ * \brief Soft reset a hung decoder.
+ *
+ * The registers are restored from the shadow copy and the decoder is
+ * left stopped. The producer (player or card thread) sees that and calls
+ * VsPlayerKick(), which reloads the patch on its own (larger) stack and
+ * resumes feeding at the current position of the segmented buffer. So
+ * the stream itself (and its network connection) is not touched.
+ */
+static void VsRecover(void)
+{
+    NutEventWait(&hVsKickMutex, 0);
+    if (vs_status != VS_STATUS_RUNNING)
+    {
+        /* stopped or restarted by a producer in the meantime */
+        NutEventPost(&hVsKickMutex);
+        return;
+    }
+
+    VsPlayerInterrupts(0);
+    vs_status = VS_STATUS_STOPPED;
+
+    VsSoftReset();
+    g_vs_tm_count = 0;
+
+    outp(BV(VS_DREQ_BIT), EIFR);
+
+    NutEventPost(&hVsKickMutex);
+}
+
+/*!
+ * \brief Check decoder progress, called once per second.
+ *
+ * While playing with enough data buffered the decode time must advance.
+ * If it does not for VS_HANG_SECONDS (DREQ stuck low, or the feeder
+ * not being triggered anymore), the decoder is recovered.
+ */
+static void VsSupervise(void)
+{
+    TVsSample tSample;
+
+    if (vs_status != VS_STATUS_RUNNING ||
+        NutSegBufUsed() < VS_HANG_MIN_DATA ||
+        VsTelemetryGet(0, &tSample) != 0)
+    {
+        g_vs_hang_secs = 0;
+        return;
+    }
+
+    if (tSample.wDecodeTime != g_vs_hang_decode_time)
+    {
+        g_vs_hang_decode_time = tSample.wDecodeTime;
+        g_vs_hang_secs = 0;
+        return;
+    }
+
+    if (++g_vs_hang_secs >= VS_HANG_SECONDS)
+    {
+        LogMsg_P(LOG_WARNING, PSTR("decoder hung (DREQ %u%%), reset"), tSample.bDreqDuty);
+        g_vs_hang_secs = 0;
+        g_vs_recoveries++;
+        VsRecover();
+    }
+}
+
+/*!
+ * \brief Return the number of times a hung decoder was recovered.
+ */
+u_short VsGetRecoveryCount(void)
+{
+    return(g_vs_recoveries);
+}
+
 
 /*!
  * \brief Enable or disable player interrupts.
@@ -495,6 +1036,8 @@ static void VsPlayerFeed(void *arg)
  */
 int VsPlayerKick(void)
 {
+    NutEventWait(&hVsKickMutex, 0);
+
     /*
      * Start feeding the decoder with data.
      */
@@ -514,10 +1057,14 @@ int VsPlayerKick(void)
 //        LogMsg_P(LOG_DEBUG,PSTR("Kick: CLOCKF = [0x%02X]"),VsRegRead(VS_CLOCKF_REG));
 
         VsLoadProgramCode();
+        SPIlock();
         vs_status = VS_STATUS_RUNNING;
         VsPlayerFeed(NULL);
+        SPIunlock();
         VsPlayerInterrupts(1);
     }
+
+    NutEventPost(&hVsKickMutex);
     return(0);
 }
 
@@ -577,6 +1124,13 @@ int VsPlayerInit(void)
     SPImode(SPEED_SLOW);
 
     vs_status = VS_STATUS_STOPPED;
+    g_vs_plugin_state = VS_PLUGIN_NONE;
+
+    /* after a hardware reset all registers are back at their defaults */
+    NutEnterCritical();
+    g_vs_dirty = 0;
+    NutExitCritical();
+    memset(g_vs_shadow, 0, sizeof(g_vs_shadow));
 
     /* Release decoder reset line. */
     sbi(VS_RESET_PORT, VS_RESET_BIT);
@@ -610,7 +1164,12 @@ int VsPlayerInit(void)
 
     // Datasheet requires 2 write instructions before speeding up SPI interface
     VsPlayerSetMode(0);
-    VsSetVolume(0,0);
+
+    NutEnterCritical();
+    g_vs_vol_ticks = 0;
+    NutExitCritical();
+    g_vs_vol_left = g_vs_vol_right = 0;
+    VsRegWrite(VS_VOL_REG, 0);
 
     NutDelay(50);
 
@@ -640,6 +1199,15 @@ int VsPlayerInit(void)
     /* Clear any spurious interrupt. */
     outp(BV(VS_DREQ_BIT), EIFR);
 
+    /* Create the thread that writes queued registers */
+    if (GetThreadByName("VsCtrl") == NULL)
+    {
+        if (NutThreadCreate("VsCtrl", VsCtrl, 0, VS_CTRL_STACK) == 0)
+        {
+            LogMsg_P(LOG_EMERG, PSTR("Thread failed"));
+        }
+    }
+
     return(0);
 }
 
@@ -668,6 +1236,15 @@ int VsPlayerReset(u_short mode)
     VsPlayerSetMode(VS_SM_RESET | mode);
     NutDelay(10);
 
+    /* a reset clears the patch memory */
+    g_vs_plugin_state = VS_PLUGIN_NONE;
+
+    /* registers may have been changed by the reset */
+    VsShadowSync();
+
+    /* decode time starts again at 0, drop the old samples */
+    g_vs_tm_count = 0;
+
     /* Clear any spurious interrupts. */
     outp(BV(VS_DREQ_BIT), EIFR);
 
@@ -779,6 +1356,10 @@ u_short VsMemoryTest(void)
 /*!
  * \brief Set volume.
  *
+ * Stops a running fade. The register write is queued, so calling this
+ * routine many times in a row (e.g. while a key is held) only results
+ * in one write per mainbeat.
+ *
  * \param left  Left channel volume.
  * \param right Right channel volume.
  *
@@ -786,17 +1367,61 @@ u_short VsMemoryTest(void)
  */
 int VsSetVolume(u_char left, u_char right)
 {
-    u_char ief;
+    NutEnterCritical();
+    g_vs_vol_ticks = 0;
+    g_vs_vol_left = (u_short)left << 8;
+    g_vs_vol_right = (u_short)right << 8;
+    NutExitCritical();
 
-    ief = VsPlayerInterrupts(0);
+    VsRegQueue(VS_VOL_REG, (((u_short) left) << 8) | (u_short) right);
 
-    VsRegWrite(VS_VOL_REG, (((u_short) left) << 8) | (u_short) right);
+    return(0);
+}
 
-    VsPlayerInterrupts(ief);
+/*!
+ * \brief Ramp the volume to a new value.
+ *
+ * The attenuation is changed in small steps on each mainbeat, which
+ * avoids the clicks of a single large step (mute, station change,
+ * alarm wake-up).
+ *
+ * \param left  Left channel target volume.
+ * \param right Right channel target volume.
+ * \param ms    Duration of the fade in msecs, 0 sets the volume at once.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+int VsVolumeFade(u_char left, u_char right, u_short ms)
+{
+    u_short ticks;
+
+    ticks = (u_short)(((u_long)ms * ONE_SECOND) / 1000);
+    if (ticks == 0)
+    {
+        return(VsSetVolume(left, right));
+    }
+
+    NutEnterCritical();
+    g_vs_vol_target_left = left;
+    g_vs_vol_target_right = right;
+    g_vs_vol_step_left = (short)((((long)left << 8) - (long)g_vs_vol_left) / ticks);
+    g_vs_vol_step_right = (short)((((long)right << 8) - (long)g_vs_vol_right) / ticks);
+    g_vs_vol_ticks = ticks;
+    NutExitCritical();
 
     return(0);
 }
 
+/*!
+ * \brief Check if a volume fade is in progress.
+ *
+ * \return 1 while fading, 0 otherwise.
+ */
+u_char VsVolumeFading(void)
+{
+    return(g_vs_vol_ticks != 0);
+}
+
 
 /*!
  * \brief Get volume.
@@ -805,12 +1430,7 @@ int VsSetVolume(u_char left, u_char right)
  */
 u_short VsGetVolume()
 {
-    u_char ief;
-    u_short vol;
-    ief = VsPlayerInterrupts(0);
-    vol=VsRegRead(VS_VOL_REG);
-    VsPlayerInterrupts(ief);
-    return(vol);
+    return(VsRegInfo(VS_VOL_REG));
 }
 
 /*!
@@ -948,18 +1568,390 @@ int VsBeepStop()
     return(0);
 }
 
+/*!
+ * \brief Write a number of words to the same decoder register.
+ *
+ * When 'fill' is non-zero, data[0] is written 'len' times, otherwise
+ * 'len' consecutive words are taken from 'data'. On chips that support
+ * it, XCS is kept active for the whole burst so only the first word
+ * carries the opcode and address. Older chips get one transaction per word.
+ *
+ * Decoder interrupts must have been disabled before calling this function.
+ */
+static void VsRegWriteBurst(u_char reg, CONST u_short *data, u_short len, u_char fill)
+{
+    u_char spimode;
+    u_short value;
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    if (g_vs_type != VS_VS1053 && g_vs_type != VS_VS1033)
+    {
+        while (len--)
+        {
+            VsRegWrite(reg, *data);
+            if (!fill)
+            {
+                data++;
+            }
+        }
+        return;
+    }
+
+    SPIlock();
+    spimode = SPIgetmode();
+    SPImode(SPEED_SLOW);
+
+    VsSelectVs();
+
+    cbi(VS_XCS_PORT, VS_XCS_BIT);
+
+    SPIputByte(VS_OPCODE_WRITE);
+    SPIputByte(reg);
+
+    while (len--)
+    {
+        value = *data;
+        if (!fill)
+        {
+            data++;
+        }
+
+        /* decoder lowers DREQ while it processes each word */
+        while (bit_is_clear(VS_DREQ_PIN, VS_DREQ_BIT))
+            ;
+
+        SPIputByte((u_char) (value >> 8));
+        SPIputByte((u_char) value);
+    }
+
+    sbi(VS_XCS_PORT, VS_XCS_BIT);
+
+    VsDeselectVs();
+
+    SPImode(spimode);
+    SPIunlock();
+}
+
+/*!
+ * \brief Read the next chunk of a plugin image.
+ *
+ * Data is read from the dataflash or the card in chunks of
+ * VS_PLUGIN_CHUNK words. The watchdog is restarted on each refill.
+ *
+ * \return 0 on success, -1 when the image is truncated.
+ */
+static int VsPluginFill(TVsPluginSrc *ptSrc)
+{
+    u_short wPageSize;
+    u_short wLen;
+
+    if (ptSrc->wLeft == 0)
+    {
+        return(-1);
+    }
+    wLen = (ptSrc->wLeft > VS_PLUGIN_CHUNK) ? VS_PLUGIN_CHUNK : ptSrc->wLeft;
+
+    if (ptSrc->iFid >= 0)
+    {
+        if (_read(ptSrc->iFid, ptSrc->awBuffer, wLen * 2) != (int)(wLen * 2))
+        {
+            return(-1);
+        }
+    }
+    else
+    {
+        wPageSize = At45dbPageSize();
+        if (At45dbRead(ptSrc->ulPage + ptSrc->ulPos / wPageSize, ptSrc->ulPos % wPageSize,
+                       ptSrc->awBuffer, wLen * 2) != 0)
+        {
+            return(-1);
+        }
+        ptSrc->ulPos += wLen * 2;
+    }
+    ptSrc->wLeft -= wLen;
+    ptSrc->bCount = wLen;
+    ptSrc->bIndex = 0;
+
+    WatchDogRestart();
+
+    return(0);
+}
+
+/*!
+ * \brief Get the next word of a plugin image.
+ *
+ * \return 0 on success, -1 when the image is truncated.
+ */
+static int VsPluginGet(TVsPluginSrc *ptSrc, u_short *pwData)
+{
+    if (ptSrc->bIndex >= ptSrc->bCount && VsPluginFill(ptSrc) != 0)
+    {
+        return(-1);
+    }
+
+    *pwData = ptSrc->awBuffer[ptSrc->bIndex++];
+    ptSrc->wSum += *pwData;
+
+    return(0);
+}
+
+/*!
+ * \brief Find the plugin image for the fitted decoder in the dataflash.
+ *
+ * Images are stored back to back starting at FLASH_PLUGIN_PAGE, each one
+ * starting on a page boundary. The scan stops at the first page that does
+ * not hold a valid header.
+ *
+ * \return 0 when found, -1 otherwise.
+ */
+static int VsPluginOpenFlash(TVsPluginSrc *ptSrc)
+{
+    u_short wPageSize;
+    u_long ulPage;
+    u_long ulSize;
+
+    wPageSize = At45dbPageSize();
+    if (wPageSize == 0)
+    {
+        return(-1);
+    }
+
+    for (ulPage = FLASH_PLUGIN_PAGE; ulPage < FLASH_PLUGIN_PAGE + FLASH_PLUGIN_NROF_PAGES; )
+    {
+        if ((At45dbRead(ulPage, 0, &ptSrc->tHdr, sizeof(TVsPluginHdr)) != 0) ||
+            (ptSrc->tHdr.wMagic != VS_PLUGIN_MAGIC))
+        {
+            break;
+        }
+        if (ptSrc->tHdr.bType == g_vs_type)
+        {
+            ptSrc->iFid = -1;
+            ptSrc->ulPage = ulPage;
+            ptSrc->ulPos = sizeof(TVsPluginHdr);
+            return(0);
+        }
+        ulSize = sizeof(TVsPluginHdr) + (u_long)ptSrc->tHdr.wWords * 2;
+        ulPage += (ulSize + wPageSize - 1) / wPageSize;
+    }
+    return(-1);
+}
+
+/*!
+ * \brief Open the plugin image for the fitted decoder on the card.
+ *
+ * The name is derived from the chip type, e.g. FM0:VS1053.PLG
+ *
+ * \return 0 when found, -1 otherwise.
+ */
+static int VsPluginOpenFile(TVsPluginSrc *ptSrc)
+{
+    static prog_int awChipNr[] = {0x1001, 0x1011, 0x1011, 0x1003, 0x1053, 0x1033};
+    char szName[16];
+
+    if (g_vs_type >= sizeof(awChipNr) / sizeof(awChipNr[0]))
+    {
+        return(-1);
+    }
+    sprintf_P(szName, PSTR("FM0:VS%04X.PLG"), PRG_RDW(&awChipNr[g_vs_type]));
+
+    ptSrc->iFid = _open(szName, _O_RDONLY | _O_BINARY);
+    if (ptSrc->iFid == -1)
+    {
+        return(-1);
+    }
+    if ((_read(ptSrc->iFid, &ptSrc->tHdr, sizeof(TVsPluginHdr)) == sizeof(TVsPluginHdr)) &&
+        (ptSrc->tHdr.wMagic == VS_PLUGIN_MAGIC) && (ptSrc->tHdr.bType == g_vs_type))
+    {
+        return(0);
+    }
+    _close(ptSrc->iFid);
+    ptSrc->iFid = -1;
+    return(-1);
+}
+
+/*!
+ * \brief Check the checksum of a plugin image without touching the decoder.
+ *
+ * The whole image is read once, then the source is positioned back at its
+ * first word for VsPluginLoad().
+ *
+ * \return 0 when the image is complete and its checksum matches, -1 otherwise.
+ */
+static int VsPluginVerify(TVsPluginSrc *ptSrc)
+{
+    ptSrc->wLeft = ptSrc->tHdr.wWords;
+    ptSrc->wSum = 0;
+
+    while (ptSrc->wLeft != 0)
+    {
+        if (VsPluginFill(ptSrc) != 0)
+        {
+            return(-1);
+        }
+        while (ptSrc->bIndex < ptSrc->bCount)
+        {
+            ptSrc->wSum += ptSrc->awBuffer[ptSrc->bIndex++];
+        }
+    }
+    if (ptSrc->wSum != ptSrc->tHdr.wChecksum)
+    {
+        return(-1);
+    }
+
+    if (ptSrc->iFid >= 0)
+    {
+        if (_seek(ptSrc->iFid, sizeof(TVsPluginHdr), SEEK_SET) < 0)
+        {
+            return(-1);
+        }
+    }
+    else
+    {
+        ptSrc->ulPos = sizeof(TVsPluginHdr);
+    }
+    return(0);
+}
+
+/*!
+ * \brief Stream a compressed plugin image into the decoder.
+ *
+ * The image should have passed VsPluginVerify(), so a failure here means
+ * the source could not be read a second time.
+ *
+ * \return 0 on success, -1 on a truncated or corrupt image.
+ */
+static int VsPluginLoad(TVsPluginSrc *ptSrc)
+{
+    u_short wAddr;
+    u_short wCount;
+    u_short wData;
+    u_short wLen;
+
+    ptSrc->wLeft = ptSrc->tHdr.wWords;
+    ptSrc->wSum = 0;
+    ptSrc->bCount = 0;
+    ptSrc->bIndex = 0;
+
+    while (ptSrc->wLeft != 0 || ptSrc->bIndex < ptSrc->bCount)
+    {
+        if (VsPluginGet(ptSrc, &wAddr) || VsPluginGet(ptSrc, &wCount) || wAddr >= NROF_VS_REGS)
+        {
+            return(-1);
+        }
+        if (wCount & 0x8000)
+        {
+            /* run of one value */
+            if (VsPluginGet(ptSrc, &wData))
+            {
+                return(-1);
+            }
+            VsRegWriteBurst(wAddr, &wData, wCount & 0x7FFF, 1);
+        }
+        else
+        {
+            /* copy as many words as are buffered in one burst */
+            while (wCount)
+            {
+                if (ptSrc->bIndex >= ptSrc->bCount && VsPluginFill(ptSrc) != 0)
+                {
+                    return(-1);
+                }
+                wLen = ptSrc->bCount - ptSrc->bIndex;
+                if (wLen > wCount)
+                {
+                    wLen = wCount;
+                }
+                VsRegWriteBurst(wAddr, &ptSrc->awBuffer[ptSrc->bIndex], wLen, 0);
+                while (wLen--)
+                {
+                    ptSrc->wSum += ptSrc->awBuffer[ptSrc->bIndex++];
+                    wCount--;
+                }
+            }
+        }
+    }
+
+    return((ptSrc->wSum == ptSrc->tHdr.wChecksum) ? 0 : -1);
+}
+
+/*!
+ * \brief Load the patch/plugin for the fitted decoder.
+ *
+ * An image in the dataflash takes precedence over one on the card. The
+ * checksum of the loaded image is remembered, so nothing is sent when the
+ * same image is still active in the decoder (the cache is cleared on each
+ * decoder reset). An image is verified before anything is sent, and the
+ * decoder is reset when loading still fails halfway. Without a (valid)
+ * image the built-in patch is used when available.
+ *
+ * Decoder interrupts must have been disabled before calling this function.
+ */
 static void VsLoadProgramCode(void)
 {
-    int i;
+    TVsPluginSrc *ptSrc;
+    int iResult = -1;
+
+    ptSrc = NutHeapAlloc(sizeof(TVsPluginSrc));
+    if (ptSrc != NULL)
+    {
+        if (VsPluginOpenFlash(ptSrc) == 0 || VsPluginOpenFile(ptSrc) == 0)
+        {
+            if (g_vs_plugin_state == VS_PLUGIN_IMAGE && g_vs_plugin_sum == ptSrc->tHdr.wChecksum)
+            {
+                iResult = 0;
+            }
+            else if (VsPluginVerify(ptSrc) != 0)
+            {
+                LogMsg_P(LOG_ERR, PSTR("plugin image corrupt"));
+                g_vs_plugin_state = VS_PLUGIN_NONE;
+            }
+            else
+            {
+                iResult = VsPluginLoad(ptSrc);
+                if (iResult == 0)
+                {
+                    g_vs_plugin_state = VS_PLUGIN_IMAGE;
+                    g_vs_plugin_sum = ptSrc->tHdr.wChecksum;
+                }
+                else
+                {
+                    /* part of the image is in the decoder, get rid of it */
+                    LogMsg_P(LOG_ERR, PSTR("plugin load failed, reset"));
+                    VsSoftReset();
+                }
+            }
+            if (ptSrc->iFid >= 0)
+            {
+                _close(ptSrc->iFid);
+            }
+        }
+        NutHeapFree(ptSrc);
+    }
 
-    for (i=0;i<CODE_SIZE;i++)
+    if (iResult == 0 || g_vs_plugin_state == VS_PLUGIN_BUILTIN)
     {
-        VsRegWrite(PRG_RDB(&atab[i]), PRG_RDW(&dtab[i]));
-        // kick watchdog on a regular base
-        if(i%500==0)
+        return;
+    }
+
+#ifdef VS_USE_BUILTIN_PATCH
+    {
+        int i;
+
+        for (i=0;i<CODE_SIZE;i++)
         {
-            WatchDogRestart();
+            VsRegWrite(PRG_RDB(&atab[i]), PRG_RDW(&dtab[i]));
+            // kick watchdog on a regular base
+            if(i%500==0)
+            {
+                WatchDogRestart();
+            }
         }
+        g_vs_plugin_state = VS_PLUGIN_BUILTIN;
     }
+#endif /* VS_USE_BUILTIN_PATCH */
 }
 /*@}*/
@@ -0,0 +1,414 @@
+/*
+ * fatbench - count the card sectors fat.c reads and writes, on a host
+ *
+ * fat.c is built against imgdrv.c, which takes the sectors from an image
+ * of a card and counts them. The benchmarks below report how many sectors
+ * it takes to
+ *
+ *  - mount the volume and walk its directory tree
+ *  - read a file from start to end (per MB of file data)
+ *  - open a file, for the directory depths found on the image
+ *  - seek in a file and read the sector there
+ *
+ * and with -w, which changes the image, to
+ *
+ *  - write a file from start to end (per MB), the data is read back
+ *  - create a file in the root directory
+ *
+ * Usage: fatbench [-w] <image> [file]
+ *
+ * The image must hold a partition table, as a card does. Without a file
+ * argument the largest file found is used for the read and seek tests.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/device.h>
+#include <fs/fs.h>
+
+#include "fat.h"
+
+#define MAX_DEPTH       8
+#define MAX_PATH        256
+#define READ_SIZE       4096            /* bytes per read in the sequential test */
+#define SEEK_COUNT      256
+#define SEEK_READ       512             /* bytes read after each seek */
+#define OPEN_REPEAT     16
+#define WRITE_TOTAL     1048576L        /* bytes written in the sequential test */
+#define WRITE_FILE      "/FATBENCH.DAT"
+#define CREATE_COUNT    16
+
+/*
+ * One file per directory depth, plus the largest file seen
+ */
+static char szDepthPath[MAX_DEPTH + 1][MAX_PATH];
+static char szLargest[MAX_PATH];
+static DWORD dwLargest;
+static DWORD dwFiles;
+static DWORD dwDirs;
+
+static BYTE abData[READ_SIZE];
+
+static void Report(const char *pName, double dUnits, const char *pUnit)
+{
+    IMG_STATS sStats;
+
+    IMGGetStats(&sStats);
+    printf("%-24s %8lu sectors in %6lu reads", pName,
+           (unsigned long)sStats.dwReadSectors, (unsigned long)sStats.dwReadCalls);
+    if (dUnits > 0)
+    {
+        printf("  %10.2f sectors/%s", sStats.dwReadSectors / dUnits, pUnit);
+    }
+    printf("\n");
+
+    if (sStats.dwWriteSectors != 0)
+    {
+        printf("%-24s %8lu sectors in %6lu writes", "",
+               (unsigned long)sStats.dwWriteSectors, (unsigned long)sStats.dwWriteCalls);
+        if (dUnits > 0)
+        {
+            printf(" %10.2f sectors/%s", sStats.dwWriteSectors / dUnits, pUnit);
+        }
+        printf("\n");
+    }
+}
+
+static NUTFILE *Open(const char *pPath, int nMode)
+{
+    NUTFILE *hFile = devFATMMC0.dev_open(&devFATMMC0, pPath, nMode | _O_BINARY, 0);
+
+    return((hFile == (NUTFILE *)-1) ? NULL : hFile);
+}
+
+static int Seek(NUTFILE *hFile, long lPos)
+{
+    IOCTL_ARG3 sArgs;
+
+    sArgs.arg1 = hFile;
+    sArgs.arg2 = &lPos;
+    sArgs.arg3 = (void *)(uptr_t)SEEK_SET;
+
+    return(devFATMMC0.dev_ioctl(&devFATMMC0, FS_FILE_SEEK, &sArgs));
+}
+
+/*
+ * Byte dwPos of the file written by BenchWrite
+ */
+static BYTE Pattern(DWORD dwPos)
+{
+    return((BYTE)((dwPos >> 9) ^ dwPos));
+}
+
+/*
+ * Walk the tree below pPath, remember the first file of every depth
+ * and the largest file
+ */
+static void Walk(char *pPath, int nDepth)
+{
+    FATDIR   *pDir;
+    FATDIRENT sEntry;
+    size_t    nLen = strlen(pPath);
+
+    if ((pDir = FATDirOpen(&devFATMMC0, pPath)) == NULL)
+    {
+        return;
+    }
+    dwDirs++;
+
+    while (FATDirRead(pDir, &sEntry) == 1)
+    {
+        if (nLen + 1 + strlen(sEntry.szShortName) + 1 > MAX_PATH)
+        {
+            continue;
+        }
+        sprintf(&pPath[nLen], "/%s", sEntry.szShortName);
+
+        if (sEntry.bAttribute & FAT_ATTR_DIRECTORY)
+        {
+            if (nDepth < MAX_DEPTH)
+            {
+                Walk(pPath, nDepth + 1);
+            }
+        }
+        else
+        {
+            dwFiles++;
+            if (szDepthPath[nDepth][0] == 0)
+            {
+                strcpy(szDepthPath[nDepth], pPath);
+            }
+            if (sEntry.dwSize > dwLargest)
+            {
+                dwLargest = sEntry.dwSize;
+                strcpy(szLargest, pPath);
+            }
+        }
+        pPath[nLen] = 0;
+    }
+    FATDirClose(pDir);
+}
+
+static void BenchOpen(void)
+{
+    NUTFILE *hFile;
+    int nDepth;
+    int i;
+    char szName[32];
+
+    for (nDepth = 0; nDepth <= MAX_DEPTH; nDepth++)
+    {
+        if (szDepthPath[nDepth][0] == 0)
+        {
+            continue;
+        }
+
+        IMGResetStats();
+        if ((hFile = Open(szDepthPath[nDepth], _O_RDONLY)) == NULL)
+        {
+            printf("open depth %d: cannot open %s\n", nDepth, szDepthPath[nDepth]);
+            continue;
+        }
+        devFATMMC0.dev_close(hFile);
+        sprintf(szName, "open depth %d, first", nDepth);
+        Report(szName, 1, "open");
+
+        IMGResetStats();
+        for (i = 0; i < OPEN_REPEAT; i++)
+        {
+            if ((hFile = Open(szDepthPath[nDepth], _O_RDONLY)) != NULL)
+            {
+                devFATMMC0.dev_close(hFile);
+            }
+        }
+        sprintf(szName, "open depth %d, again", nDepth);
+        Report(szName, OPEN_REPEAT, "open");
+    }
+}
+
+static void BenchRead(const char *pPath, DWORD dwSize)
+{
+    NUTFILE *hFile;
+    DWORD dwTotal = 0;
+    int nRead;
+
+    if ((hFile = Open(pPath, _O_RDONLY)) == NULL)
+    {
+        printf("read: cannot open %s\n", pPath);
+        return;
+    }
+
+    IMGResetStats();
+    while ((nRead = devFATMMC0.dev_read(hFile, abData, sizeof(abData))) > 0)
+    {
+        dwTotal += nRead;
+    }
+    devFATMMC0.dev_close(hFile);
+
+    if (dwTotal != dwSize)
+    {
+        printf("read: got %lu of %lu bytes\n", (unsigned long)dwTotal, (unsigned long)dwSize);
+    }
+    Report("sequential read", dwTotal / 1048576.0, "MB");
+}
+
+static void BenchSeek(const char *pPath, DWORD dwSize)
+{
+    NUTFILE *hFile;
+    DWORD dwRandom = 12345;
+    DWORD dwPos;
+    int i;
+
+    if ((hFile = Open(pPath, _O_RDONLY)) == NULL)
+    {
+        printf("seek: cannot open %s\n", pPath);
+        return;
+    }
+
+    /* forward, in steps of 1/SEEK_COUNT of the file */
+    IMGResetStats();
+    for (i = 0; i < SEEK_COUNT; i++)
+    {
+        dwPos = (DWORD)(((unsigned long long)dwSize * i) / SEEK_COUNT);
+        if ((Seek(hFile, dwPos) != 0) || (devFATMMC0.dev_read(hFile, abData, SEEK_READ) <= 0))
+        {
+            printf("seek: failed at %lu\n", (unsigned long)dwPos);
+            break;
+        }
+    }
+    Report("seek forward + read", SEEK_COUNT, "seek");
+
+    /* random positions, same sequence on every run */
+    IMGResetStats();
+    for (i = 0; i < SEEK_COUNT; i++)
+    {
+        dwRandom = dwRandom * 1103515245 + 12345;
+        dwPos = dwRandom % (dwSize - SEEK_READ);
+        if ((Seek(hFile, dwPos) != 0) || (devFATMMC0.dev_read(hFile, abData, SEEK_READ) <= 0))
+        {
+            printf("seek: failed at %lu\n", (unsigned long)dwPos);
+            break;
+        }
+    }
+    Report("seek random + read", SEEK_COUNT, "seek");
+
+    devFATMMC0.dev_close(hFile);
+}
+
+/*
+ * Write WRITE_TOTAL bytes to a new (or truncated) file, then read them
+ * back to check the file
+ */
+static void BenchWrite(void)
+{
+    NUTFILE *hFile;
+    DWORD dwTotal;
+    DWORD dwBad = 0;
+    int nRead;
+    int i;
+
+    IMGResetStats();
+    if ((hFile = Open(WRITE_FILE, _O_WRONLY | _O_CREAT | _O_TRUNC)) == NULL)
+    {
+        printf("write: cannot create %s\n", WRITE_FILE);
+        return;
+    }
+    for (dwTotal = 0; dwTotal < WRITE_TOTAL; dwTotal += sizeof(abData))
+    {
+        for (i = 0; i < (int)sizeof(abData); i++)
+        {
+            abData[i] = Pattern(dwTotal + i);
+        }
+        if (devFATMMC0.dev_write(hFile, abData, sizeof(abData)) != (int)sizeof(abData))
+        {
+            printf("write: failed at %lu\n", (unsigned long)dwTotal);
+            break;
+        }
+    }
+    devFATMMC0.dev_close(hFile);
+    Report("sequential write", dwTotal / 1048576.0, "MB");
+
+    if ((hFile = Open(WRITE_FILE, _O_RDONLY)) == NULL)
+    {
+        printf("write: cannot open %s again\n", WRITE_FILE);
+        return;
+    }
+    dwTotal = 0;
+    while ((nRead = devFATMMC0.dev_read(hFile, abData, sizeof(abData))) > 0)
+    {
+        for (i = 0; i < nRead; i++)
+        {
+            if (abData[i] != Pattern(dwTotal + i))
+            {
+                dwBad++;
+            }
+        }
+        dwTotal += nRead;
+    }
+    devFATMMC0.dev_close(hFile);
+
+    if ((dwTotal != WRITE_TOTAL) || (dwBad != 0))
+    {
+        printf("write: read back %lu of %lu bytes, %lu wrong\n",
+               (unsigned long)dwTotal, (unsigned long)WRITE_TOTAL, (unsigned long)dwBad);
+    }
+}
+
+/*
+ * Create CREATE_COUNT small files in the root directory
+ */
+static void BenchCreate(void)
+{
+    NUTFILE *hFile;
+    char szName[16];
+    int i;
+
+    memset(abData, 'x', SEEK_READ);
+
+    IMGResetStats();
+    for (i = 0; i < CREATE_COUNT; i++)
+    {
+        sprintf(szName, "/FB%05d.DAT", i);
+        if ((hFile = Open(szName, _O_WRONLY | _O_CREAT | _O_TRUNC)) == NULL)
+        {
+            printf("create: cannot create %s\n", szName);
+            break;
+        }
+        if (devFATMMC0.dev_write(hFile, abData, SEEK_READ) != SEEK_READ)
+        {
+            printf("create: cannot write %s\n", szName);
+        }
+        devFATMMC0.dev_close(hFile);
+    }
+    Report("create + write + close", CREATE_COUNT, "file");
+}
+
+int main(int argc, char **argv)
+{
+    char szPath[MAX_PATH];
+    DWORD dwCluster;
+    NUTFILE *hFile;
+    int nWrite = 0;
+
+    if ((argc > 1) && (strcmp(argv[1], "-w") == 0))
+    {
+        nWrite = 1;
+        argc--;
+        argv++;
+    }
+
+    if ((argc < 2) || (argc > 3))
+    {
+        fprintf(stderr, "usage: fatbench [-w] <image> [file]\n");
+        return(2);
+    }
+
+    IMGSetImage(argv[1]);
+
+    if ((NutRegisterDevice(&devFAT, FAT_MODE_MMC, 0) != 0) ||
+        (NutRegisterDevice(&devFATMMC0, FAT_MODE_MMC, 0) != 0) ||
+        (FATGetClusterSize(&devFATMMC0, &dwCluster) != 0) || (dwCluster == 0))
+    {
+        fprintf(stderr, "%s: no FAT volume found\n", argv[1]);
+        return(1);
+    }
+    Report("mount", 0, NULL);
+    printf("cluster size %lu bytes\n", (unsigned long)dwCluster);
+
+    IMGResetStats();
+    szPath[0] = 0;
+    Walk(szPath, 0);
+    Report("walk tree", dwDirs, "dir");
+    printf("%lu directories, %lu files\n", (unsigned long)dwDirs, (unsigned long)dwFiles);
+
+    BenchOpen();
+
+    if (argc == 3)
+    {
+        strncpy(szLargest, argv[2], MAX_PATH - 1);
+        if ((hFile = Open(szLargest, _O_RDONLY)) == NULL)
+        {
+            fprintf(stderr, "%s: cannot open\n", szLargest);
+            return(1);
+        }
+        dwLargest = devFATMMC0.dev_size(hFile);
+        devFATMMC0.dev_close(hFile);
+    }
+
+    if (dwLargest > SEEK_READ)
+    {
+        printf("read and seek on %s, %lu bytes\n", szLargest, (unsigned long)dwLargest);
+        BenchRead(szLargest, dwLargest);
+        BenchSeek(szLargest, dwLargest);
+    }
+
+    if (nWrite)
+    {
+        BenchWrite();
+        BenchCreate();
+        FATSync();
+    }
+
+    return(0);
+}
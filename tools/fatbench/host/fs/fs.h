@@ -0,0 +1,12 @@
+#ifndef _FS_FS_H_
+#define _FS_FS_H_
+
+#define FS_FILE_SEEK    0x1301
+
+typedef struct {
+    void *arg1;
+    void *arg2;
+    void *arg3;
+} IOCTL_ARG3;
+
+#endif
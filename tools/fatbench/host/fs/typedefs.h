@@ -0,0 +1,10 @@
+#ifndef _FS_TYPEDEFS_H_
+#define _FS_TYPEDEFS_H_
+
+/* the FAT structures are laid out for 8, 16 and 32 bit fields */
+typedef uint8_t         BYTE;
+typedef uint16_t        WORD;
+typedef uint32_t        DWORD;
+typedef int32_t         LONG;
+
+#endif
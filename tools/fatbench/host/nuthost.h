@@ -0,0 +1,44 @@
+/*
+ * Host replacement of the Nut/OS compiler and type definitions that
+ * fat.c and imgdrv.c pick up through the Nut/OS headers. Included on
+ * the command line (-include), see ../Makefile.
+ */
+#ifndef _NutHost_H
+#define _NutHost_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>                  // u_char, u_short, u_int
+#include <time.h>
+
+typedef struct tm       tm;             // Nut/OS calls its struct _tm 'tm'
+
+typedef uintptr_t       uptr_t;
+
+typedef void *HANDLE;
+
+#define CONST           const
+#define INLINE          inline
+
+#ifndef TRUE
+#define TRUE            1
+#define FALSE           0
+#endif
+
+typedef char            prog_char;
+typedef const char     *PGM_P;
+#define PSTR(s)         (s)
+#define strcpy_P        strcpy
+#define strlen_P        strlen
+#define memcpy_P        memcpy
+
+#define _O_RDONLY       0x0000
+#define _O_WRONLY       0x0001
+#define _O_RDWR         0x0002
+#define _O_APPEND       0x0008
+#define _O_CREAT        0x0100
+#define _O_TRUNC        0x0200
+#define _O_EXCL         0x0400
+#define _O_BINARY       0x8000
+
+#endif /* _NutHost_H */
@@ -0,0 +1,36 @@
+#ifndef _SYS_DEVICE_H_
+#define _SYS_DEVICE_H_
+
+/* same layout as Nut/OS 4.3, without the Harvard write_P entry */
+typedef struct _NUTDEVICE NUTDEVICE;
+typedef struct _NUTFILE NUTFILE;
+
+struct _NUTFILE {
+    NUTFILE   *nf_next;
+    NUTDEVICE *nf_dev;
+    void      *nf_fcb;
+};
+
+struct _NUTDEVICE {
+    NUTDEVICE *dev_next;
+    char       dev_name[9];
+    u_char     dev_type;
+    uptr_t     dev_base;
+    u_char     dev_irq;
+    void      *dev_icb;
+    void      *dev_dcb;
+    int      (*dev_init) (NUTDEVICE *);
+    int      (*dev_ioctl) (NUTDEVICE *, int, void *);
+    int      (*dev_read) (NUTFILE *, void *, int);
+    int      (*dev_write) (NUTFILE *, CONST void *, int);
+    NUTFILE *(*dev_open) (NUTDEVICE *, CONST char *, int, int);
+    int      (*dev_close) (NUTFILE *);
+    long     (*dev_size) (NUTFILE *);
+};
+
+#define IFTYP_STREAM    1
+
+extern NUTDEVICE *NutDeviceLookup(CONST char *name);
+extern int NutRegisterDevice(NUTDEVICE *dev, uptr_t base, u_char irq);
+
+#endif
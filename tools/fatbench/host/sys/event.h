@@ -0,0 +1,11 @@
+#ifndef _SYS_EVENT_H_
+#define _SYS_EVENT_H_
+
+#define NUT_WAIT_INFINITE       0
+#define SIGNALED                ((HANDLE)-1)
+
+extern int NutEventWait(volatile HANDLE *qhp, u_long ms);
+extern int NutEventPost(volatile HANDLE *qhp);
+extern int NutEventBroadcast(volatile HANDLE *qhp);
+
+#endif
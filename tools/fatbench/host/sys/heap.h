@@ -0,0 +1,8 @@
+#ifndef _SYS_HEAP_H_
+#define _SYS_HEAP_H_
+
+extern void *NutHeapAlloc(size_t size);
+extern void *NutHeapAllocClear(size_t size);
+extern int NutHeapFree(void *block);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _SYS_THREAD_H_
+#define _SYS_THREAD_H_
+
+#define NutThreadYield()
+
+#endif
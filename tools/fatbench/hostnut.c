@@ -0,0 +1,110 @@
+/*
+ * The few Nut/OS routines fat.c needs, for a single threaded host build.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/heap.h>
+#include <sys/event.h>
+#include <sys/device.h>
+
+#include "typedefs.h"
+#include "log.h"
+#include "rtc.h"
+
+static NUTDEVICE *nutDeviceList;
+
+void *NutHeapAlloc(size_t size)
+{
+    return malloc(size);
+}
+
+void *NutHeapAllocClear(size_t size)
+{
+    return calloc(1, size);
+}
+
+int NutHeapFree(void *block)
+{
+    free(block);
+    return(0);
+}
+
+/*
+ * Nothing runs concurrently, a wait on the FAT semaphore always
+ * finds it posted.
+ */
+int NutEventWait(volatile HANDLE *qhp, u_long ms)
+{
+    return(0);
+}
+
+int NutEventPost(volatile HANDLE *qhp)
+{
+    return(0);
+}
+
+int NutEventBroadcast(volatile HANDLE *qhp)
+{
+    return(0);
+}
+
+NUTDEVICE *NutDeviceLookup(CONST char *name)
+{
+    NUTDEVICE *dev;
+
+    for (dev = nutDeviceList; dev != NULL; dev = dev->dev_next)
+    {
+        if (strcmp(dev->dev_name, name) == 0)
+        {
+            break;
+        }
+    }
+    return(dev);
+}
+
+int NutRegisterDevice(NUTDEVICE *dev, uptr_t base, u_char irq)
+{
+    if (base)
+    {
+        dev->dev_base = base;
+    }
+    if (irq)
+    {
+        dev->dev_irq = irq;
+    }
+    if (dev->dev_init && dev->dev_init(dev) != 0)
+    {
+        return(-1);
+    }
+    if (NutDeviceLookup(dev->dev_name) == NULL)
+    {
+        dev->dev_next = nutDeviceList;
+        nutDeviceList = dev;
+    }
+    return(0);
+}
+
+/*
+ * The log goes to stderr, the RTC is the host clock.
+ */
+void LogMsg_P(TLogLevel tLevel, PGM_P szMsg, ...)
+{
+    va_list ap;
+
+    va_start(ap, szMsg);
+    vfprintf(stderr, szMsg, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+int X12RtcGetClock(tm *tm)
+{
+    time_t now = time(NULL);
+
+    *tm = *localtime(&now);
+    return(0);
+}